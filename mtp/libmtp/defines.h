@@ -308,6 +308,9 @@
 #define MTP_PROPERTY_TIME_TO_LIVE                           0xDD71
 #define MTP_PROPERTY_MEDIA_GUID                             0xDD72
 
+// Vendor extension Object Property Codes
+#define MTP_PROPERTY_VENDOR_CRC32C                          0xDE01   // CRC32C of content, 0 when not known yet
+
 // MTP Device Property Codes
 #define MTP_DEVICE_PROPERTY_UNDEFINED                       0x5000
 #define MTP_DEVICE_PROPERTY_BATTERY_LEVEL                   0x5001
@@ -406,6 +409,33 @@
 // Called to commit changes made by SendPartialObject and TruncateObject
 #define MTP_OPERATION_END_EDIT_OBJECT                       0x95C5
 
+// Vendor extensions
+
+// Streams manifest of all objects: handle, size, mtime, format, checksum, name
+#define MTP_OPERATION_VENDOR_GET_SYNC_MANIFEST              0x9701
+// GetObject streaming LZ4 frame, data phase length is 0xFFFFFFFF (ends with short packet)
+#define MTP_OPERATION_VENDOR_GET_OBJECT_COMPRESSED          0x9702
+// SendObject taking LZ4 frame with independent blocks up to 4KiB, follows SendObjectInfo
+#define MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED         0x9703
+// Data phase announces CRC32C, size and SHA-256 of object about to be sent. Ok means identical content is on
+// the device: following SendObjectInfo creates the object, no SendObject needed
+#define MTP_OPERATION_VENDOR_SEND_OBJECT_HASH               0x9704
+// Reports upload interrupted before all data arrived: handle (param 1, 0 for the most recent one). Response
+// parameters are handle, bytes received and object size. Upload is resumed by SendPartialObject at that offset
+#define MTP_OPERATION_VENDOR_GET_PARTIAL_UPLOAD             0x9705
+// Data phase is ustar archive of regular files, each stored as a new object. Files with a path, not just a name,
+// fail. Response parameters are number of files in the archive, number stored and index of the first one which
+// failed (0xFFFFFFFF when none did)
+#define MTP_OPERATION_VENDOR_SEND_ARCHIVE                   0x9706
+// Streams ustar archive of objects in storage (param 1) under parent (param 2, 0xFFFFFFFF for all), data phase
+// length is 0xFFFFFFFF (ends with short packet). Response parameter is number of files in the archive
+#define MTP_OPERATION_VENDOR_GET_ARCHIVE                    0x9707
+// Data phase is search query dataset (see mtp_storage.h) for objects in storage (param 1). Response parameter is
+// number of matching objects, their handles are taken with GetSearchResults
+#define MTP_OPERATION_VENDOR_SEND_SEARCH_QUERY              0x9708
+// Data phase is array of handles matched by preceding SendSearchQuery, as in GetObjectHandles. Results are given once
+#define MTP_OPERATION_VENDOR_GET_SEARCH_RESULTS             0x9709
+
 // MTP Response Codes
 #define MTP_RESPONSE_UNDEFINED                                  0x2000
 #define MTP_RESPONSE_OK                                         0x2001
@@ -451,6 +481,9 @@
 #define MTP_RESPONSE_OBJECT_TOO_LARGE                           0xA809
 #define MTP_RESPONSE_OBJECT_PROP_NOT_SUPPORTED                  0xA80A
 
+// Vendor extension Response Codes
+#define MTP_RESPONSE_VENDOR_NO_MATCHING_OBJECT                  0xA001
+
 // MTP Event Codes
 #define MTP_EVENT_UNDEFINED                         0x4000
 #define MTP_EVENT_CANCEL_TRANSACTION                0x4001
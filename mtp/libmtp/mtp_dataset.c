@@ -50,22 +50,32 @@ const uint16_t MTP_SUPPORTED_OPERATIONS[] =
 ///    MTP_OPERATION_SKIP,
     // Android extension for direct file IO
 //    MTP_OPERATION_GET_PARTIAL_OBJECT_64,
-//    MTP_OPERATION_SEND_PARTIAL_OBJECT,
+    MTP_OPERATION_SEND_PARTIAL_OBJECT,
 //    MTP_OPERATION_TRUNCATE_OBJECT,
 //    MTP_OPERATION_BEGIN_EDIT_OBJECT,
 //    MTP_OPERATION_END_EDIT_OBJECT,
+    // Vendor extensions
+    MTP_OPERATION_VENDOR_GET_SYNC_MANIFEST,
+    MTP_OPERATION_VENDOR_GET_OBJECT_COMPRESSED,
+    MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED,
+    MTP_OPERATION_VENDOR_SEND_OBJECT_HASH,
+    MTP_OPERATION_VENDOR_GET_PARTIAL_UPLOAD,
+    MTP_OPERATION_VENDOR_SEND_ARCHIVE,
+    MTP_OPERATION_VENDOR_GET_ARCHIVE,
+    MTP_OPERATION_VENDOR_SEND_SEARCH_QUERY,
+    MTP_OPERATION_VENDOR_GET_SEARCH_RESULTS,
 };
 
 const uint16_t MTP_SUPPORTED_EVENTS[] =
 {
 //	MTP_EVENT_UNDEFINED,
 	MTP_EVENT_CANCEL_TRANSACTION,
-//	MTP_EVENT_OBJECT_ADDED,
-//	MTP_EVENT_OBJECT_REMOVED,
+	MTP_EVENT_OBJECT_ADDED,
+	MTP_EVENT_OBJECT_REMOVED,
 //	MTP_EVENT_STORE_ADDED,
 //	MTP_EVENT_STORE_REMOVED,
 //	MTP_EVENT_DEVICE_PROP_CHANGED,
-//	MTP_EVENT_OBJECT_INFO_CHANGED,
+	MTP_EVENT_OBJECT_INFO_CHANGED,
 //	MTP_EVENT_DEVICE_INFO_CHANGED,
 //	MTP_EVENT_REQUEST_OBJECT_TRANSFER,
 //	MTP_EVENT_STORE_FULL,
@@ -0,0 +1,589 @@
+/*
+ * Copyright  Onplick <info@onplick.com> - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+#include <string.h>
+
+#include "mtp_lz4.h"
+
+#define LZ4_MAGIC (0x184D2204)
+#define LZ4_SKIPPABLE_MAGIC (0x184D2A50)
+#define LZ4_FLG_VERSION (0x40)
+#define LZ4_FLG_VERSION_MASK (0xC0)
+#define LZ4_FLG_BLOCK_INDEPENDENT (0x20)
+#define LZ4_FLG_BLOCK_CHECKSUM (0x10)
+#define LZ4_FLG_CONTENT_SIZE (0x08)
+#define LZ4_FLG_CONTENT_CHECKSUM (0x04)
+#define LZ4_FLG_DICT_ID (0x01)
+#define LZ4_BD_64KB (0x40)
+#define LZ4_BLOCK_UNCOMPRESSED (0x80000000)
+
+#define MIN_MATCH (4)
+#define LAST_LITERALS (5)
+#define MF_LIMIT (12)
+
+/* Full speed bulk packet, high speed one is a multiple of it */
+#define PACKET_SIZE (64)
+
+#define PRIME32_1 (2654435761U)
+#define PRIME32_2 (2246822519U)
+#define PRIME32_3 (3266489917U)
+#define PRIME32_4 (668265263U)
+#define PRIME32_5 (374761393U)
+
+/* Compressed block is decoded as it comes, sequence by sequence */
+enum {
+    SEQUENCE_TOKEN,
+    SEQUENCE_LITERAL_LENGTH,
+    SEQUENCE_LITERALS,
+    SEQUENCE_OFFSET_LOW,
+    SEQUENCE_OFFSET_HIGH,
+    SEQUENCE_MATCH_LENGTH,
+};
+
+enum {
+    DECODER_MAGIC,
+    DECODER_DESCRIPTOR,
+    DECODER_DESCRIPTOR_REST,
+    DECODER_BLOCK_SIZE,
+    DECODER_BLOCK_DATA,
+    DECODER_BLOCK_CHECKSUM,
+    DECODER_CONTENT_CHECKSUM,
+    DECODER_DONE,
+    DECODER_ERROR,
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t xxh32_round(uint32_t acc, uint32_t input)
+{
+    acc += input * PRIME32_2;
+    acc = rotl32(acc, 13);
+    return acc * PRIME32_1;
+}
+
+uint32_t mtp_lz4_xxh32(const void *data, size_t length, uint32_t seed)
+{
+    const uint8_t *p = data;
+    const uint8_t *const end = p + length;
+    uint32_t h32;
+
+    if (length >= 16)
+    {
+        uint32_t v1 = seed + PRIME32_1 + PRIME32_2;
+        uint32_t v2 = seed + PRIME32_2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - PRIME32_1;
+        do {
+            v1 = xxh32_round(v1, get_le32(p));
+            v2 = xxh32_round(v2, get_le32(p + 4));
+            v3 = xxh32_round(v3, get_le32(p + 8));
+            v4 = xxh32_round(v4, get_le32(p + 12));
+            p += 16;
+        } while (end - p >= 16);
+        h32 = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    }
+    else
+    {
+        h32 = seed + PRIME32_5;
+    }
+
+    h32 += (uint32_t)length;
+    while (end - p >= 4)
+    {
+        h32 += get_le32(p) * PRIME32_3;
+        h32 = rotl32(h32, 17) * PRIME32_4;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h32 += (*p) * PRIME32_5;
+        h32 = rotl32(h32, 11) * PRIME32_1;
+        p++;
+    }
+
+    h32 ^= h32 >> 15;
+    h32 *= PRIME32_2;
+    h32 ^= h32 >> 13;
+    h32 *= PRIME32_3;
+    h32 ^= h32 >> 16;
+    return h32;
+}
+
+static uint32_t read_32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash_32(uint32_t sequence)
+{
+    return (sequence * PRIME32_1) >> (32 - MTP_LZ4_HASH_LOG);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/* Literals followed by match, match is omitted in the last sequence */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend,
+        const uint8_t *literals, size_t literal_length, size_t offset, size_t match_length)
+{
+    uint8_t *token;
+    size_t worst = 1 + literal_length + literal_length / 255 + 1 + (offset ? 3 + match_length / 255 : 0);
+
+    if ((size_t)(oend - op) < worst)
+        return NULL;
+
+    token = op++;
+    if (literal_length >= 15)
+    {
+        *token = 15 << 4;
+        op = put_length(op, literal_length - 15);
+    }
+    else
+    {
+        *token = (uint8_t)(literal_length << 4);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (offset)
+    {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        match_length -= MIN_MATCH;
+        if (match_length >= 15)
+        {
+            *token |= 15;
+            op = put_length(op, match_length - 15);
+        }
+        else
+        {
+            *token |= (uint8_t)match_length;
+        }
+    }
+    return op;
+}
+
+/* Greedy single probe matcher. Positions are kept as 16 bit offsets,
+ * so blocks can't exceed 64KiB, which is also LZ4 window size. */
+size_t mtp_lz4_compress(mtp_lz4_encoder_t *encoder, const uint8_t *src, size_t length,
+        uint8_t *dst, size_t capacity)
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *const iend = src + length;
+    uint8_t *op = dst;
+    const uint8_t *const oend = dst + capacity;
+
+    if (length > 0xFFFF)
+        return 0;
+
+    memset(encoder->table, 0, sizeof(encoder->table));
+    if (length > MF_LIMIT)
+    {
+        const uint8_t *const mflimit = iend - MF_LIMIT;
+        const uint8_t *const matchlimit = iend - LAST_LITERALS;
+
+        while (ip < mflimit)
+        {
+            const uint32_t sequence = read_32(ip);
+            const uint32_t h = hash_32(sequence);
+            const uint8_t *ref = src + encoder->table[h];
+            const uint8_t *match_end;
+            const uint8_t *ref_end;
+
+            encoder->table[h] = (uint16_t)(ip - src);
+            if (ref >= ip || read_32(ref) != sequence)
+            {
+                ip++;
+                continue;
+            }
+
+            match_end = ip + MIN_MATCH;
+            ref_end = ref + MIN_MATCH;
+            while (match_end < matchlimit && *match_end == *ref_end)
+            {
+                match_end++;
+                ref_end++;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, match_end - ip);
+            if (!op)
+                return 0;
+            ip = anchor = match_end;
+        }
+    }
+
+    op = put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *length)
+{
+    uint8_t byte;
+
+    do {
+        if (*ip >= iend)
+            return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int mtp_lz4_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity)
+{
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + length;
+    uint8_t *op = dst;
+    const uint8_t *const oend = dst + capacity;
+
+    while (ip < iend)
+    {
+        const uint8_t token = *ip++;
+        size_t literal_length = token >> 4;
+        size_t match_length = token & 15;
+        size_t offset;
+        const uint8_t *match;
+
+        if (literal_length == 15 && get_length(&ip, iend, &literal_length))
+            return -1;
+        if (literal_length > (size_t)(iend - ip) || literal_length > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+
+        if (match_length == 15 && get_length(&ip, iend, &match_length))
+            return -1;
+        match_length += MIN_MATCH;
+        if (match_length > (size_t)(oend - op))
+            return -1;
+
+        /* Byte by byte, match may overlap bytes being written */
+        match = op - offset;
+        while (match_length--)
+            *op++ = *match++;
+    }
+
+    return (int)(op - dst);
+}
+
+size_t mtp_lz4_frame_header(uint8_t *dst)
+{
+    put_le32(dst, LZ4_MAGIC);
+    dst[4] = LZ4_FLG_VERSION | LZ4_FLG_BLOCK_INDEPENDENT;
+    dst[5] = LZ4_BD_64KB;
+    dst[6] = (uint8_t)(mtp_lz4_xxh32(&dst[4], 2, 0) >> 8);
+    return MTP_LZ4_FRAME_HEADER_SIZE;
+}
+
+size_t mtp_lz4_frame_block(mtp_lz4_encoder_t *encoder, const uint8_t *src, size_t length,
+        uint8_t *dst, bool compress)
+{
+    size_t packed = 0;
+
+    /* Block is worth compressing only if it gets smaller */
+    if (compress && length > 1)
+        packed = mtp_lz4_compress(encoder, src, length, dst + 4, length - 1);
+
+    if (packed)
+    {
+        put_le32(dst, (uint32_t)packed);
+        return 4 + packed;
+    }
+
+    put_le32(dst, (uint32_t)length | LZ4_BLOCK_UNCOMPRESSED);
+    memcpy(dst + 4, src, length);
+    return 4 + length;
+}
+
+size_t mtp_lz4_frame_end(uint8_t *dst, size_t stream_length)
+{
+    size_t written = 4;
+
+    put_le32(dst, 0);
+    if ((stream_length + written) % PACKET_SIZE == 0)
+    {
+        put_le32(dst + 4, LZ4_SKIPPABLE_MAGIC);
+        put_le32(dst + 8, 0);
+        written += 8;
+    }
+    return written;
+}
+
+void mtp_lz4_decoder_init(mtp_lz4_decoder_t *decoder)
+{
+    decoder->state = DECODER_MAGIC;
+    decoder->flags = 0;
+    decoder->sequence = SEQUENCE_TOKEN;
+    decoder->need = 4;
+    decoder->have = 0;
+    decoder->block = 0;
+    decoder->produced = 0;
+}
+
+static void expect_next(mtp_lz4_decoder_t *decoder, uint8_t state, uint32_t need)
+{
+    decoder->state = state;
+    decoder->need = need;
+    decoder->have = 0;
+}
+
+static void expect_block(mtp_lz4_decoder_t *decoder)
+{
+    expect_next(decoder, DECODER_BLOCK_SIZE, 4);
+}
+
+/* Field of current state is complete, act on it */
+static int decoder_step(mtp_lz4_decoder_t *decoder, mtp_lz4_sink_t sink, void *arg)
+{
+    const uint8_t *field = decoder->descriptor;
+    uint32_t size;
+
+    switch (decoder->state)
+    {
+        case DECODER_MAGIC:
+            if (get_le32(field) != LZ4_MAGIC)
+                return -1;
+            expect_next(decoder, DECODER_DESCRIPTOR, 2);
+            break;
+        case DECODER_DESCRIPTOR:
+            decoder->flags = field[0];
+            /* Linked blocks would need previous block kept as dictionary */
+            if ((decoder->flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION ||
+                    !(decoder->flags & LZ4_FLG_BLOCK_INDEPENDENT) ||
+                    (decoder->flags & LZ4_FLG_DICT_ID))
+                return -1;
+            /* Larger maximum block size would need larger match window */
+            if (field[1] != LZ4_BD_64KB)
+                return -1;
+            expect_next(decoder, DECODER_DESCRIPTOR_REST,
+                    ((decoder->flags & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + 1);
+            break;
+        case DECODER_DESCRIPTOR_REST:
+            size = 2 + decoder->need - 1;
+            if (field[size] != (uint8_t)(mtp_lz4_xxh32(field, size, 0) >> 8))
+                return -1;
+            expect_block(decoder);
+            break;
+        case DECODER_BLOCK_SIZE:
+            decoder->block = get_le32(field);
+            size = decoder->block & ~LZ4_BLOCK_UNCOMPRESSED;
+            if (decoder->block == 0)
+            {
+                if (decoder->flags & LZ4_FLG_CONTENT_CHECKSUM)
+                    expect_next(decoder, DECODER_CONTENT_CHECKSUM, 4);
+                else
+                    expect_next(decoder, DECODER_DONE, 0);
+            }
+            else if (size == 0 || size > MTP_LZ4_DECODER_BLOCK_SIZE)
+            {
+                return -1;
+            }
+            else
+            {
+                expect_next(decoder, DECODER_BLOCK_DATA, size);
+                decoder->sequence = SEQUENCE_TOKEN;
+                decoder->produced = 0;
+            }
+            break;
+        /* Stored block went to sink as it came, compressed one must end
+         * with literals of its last sequence */
+        case DECODER_BLOCK_DATA:
+            if (!(decoder->block & LZ4_BLOCK_UNCOMPRESSED))
+            {
+                if (decoder->sequence != SEQUENCE_OFFSET_LOW ||
+                        sink(arg, decoder->out, decoder->produced) < 0)
+                    return -1;
+            }
+            if (decoder->flags & LZ4_FLG_BLOCK_CHECKSUM)
+                expect_next(decoder, DECODER_BLOCK_CHECKSUM, 4);
+            else
+                expect_block(decoder);
+            break;
+        /* Checksums are skipped, transfer integrity is up to CRC32C property */
+        case DECODER_BLOCK_CHECKSUM:
+            expect_block(decoder);
+            break;
+        case DECODER_CONTENT_CHECKSUM:
+            expect_next(decoder, DECODER_DONE, 0);
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/* Match is copied byte by byte, it may overlap bytes being written */
+static int copy_match(mtp_lz4_decoder_t *decoder)
+{
+    const uint32_t length = decoder->length + MIN_MATCH;
+    const uint8_t *match = &decoder->out[decoder->produced - decoder->offset];
+    uint8_t *op = &decoder->out[decoder->produced];
+    uint32_t i;
+
+    if (length > sizeof(decoder->out) - decoder->produced)
+        return -1;
+    for (i = 0; i < length; i++)
+        op[i] = match[i];
+    decoder->produced += length;
+    decoder->sequence = SEQUENCE_TOKEN;
+    return 0;
+}
+
+/* Part of compressed block, decoded into match window */
+static int decode_sequences(mtp_lz4_decoder_t *decoder, const uint8_t *p, size_t length)
+{
+    const uint8_t *const end = p + length;
+    size_t chunk;
+
+    while (p < end)
+    {
+        switch (decoder->sequence)
+        {
+            case SEQUENCE_TOKEN:
+                decoder->token = *p++;
+                decoder->length = decoder->token >> 4;
+                decoder->sequence = (decoder->length == 15) ? SEQUENCE_LITERAL_LENGTH
+                                  : decoder->length ? SEQUENCE_LITERALS : SEQUENCE_OFFSET_LOW;
+                break;
+            case SEQUENCE_LITERAL_LENGTH:
+                decoder->length += *p;
+                if (*p++ != 255)
+                    decoder->sequence = SEQUENCE_LITERALS;
+                break;
+            case SEQUENCE_LITERALS:
+                chunk = (size_t)(end - p) < decoder->length ? (size_t)(end - p) : decoder->length;
+                if (chunk > sizeof(decoder->out) - decoder->produced)
+                    return -1;
+                memcpy(&decoder->out[decoder->produced], p, chunk);
+                decoder->produced += chunk;
+                decoder->length -= chunk;
+                p += chunk;
+                if (!decoder->length)
+                    decoder->sequence = SEQUENCE_OFFSET_LOW;
+                break;
+            case SEQUENCE_OFFSET_LOW:
+                decoder->offset = *p++;
+                decoder->sequence = SEQUENCE_OFFSET_HIGH;
+                break;
+            case SEQUENCE_OFFSET_HIGH:
+                decoder->offset |= (uint32_t)*p++ << 8;
+                if (decoder->offset == 0 || decoder->offset > decoder->produced)
+                    return -1;
+                decoder->length = decoder->token & 15;
+                if (decoder->length == 15)
+                    decoder->sequence = SEQUENCE_MATCH_LENGTH;
+                else if (copy_match(decoder))
+                    return -1;
+                break;
+            case SEQUENCE_MATCH_LENGTH:
+                decoder->length += *p;
+                if (*p++ != 255 && copy_match(decoder))
+                    return -1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return 0;
+}
+
+int mtp_lz4_decoder_feed(mtp_lz4_decoder_t *decoder, const void *data, size_t length,
+        mtp_lz4_sink_t sink, void *arg)
+{
+    const uint8_t *p = data;
+
+    while (length && decoder->state != DECODER_DONE)
+    {
+        uint8_t *field;
+        size_t chunk;
+        int status = 0;
+
+        if (decoder->state == DECODER_ERROR)
+            return -1;
+
+        chunk = decoder->need - decoder->have;
+        if (chunk > length)
+            chunk = length;
+
+        /* Block data isn't gathered, stored one goes straight to sink */
+        if (decoder->state == DECODER_BLOCK_DATA)
+        {
+            if (decoder->block & LZ4_BLOCK_UNCOMPRESSED)
+                status = (sink(arg, p, chunk) < 0) ? -1 : 0;
+            else
+                status = decode_sequences(decoder, p, chunk);
+        }
+        else
+        {
+            field = (decoder->state == DECODER_DESCRIPTOR_REST) ? &decoder->descriptor[2] : decoder->descriptor;
+            memcpy(field + decoder->have, p, chunk);
+        }
+        if (status)
+        {
+            decoder->state = DECODER_ERROR;
+            return -1;
+        }
+        decoder->have += chunk;
+        p += chunk;
+        length -= chunk;
+
+        if (decoder->have == decoder->need && decoder_step(decoder, sink, arg))
+        {
+            decoder->state = DECODER_ERROR;
+            return -1;
+        }
+    }
+
+    /* Anything past the frame, like skippable padding, is ignored */
+    return (decoder->state == DECODER_ERROR) ? -1 : 0;
+}
+
+bool mtp_lz4_decoder_done(const mtp_lz4_decoder_t *decoder)
+{
+    return decoder->state == DECODER_DONE;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright  Onplick <info@onplick.com> - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+#ifndef _MTP_LZ4_H
+#define _MTP_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Minimal LZ4 frame codec used by compressed object transfers. Encoder writes
+ * independent blocks of at most MTP_LZ4_BLOCK_SIZE bytes, no checksums.
+ * Decoder takes independent blocks with maximum block size of 64 KiB (BD 4),
+ * the smallest the frame format has and the default of LZ4F encoders. Frames
+ * with larger maximum, like ones of lz4 CLI default -B7, are refused. Decoded
+ * block is kept as match window, compressed data isn't buffered, so both
+ * directions run in a fixed amount of memory. */
+#define MTP_LZ4_BLOCK_SIZE (4096)
+#define MTP_LZ4_DECODER_BLOCK_SIZE (64 * 1024)
+#define MTP_LZ4_HASH_LOG (10)
+#define MTP_LZ4_FRAME_HEADER_SIZE (7)
+/* Block size word plus data, incompressible blocks are stored as is */
+#define MTP_LZ4_BLOCK_MAX_SIZE (4 + MTP_LZ4_BLOCK_SIZE)
+/* End mark plus optional empty skippable frame */
+#define MTP_LZ4_FRAME_END_MAX_SIZE (4 + 8)
+
+typedef int (*mtp_lz4_sink_t)(void *arg, const void *data, size_t length);
+
+typedef struct mtp_lz4_encoder {
+    uint16_t table[1 << MTP_LZ4_HASH_LOG];
+} mtp_lz4_encoder_t;
+
+typedef struct mtp_lz4_decoder {
+    uint8_t state;
+    uint8_t flags;
+    uint8_t sequence;       /* part of LZ4 sequence expected next */
+    uint8_t token;
+    uint8_t descriptor[15];
+    uint32_t need;
+    uint32_t have;
+    uint32_t block;
+    uint32_t length;        /* of literals or match being read */
+    uint32_t offset;
+    uint32_t produced;      /* decoded bytes of current block */
+    uint8_t out[MTP_LZ4_DECODER_BLOCK_SIZE];
+} mtp_lz4_decoder_t;
+
+/** @brief xxHash32, used for frame descriptor checksum */
+uint32_t mtp_lz4_xxh32(const void *data, size_t length, uint32_t seed);
+
+/** @brief Compress block in LZ4 block format
+ *  @return compressed length, 0 if it doesn't fit in capacity */
+size_t mtp_lz4_compress(mtp_lz4_encoder_t *encoder, const uint8_t *src, size_t length,
+        uint8_t *dst, size_t capacity);
+
+/** @brief Decompress block in LZ4 block format
+ *  @return decompressed length, -1 on malformed input or overflow */
+int mtp_lz4_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity);
+
+/** @brief Write frame header: independent blocks, no checksums
+ *  @return MTP_LZ4_FRAME_HEADER_SIZE */
+size_t mtp_lz4_frame_header(uint8_t *dst);
+
+/** @brief Write one frame block, at most MTP_LZ4_BLOCK_MAX_SIZE bytes
+ *  @param compress false stores data uncompressed
+ *  @return bytes written */
+size_t mtp_lz4_frame_block(mtp_lz4_encoder_t *encoder, const uint8_t *src, size_t length,
+        uint8_t *dst, bool compress);
+
+/** @brief Write end mark. Data phase of unknown length is terminated by short
+ *         packet, so when stream would end on 64 byte boundary an empty
+ *         skippable frame is appended.
+ *  @param stream_length bytes sent so far, including container header
+ *  @return bytes written */
+size_t mtp_lz4_frame_end(uint8_t *dst, size_t stream_length);
+
+void mtp_lz4_decoder_init(mtp_lz4_decoder_t *decoder);
+
+/** @brief Feed next part of frame, decoded data is passed to sink
+ *  @return zero on success, -1 on malformed frame or sink failure */
+int mtp_lz4_decoder_feed(mtp_lz4_decoder_t *decoder, const void *data, size_t length,
+        mtp_lz4_sink_t sink, void *arg);
+
+/** @brief True once end mark of the frame has been consumed */
+bool mtp_lz4_decoder_done(const mtp_lz4_decoder_t *decoder);
+
+#endif /* _MTP_LZ4_H */
@@ -13,9 +13,59 @@
 #include "mtp_container.h"
 #include "mtp_storage.h"
 #include "mtp_dataset.h"
+#include "mtp_lz4.h"
 #include "log.hpp"
 
 #define UNUSED(x) do { (void)(x); } while (0)
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+/* Data phase of length not known up front, terminated by short packet */
+#define DATA_LENGTH_UNKNOWN (0xFFFFFFFF)
+
+/* Object data passing through LZ4 frame codec, compressed on the way out,
+ * decompressed on the way in. Staged output may span data frames. */
+struct lz4_transfer
+{
+    bool compress;
+    bool finished;
+    bool write_failed;
+    size_t produced;
+    uint16_t length;
+    uint16_t offset;
+    union {
+        struct {
+            mtp_lz4_encoder_t encoder;
+            uint8_t in[MTP_LZ4_BLOCK_SIZE];
+            uint8_t out[MTP_LZ4_BLOCK_MAX_SIZE];
+        };
+        mtp_lz4_decoder_t decoder;
+    };
+};
+
+/* Archive being unpacked or packed, headers and payloads may span data frames */
+struct archive_transfer
+{
+    bool ended;
+    uint16_t filled;            /* bytes of header gathered or sent */
+    uint16_t length;            /* bytes of header to send */
+    uint16_t padding;           /* bytes left up to next header */
+    uint64_t remaining;         /* payload bytes of current entry left */
+    uint32_t handle;            /* object being written, 0 if none */
+    uint32_t next_handle;       /* next listed object to send */
+    uint32_t entries;
+    uint32_t stored;
+    uint32_t first_failed;
+    uint8_t header[MTP_ARCHIVE_HEADER_MAX_SIZE];
+};
+
+/* Upload interrupted before all data arrived, kept for resuming */
+struct staged_upload
+{
+    uint32_t handle;
+    uint32_t received;
+    uint32_t size;
+    uint32_t since;
+};
 
 struct mtp_responder
 {
@@ -31,10 +81,12 @@ struct mtp_responder
         uint16_t prop_code;
         uint16_t opcode;
         uint32_t handle;
+        uint32_t object;            /* as reported to the application */
         size_t total;
         size_t in_buffer;
         bool file_open;
         bool keep;
+        size_t offset;              /* object data preceding this data phase */
         union {
             size_t sent;
             size_t received;
@@ -45,6 +97,51 @@ struct mtp_responder
         mtp_data_cntr_t *cntr;
     };
     size_t buf_size;
+
+    /* Sync manifest being streamed, entries may span data frames */
+    struct {
+        uint32_t count;
+        uint32_t listed;
+        uint32_t next_handle;
+        uint16_t length;
+        uint16_t offset;
+        uint8_t entry[MTP_MANIFEST_ENTRY_MAX_SIZE];
+    } manifest;
+
+    /* Allocated for compressed object transfers only */
+    struct lz4_transfer *lz4;
+
+    /* Allocated for archive uploads only */
+    struct archive_transfer *archive;
+
+    /* Results of the last SendSearchQuery, kept by storage */
+    struct {
+        uint32_t count;
+        bool ready;
+    } search;
+
+    /* Created by SendObjectInfo, waits for SendObject to take it, 0 if none */
+    uint32_t pending;
+
+    /* Content announced by SendObjectHash, consumed by following SendObjectInfo */
+    struct {
+        uint32_t source;
+        mtp_object_hash_t hash;
+    } duplicate;
+
+    /* Interrupted uploads, free slots have handle 0 */
+    struct {
+        struct staged_upload uploads[CONFIG_MTP_STAGED_UPLOADS];
+        uint32_t timeout;
+        uint32_t now;
+        uint32_t latest;
+    } staging;
+
+    /* Response parameters of operations which don't create objects */
+    struct {
+        uint32_t parameter[3];
+        uint8_t count;
+    } response;
 };
 
 typedef struct {
@@ -95,6 +192,16 @@ static const char* dbg_operation(uint16_t op)
         { "MTP_OPERATION_GET_OBJECT_REFERENCES", 0x9810 },
         { "MTP_OPERATION_SET_OBJECT_REFERENCES", 0x9811 },
         { "MTP_OPERATION_SKIP", 0x9820 },
+        { "MTP_OPERATION_SEND_PARTIAL_OBJECT", 0x95C2 },
+        { "MTP_OPERATION_VENDOR_GET_SYNC_MANIFEST", 0x9701 },
+        { "MTP_OPERATION_VENDOR_GET_OBJECT_COMPRESSED", 0x9702 },
+        { "MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED", 0x9703 },
+        { "MTP_OPERATION_VENDOR_SEND_OBJECT_HASH", 0x9704 },
+        { "MTP_OPERATION_VENDOR_GET_PARTIAL_UPLOAD", 0x9705 },
+        { "MTP_OPERATION_VENDOR_SEND_ARCHIVE", 0x9706 },
+        { "MTP_OPERATION_VENDOR_GET_ARCHIVE", 0x9707 },
+        { "MTP_OPERATION_VENDOR_SEND_SEARCH_QUERY", 0x9708 },
+        { "MTP_OPERATION_VENDOR_GET_SEARCH_RESULTS", 0x9709 },
         { NULL, 0 }
     };
     const dbg_map_entry_t *e = ops;
@@ -190,6 +297,7 @@ static const char* dbg_result(uint16_t result)
         { "MTP_RESPONSE_SPECIFICATION_BY_DEPTH_UNSUPPORTED", 0xA808 },
         { "MTP_RESPONSE_OBJECT_TOO_LARGE", 0xA809 },
         { "MTP_RESPONSE_OBJECT_PROP_NOT_SUPPORTED", 0xA80A },
+        { "MTP_RESPONSE_VENDOR_NO_MATCHING_OBJECT", 0xA001 },
         { NULL, 0 }
     };
     const dbg_map_entry_t *e = results;
@@ -208,6 +316,7 @@ void mtp_responder_init(mtp_responder_t *mtp)
 {
     assert(mtp);
     memset(mtp, 0, sizeof(mtp_responder_t));
+    mtp->staging.timeout = CONFIG_MTP_STAGING_TIMEOUT;
 }
 
 mtp_responder_t* mtp_responder_alloc(void)
@@ -218,6 +327,8 @@ mtp_responder_t* mtp_responder_alloc(void)
 void mtp_responder_free(mtp_responder_t *mtp)
 {
     assert(mtp);
+    free(mtp->lz4);
+    free(mtp->archive);
     free(mtp);
 }
 
@@ -268,11 +379,93 @@ static void set_data_header(mtp_responder_t *mtp)
     mtp->cntr->header.type = MTP_CONTAINER_TYPE_DATA;
     mtp->cntr->header.operation_code = mtp->transaction.opcode;
     mtp->cntr->header.transaction_id = mtp->transaction.id;
-    mtp->cntr->header.length = MTP_CONTAINER_HEADER_SIZE + mtp->transaction.total;
+    if (mtp->transaction.total == DATA_LENGTH_UNKNOWN)
+        mtp->cntr->header.length = DATA_LENGTH_UNKNOWN;
+    else
+        mtp->cntr->header.length = MTP_CONTAINER_HEADER_SIZE + mtp->transaction.total;
+}
+
+static struct staged_upload *find_staged(mtp_responder_t *mtp, uint32_t handle)
+{
+    int i;
+    for (i = 0; handle && i < CONFIG_MTP_STAGED_UPLOADS; i++)
+    {
+        if (mtp->staging.uploads[i].handle == handle)
+            return &mtp->staging.uploads[i];
+    }
+    return NULL;
+}
+
+static void forget_staged(mtp_responder_t *mtp, uint32_t handle)
+{
+    struct staged_upload *staged = find_staged(mtp, handle);
+    if (staged)
+        memset(staged, 0, sizeof(struct staged_upload));
+}
+
+/* Free slot for new staged upload, the oldest one makes room if there's none */
+static struct staged_upload *staging_slot(mtp_responder_t *mtp)
+{
+    struct staged_upload *oldest = &mtp->staging.uploads[0];
+    int i;
+    for (i = 0; i < CONFIG_MTP_STAGED_UPLOADS; i++)
+    {
+        struct staged_upload *slot = &mtp->staging.uploads[i];
+        if (!slot->handle)
+            return slot;
+        if (mtp->staging.now - slot->since > mtp->staging.now - oldest->since)
+            oldest = slot;
+    }
+    log_info("Staged upload %u dropped", (unsigned int) oldest->handle);
+    mtp->storage.api->remove(mtp->storage.api_arg, oldest->handle);
+    memset(oldest, 0, sizeof(struct staged_upload));
+    return oldest;
+}
+
+/* Keep data received so far aside, so the host can resume the upload.
+ * Object of unknown size (4GiB or more) can't tell when it's complete,
+ * so it's not staged. */
+static bool stage_upload(mtp_responder_t *mtp)
+{
+    const uint32_t handle = mtp->transaction.handle;
+    struct staged_upload *staged = find_staged(mtp, handle);
+    const size_t size = staged ? staged->size : mtp->transaction.total;
+
+    if (!mtp->storage.api->stage || !mtp->staging.timeout || size >= UINT32_MAX)
+        return false;
+
+    if (mtp->storage.api->stage(mtp->storage.api_arg, handle))
+    {
+        forget_staged(mtp, handle);
+        return false;
+    }
+
+    if (!staged)
+        staged = staging_slot(mtp);
+    staged->handle = handle;
+    staged->received = mtp->transaction.offset + mtp->transaction.received;
+    staged->size = size;
+    staged->since = mtp->staging.now;
+    mtp->staging.latest = handle;
+    log_info("Upload %u staged at %u of %u", (unsigned int) handle,
+            (unsigned int) staged->received, (unsigned int) staged->size);
+    return true;
+}
+
+/* Host announced an object and never sent its data, nothing is left behind */
+static void drop_pending(mtp_responder_t *mtp)
+{
+    if (mtp->pending)
+    {
+        log_info("Object %u: no data sent, removed", (unsigned int) mtp->pending);
+        mtp->storage.api->remove(mtp->storage.api_arg, mtp->pending);
+        mtp->pending = 0;
+    }
 }
 
 static uint16_t operation_open_session(mtp_responder_t *mtp, const mtp_op_cntr_t *request)
 {
+    drop_pending(mtp);
     if (mtp_container_get_param_count(request) > 0) {
         mtp->session_id = request->parameter[0];
     }
@@ -300,6 +493,7 @@ static uint16_t operation_close_session(mtp_responder_t *mtp, const mtp_op_cntr_
 
     if (mtp->session_open)
     {
+        drop_pending(mtp);
         mtp->session_open = false;
         error = MTP_RESPONSE_OK;
     }
@@ -349,6 +543,26 @@ static uint16_t operation_get_storage_info(mtp_responder_t *mtp, const mtp_op_cn
     return error;
 }
 
+/* Continue listing started by find_first, in one call if storage supports it */
+static uint32_t find_handles(mtp_responder_t *mtp, uint32_t *out, uint32_t max)
+{
+    uint32_t i;
+
+    if (mtp->storage.api->find_batch)
+    {
+        return max ? mtp->storage.api->find_batch(mtp->storage.api_arg, out, max) : 0;
+    }
+
+    for (i = 0; i < max; i++)
+    {
+        out[i] = mtp->storage.api->find_next(mtp->storage.api_arg);
+        if (out[i] == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
 static uint16_t operation_get_object_handles(mtp_responder_t *mtp, const mtp_op_cntr_t *request)
 {
     uint16_t error;
@@ -387,18 +601,13 @@ static uint16_t operation_get_object_handles(mtp_responder_t *mtp, const mtp_op_
     {
         uint32_t available = (mtp->buf_size - MTP_CONTAINER_HEADER_SIZE) / sizeof(uint32_t) - 1; // -1 beacuse 4 bytes for array length
         uint32_t fit_to_buf = count > available ? available : count;
-        unsigned i;
 
         *ptr++ = handle;
         // (fit_to_buf - 1) because first already is in buffer
-        for (i = 0; i < (fit_to_buf - 1); i++)
+        if (find_handles(mtp, ptr, fit_to_buf - 1) != (fit_to_buf - 1))
         {
-            handle = mtp->storage.api->find_next(mtp->storage.api_arg);
-            if(!handle) {
-                error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
-                goto get_object_handles_exit;
-            }
-            *ptr++ = handle;
+            error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+            goto get_object_handles_exit;
         }
         mtp->transaction.in_buffer = (1 + fit_to_buf) * sizeof(uint32_t);
     }
@@ -445,7 +654,7 @@ static uint16_t operation_get_object_props_supported(mtp_responder_t *mtp,
 
     if (is_format_code_supported(format_code))
     {
-        uint32_t total = serialize_object_props_supported(payload);
+        uint32_t total = serialize_object_props_supported(format_code, payload);
         mtp->transaction.total = total;
         mtp->transaction.in_buffer = total;
         error = MTP_RESPONSE_OK;
@@ -483,6 +692,19 @@ get_object_prop_desc_exit:
     return error;
 }
 
+/* Media property of object storage can't read metadata of is empty */
+static uint32_t get_media_prop_value(mtp_responder_t *mtp, uint32_t handle, uint16_t prop_code, uint8_t *payload)
+{
+    mtp_media_info_t media = {0};
+
+    if (mtp->storage.api->get_media_info &&
+        mtp->storage.api->get_media_info(mtp->storage.api_arg, handle, &media) != 0)
+    {
+        memset(&media, 0, sizeof(media));
+    }
+    return serialize_media_prop_value(prop_code, &media, payload);
+}
+
 static uint16_t operation_get_object_prop_value(mtp_responder_t *mtp,
         const mtp_op_cntr_t *request)
 {
@@ -500,6 +722,10 @@ static uint16_t operation_get_object_prop_value(mtp_responder_t *mtp,
 
     uint32_t total = serialize_object_prop_value(prop_code, &info, payload);
     if (total == 0)
+    {
+        total = get_media_prop_value(mtp, obj_handle, prop_code, payload);
+    }
+    if (total == 0)
     {
         error = MTP_RESPONSE_INVALID_OBJECT_PROP_CODE;
         goto get_object_prop_value_exit;
@@ -547,10 +773,10 @@ static uint16_t operation_get_object(mtp_responder_t *mtp,
            mtp->storage.api->stat(mtp->storage.api_arg, obj_handle, &info) ||
            mtp->storage.api->open(mtp->storage.api_arg, obj_handle, "r"))
     {
-        mtp->transaction.file_open = true;
         error = MTP_RESPONSE_INVALID_OBJECT_HANDLE;
         goto get_object_exit;
     }
+    mtp->transaction.file_open = true;
 
     size_t empty_space = (mtp->buf_size - MTP_CONTAINER_HEADER_SIZE);
     uint32_t total = info.size;
@@ -561,6 +787,7 @@ static uint16_t operation_get_object(mtp_responder_t *mtp,
     if (data_read < 0)
     {
         mtp->storage.api->close(mtp->storage.api_arg);
+        mtp->transaction.file_open = false;
         error = MTP_RESPONSE_INCOMPLETE_TRANSFER;
         goto get_object_exit;
 
@@ -574,220 +801,1406 @@ get_object_exit:
     return error;
 }
 
-static uint16_t operation_delete_object(mtp_responder_t *mtp,
-        const mtp_op_cntr_t *request)
-{
-    uint16_t error = MTP_RESPONSE_OK;
-    uint32_t obj_handle = request->parameter[0];
-
-    if (!obj_handle || mtp->storage.api->remove(mtp->storage.api_arg, obj_handle) != 0) {
-        error = MTP_RESPONSE_INVALID_OBJECT_HANDLE;
-    }
-
-    return error;
-}
-
-static uint16_t operation_send_object_info(mtp_responder_t *mtp,
-        const mtp_op_cntr_t *request)
+static bool object_has_format(mtp_responder_t *mtp, uint32_t handle, uint16_t format)
 {
-    uint16_t error;
-    uint32_t storage_id = request->parameter[0];
-    uint32_t parent_handle = request->parameter[1];
-    UNUSED(parent_handle);
+    mtp_object_info_t info;
 
-    if (storage_id == mtp->storage.id)
+    if (!format)
     {
-        error = 0;
+        return true;
     }
-    else
+    if (mtp->storage.api->stat(mtp->storage.api_arg, handle, &info))
     {
-        error = MTP_RESPONSE_INVALID_STORAGE_ID;
+        return false;
     }
-
-    return error;
+    return info.format_code == format;
 }
 
-static uint16_t operation_send_object(mtp_responder_t *mtp,
-        const mtp_op_cntr_t *request)
+/* List objects of given format (0 - any), up to max. Listing restarts on
+ * each call, as removing objects invalidates it. */
+static uint32_t collect_handles(mtp_responder_t *mtp, uint16_t format, uint32_t *out, uint32_t max)
 {
-    uint16_t error = 0;
-    UNUSED(request);
-
-    /* TODO: restore open mode, we're opening for write. */
-    if (mtp->storage.api->open(mtp->storage.api_arg, mtp->transaction.handle, "w+"))
+    uint32_t count = 0;
+    uint32_t found = 0;
+    uint32_t batch = 1;
+    uint32_t wanted = 1;
+    uint32_t end;
+    uint32_t i;
+
+    out[0] = mtp->storage.api->find_first(mtp->storage.api_arg, 0xFFFFFFFF, &count);
+    if (!out[0])
     {
-        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
-    }
-    else {
-        mtp->transaction.file_open = true;
+        return 0;
     }
 
-    return error;
+    while (batch)
+    {
+        end = found + batch;
+        for (i = found; i < end; i++)
+        {
+            if (object_has_format(mtp, out[i], format))
+            {
+                out[found++] = out[i];
+            }
+        }
+        if (found == max || batch < wanted)
+        {
+            break;
+        }
+        wanted = max - found;
+        batch = find_handles(mtp, out + found, wanted);
+    }
+    return found;
 }
 
-static uint16_t handle_command(mtp_responder_t *mtp, const mtp_op_cntr_t *request)
+static uint32_t remove_handles(mtp_responder_t *mtp, const uint32_t *handles, uint32_t count)
 {
-    uint16_t error = MTP_RESPONSE_UNDEFINED;
+    uint32_t removed = 0;
+    uint32_t i;
 
-    mtp->transaction.id = request->header.transaction_id;
-    mtp->transaction.opcode = request->header.operation_code;
-    if (!mtp->transaction.keep)
+    if (mtp->storage.api->remove_batch)
     {
-        mtp->transaction.in_buffer = 0;
-        mtp->transaction.total = 0;
+        return mtp->storage.api->remove_batch(mtp->storage.api_arg, handles, count);
     }
 
-    log_info("OP> %s (0x%x)", dbg_operation(request->header.operation_code), (unsigned int) mtp->transaction.id);
-
-    switch(request->header.operation_code)
+    for (i = 0; i < count; i++)
     {
-        case MTP_OPERATION_OPEN_SESSION:
-            error = operation_open_session(mtp, request);
-            break;
-        case MTP_OPERATION_GET_DEVICE_INFO:
-            error = operation_get_device_info(mtp, request);
-            break;
-        case MTP_OPERATION_CLOSE_SESSION:
-            error = operation_close_session(mtp, request);
-            break;
-        case MTP_OPERATION_GET_STORAGE_IDS:
-            error = operation_get_storage_ids(mtp, request);
-            break;
-        case MTP_OPERATION_GET_STORAGE_INFO:
-            error = operation_get_storage_info(mtp, request);
-            break;
-        case MTP_OPERATION_GET_OBJECT_HANDLES:
-            error = operation_get_object_handles(mtp, request);
-            break;
-        case MTP_OPERATION_GET_OBJECT_INFO:
-            error = operation_get_object_info(mtp, request);
-            break;
-        case MTP_OPERATION_GET_OBJECT_PROPS_SUPPORTED:
-            error = operation_get_object_props_supported(mtp, request);
-            break;
-        case MTP_OPERATION_GET_OBJECT_PROP_DESC:
-            error = operation_get_object_prop_desc(mtp, request);
-            break;
-        case MTP_OPERATION_GET_OBJECT_PROP_VALUE:
-            error = operation_get_object_prop_value(mtp, request);
-            break;
-        case MTP_OPERATION_SET_OBJECT_PROP_VALUE:
-            error = operation_set_object_prop_value(mtp, request);
-            break;
-        case MTP_OPERATION_GET_OBJECT:
-            error = operation_get_object(mtp, request);
-            break;
-        case MTP_OPERATION_DELETE_OBJECT:
-            error = operation_delete_object(mtp, request);
-            break;
-        case MTP_OPERATION_SEND_OBJECT_INFO:
-            error = operation_send_object_info(mtp, request);
-            break;
-        case MTP_OPERATION_SEND_OBJECT:
-            error = operation_send_object(mtp, request);
-            break;
-        default:
-            error = MTP_RESPONSE_OPERATION_NOT_SUPPORTED;
-            log_error("Operation %s not supported\n", dbg_operation(request->header.operation_code));
+        if (mtp->storage.api->remove(mtp->storage.api_arg, handles[i]) == 0)
+        {
+            removed++;
+        }
     }
-
-    return error;
+    return removed;
 }
 
-
-static uint16_t data_set_object_prop_value(mtp_responder_t *mtp, const mtp_data_cntr_t *incoming, size_t size)
+/* Handles are gathered in data buffer, which is free during DeleteObject */
+static uint16_t delete_all_objects(mtp_responder_t *mtp, uint16_t format)
 {
-    char name[MTP_STORAGE_FILENAME_LENGTH];
-    uint16_t error = MTP_RESPONSE_OK;
-    UNUSED(size);
-
-    do {
-        int ret = deserialize_object_prop_value(mtp->transaction.prop_code, incoming->payload, name, sizeof(name));
-        if (ret <= 0) {
-            log_error("Failed to deserialize object property value, retcode %d!", ret);
-            error = MTP_RESPONSE_INVALID_OBJECT_PROP_VALUE;
+    uint32_t *handles = (uint32_t*)mtp->buffer;
+    const uint32_t capacity = mtp->buf_size / sizeof(uint32_t);
+    uint32_t deleted = 0;
+    bool failed = false;
+    uint32_t collected;
+    uint32_t removed;
+
+    do
+    {
+        collected = collect_handles(mtp, format, handles, capacity);
+        if (!collected)
+        {
             break;
         }
+        removed = remove_handles(mtp, handles, collected);
+        deleted += removed;
+        failed |= (removed < collected);
+    } while (removed && collected == capacity);
 
-        /* TODO for now only rename is handled */
-        switch (mtp->transaction.prop_code) {
-            case MTP_PROPERTY_OBJECT_FILE_NAME:
-                ret = mtp->storage.api->rename(mtp->storage.api_arg, mtp->transaction.handle, name);
-                if (ret) {
-                    error = MTP_RESPONSE_INVALID_OBJECT_PROP_VALUE;
-                }
-                break;
-
-            default:
-                log_error("Unhandled property code: 0x%04X", mtp->transaction.prop_code);
-                break;
-        }
-
-    } while (0);
+    log_info("Deleted %u objects, format 0x%04X%s",
+            (unsigned int) deleted, format, failed ? ", some failed" : "");
 
-    return error;
+    if (!failed)
+    {
+        return MTP_RESPONSE_OK;
+    }
+    return deleted ? MTP_RESPONSE_PARTIAL_DELETION : MTP_RESPONSE_ACCESS_DENIED;
 }
 
-static uint16_t data_send_object_info(mtp_responder_t *mtp, const mtp_data_cntr_t* incoming, size_t size)
+static uint16_t operation_delete_object(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
 {
-    uint16_t error;
-    mtp_object_info_t info;
-    uint32_t obj_handle = 0;
-    size_t plen = incoming->header.length - MTP_CONTAINER_HEADER_SIZE;
-    UNUSED(size);
+    uint16_t error = MTP_RESPONSE_OK;
+    uint32_t obj_handle = request->parameter[0];
+    uint16_t format = 0;
 
-    if (deserialize_object_info(incoming->payload, plen, &info))
+    if (request->header.length >= MTP_CONTAINER_HEADER_SIZE + 2 * sizeof(uint32_t))
     {
-        error = MTP_RESPONSE_INVALID_DATASET;
-        goto send_object_info_exit;
+        format = request->parameter[1];
     }
 
-    if (!is_format_code_supported(info.format_code))
+    if (obj_handle == 0xFFFFFFFF)
     {
-        error = MTP_RESPONSE_INVALID_OBJECT_FORMAT_CODE;
-        goto send_object_info_exit;
+        return delete_all_objects(mtp, format);
     }
 
-    if (mtp->storage.api->create(mtp->storage.api_arg, &info, &obj_handle))
-    {
-        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
-        goto send_object_info_exit;
+    if (!obj_handle || mtp->storage.api->remove(mtp->storage.api_arg, obj_handle) != 0) {
+        error = MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+    }
+    else {
+        forget_staged(mtp, obj_handle);
     }
 
-    mtp->transaction.handle = obj_handle;
-    mtp->transaction.total = info.size;
-    mtp->transaction.received = 0;
-    mtp->transaction.keep = true;
-    error = MTP_RESPONSE_OK;
-send_object_info_exit:
     return error;
 }
 
-static uint16_t data_send_object(mtp_responder_t *mtp, const mtp_data_cntr_t* incoming, size_t size)
+/* Serialize next listed object into manifest entry buffer */
+static bool next_manifest_entry(mtp_responder_t *mtp)
 {
-    uint16_t error;
-    size_t plen = size - MTP_CONTAINER_HEADER_SIZE;
+    mtp_object_info_t info;
+    uint32_t handle;
 
-    if (plen > 0)
+    while ((handle = mtp->manifest.next_handle))
     {
-        if (mtp->storage.api->write(mtp->storage.api_arg, (void*)incoming->payload, plen) < 0)
+        if (!find_handles(mtp, &mtp->manifest.next_handle, 1))
         {
-            error = MTP_RESPONSE_OBJECT_TOO_LARGE;
-            mtp->transaction.keep = false;
-            mtp->storage.api->close(mtp->storage.api_arg);
-            mtp->transaction.file_open = false;
-            goto data_send_object_exit;
+            mtp->manifest.next_handle = 0;
+        }
+        if (mtp->storage.api->stat(mtp->storage.api_arg, handle, &info) == 0)
+        {
+            mtp->manifest.length = serialize_manifest_entry(handle, &info, mtp->manifest.entry);
+            mtp->manifest.offset = 0;
+            mtp->manifest.listed++;
+            return true;
         }
     }
+    return false;
+}
 
-    if (plen >= mtp->transaction.total)
-    {
+static size_t fill_manifest(mtp_responder_t *mtp, uint8_t *out, size_t space)
+{
+    size_t filled = 0;
+    size_t chunk;
+
+    while (filled < space)
+    {
+        if (mtp->manifest.offset == mtp->manifest.length)
+        {
+            if (mtp->manifest.listed == mtp->manifest.count || !next_manifest_entry(mtp))
+            {
+                break;
+            }
+        }
+        chunk = mtp->manifest.length - mtp->manifest.offset;
+        if (chunk > space - filled)
+        {
+            chunk = space - filled;
+        }
+        memcpy(out + filled, &mtp->manifest.entry[mtp->manifest.offset], chunk);
+        mtp->manifest.offset += chunk;
+        filled += chunk;
+    }
+    return filled;
+}
+
+/* Manifest is listed twice: first to learn data phase length, then to stream
+ * it. Objects appearing in between are skipped, vanished ones are padded with
+ * zeros, so announced length always holds. */
+static uint16_t operation_get_sync_manifest(mtp_responder_t *mtp, const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    const uint32_t storage_id = request->parameter[0];
+    const uint32_t parent_handle = request->parameter[1];
+    const bool storage_locked = (mtp->storage_lock != NULL) ? *mtp->storage_lock : false;
+    uint8_t *payload = (uint8_t *)mtp->cntr->payload;
+    uint32_t count = 0;
+    size_t total = sizeof(uint32_t);
+
+    if (storage_locked)
+    {
+        error = MTP_RESPONSE_ACCESS_DENIED;
+        goto get_sync_manifest_exit;
+    }
+
+    if (!mtp->storage.id || !mtp->storage.api)
+    {
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+        goto get_sync_manifest_exit;
+    }
+
+    if (storage_id != 0xFFFFFFFF && storage_id != mtp->storage.id)
+    {
+        error = MTP_RESPONSE_INVALID_STORAGE_ID;
+        goto get_sync_manifest_exit;
+    }
+
+    mtp->manifest.count = 0xFFFFFFFF;
+    mtp->manifest.listed = 0;
+    mtp->manifest.length = 0;
+    mtp->manifest.offset = 0;
+    mtp->manifest.next_handle = mtp->storage.api->find_first(mtp->storage.api_arg, parent_handle, &count);
+    while (next_manifest_entry(mtp))
+    {
+        total += mtp->manifest.length;
+    }
+    count = mtp->manifest.listed;
+
+    mtp->manifest.count = count;
+    mtp->manifest.listed = 0;
+    mtp->manifest.length = 0;
+    mtp->manifest.offset = 0;
+    mtp->manifest.next_handle = mtp->storage.api->find_first(mtp->storage.api_arg, parent_handle, &count);
+
+    memcpy(payload, &mtp->manifest.count, sizeof(uint32_t));
+    mtp->transaction.total = total;
+    mtp->transaction.in_buffer = sizeof(uint32_t) +
+        fill_manifest(mtp, payload + sizeof(uint32_t),
+                      MIN(mtp->buf_size - MTP_CONTAINER_HEADER_SIZE, total) - sizeof(uint32_t));
+
+    log_info("Sync manifest: %u objects, %u bytes", (unsigned int) count, (unsigned int) total);
+    error = MTP_RESPONSE_OK;
+
+get_sync_manifest_exit:
+    return error;
+}
+
+/* Formats already packed by their codec, LZ4 would only burn CPU on them */
+static bool is_compressed_format(uint16_t format)
+{
+    switch (format)
+    {
+        case MTP_FORMAT_EXIF_JPEG:
+        case MTP_FORMAT_JFIF:
+        case MTP_FORMAT_PNG:
+        case MTP_FORMAT_GIF:
+        case MTP_FORMAT_MP3:
+        case MTP_FORMAT_FLAC:
+        case MTP_FORMAT_OGG:
+        case MTP_FORMAT_AAC:
+        case MTP_FORMAT_MP4_CONTAINER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void release_lz4(mtp_responder_t *mtp)
+{
+    free(mtp->lz4);
+    mtp->lz4 = NULL;
+}
+
+/* Stage next part of outgoing frame: block of object data or, past the end
+ * of object, the end mark. Returns false when whole frame has been staged. */
+static bool next_lz4_chunk(mtp_responder_t *mtp)
+{
+    struct lz4_transfer *lz4 = mtp->lz4;
+    int data_read;
+
+    if (lz4->finished)
+        return false;
+
+    data_read = mtp->storage.api->read(mtp->storage.api_arg, lz4->in, sizeof(lz4->in));
+    if (data_read > 0)
+    {
+        lz4->length = mtp_lz4_frame_block(&lz4->encoder, lz4->in, data_read, lz4->out, lz4->compress);
+    }
+    else if (data_read == 0)
+    {
+        lz4->length = mtp_lz4_frame_end(lz4->out, MTP_CONTAINER_HEADER_SIZE + lz4->produced);
+        lz4->finished = true;
+    }
+    else
+    {
+        /* No way to fail mid data phase, unterminated frame tells host it's truncated */
+        log_error("Compressed object: read error after %u bytes", (unsigned int) lz4->produced);
+        lz4->length = 0;
+        lz4->finished = true;
+    }
+
+    lz4->offset = 0;
+    lz4->produced += lz4->length;
+    return lz4->length > 0;
+}
+
+static size_t fill_lz4(mtp_responder_t *mtp, uint8_t *out, size_t space)
+{
+    struct lz4_transfer *lz4 = mtp->lz4;
+    size_t filled = 0;
+    size_t chunk;
+
+    while (filled < space)
+    {
+        if (lz4->offset == lz4->length && !next_lz4_chunk(mtp))
+        {
+            break;
+        }
+
+        chunk = MIN((size_t)(lz4->length - lz4->offset), space - filled);
+        memcpy(out + filled, &lz4->out[lz4->offset], chunk);
+        lz4->offset += chunk;
+        filled += chunk;
+    }
+    return filled;
+}
+
+static void end_get_object_compressed(mtp_responder_t *mtp)
+{
+    mtp->storage.api->close(mtp->storage.api_arg);
+    mtp->transaction.file_open = false;
+    release_lz4(mtp);
+}
+
+/* Compressed size is known only after the whole object went through the
+ * encoder, so data phase length is left unknown, unless the frame fits
+ * into the very first container. */
+static uint16_t operation_get_object_compressed(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    uint32_t obj_handle = request->parameter[0];
+    size_t space = mtp->buf_size - MTP_CONTAINER_HEADER_SIZE;
+    mtp_object_info_t info;
+    size_t filled;
+
+    if (!obj_handle ||
+           mtp->storage.api->stat(mtp->storage.api_arg, obj_handle, &info) ||
+           mtp->storage.api->open(mtp->storage.api_arg, obj_handle, "r"))
+    {
+        error = MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+        goto get_object_compressed_exit;
+    }
+    mtp->transaction.file_open = true;
+
+    if (!(mtp->lz4 = malloc(sizeof(struct lz4_transfer))))
+    {
         mtp->storage.api->close(mtp->storage.api_arg);
         mtp->transaction.file_open = false;
-        mtp->transaction.keep = false;
+        error = MTP_RESPONSE_DEVICE_BUSY;
+        goto get_object_compressed_exit;
+    }
+
+    mtp->lz4->compress = !is_compressed_format(info.format_code);
+    mtp->lz4->finished = false;
+    mtp->lz4->length = mtp_lz4_frame_header(mtp->lz4->out);
+    mtp->lz4->offset = 0;
+    mtp->lz4->produced = mtp->lz4->length;
+
+    filled = fill_lz4(mtp, mtp->cntr->payload, space);
+    if (filled < space)
+    {
+        end_get_object_compressed(mtp);
+        mtp->transaction.total = filled;
+    }
+    else
+    {
+        mtp->transaction.total = DATA_LENGTH_UNKNOWN;
+    }
+    mtp->transaction.in_buffer = filled;
+
+    log_info("Compressed object %s: %s", info.filename, is_compressed_format(info.format_code) ? "stored" : "lz4");
+    error = MTP_RESPONSE_OK;
+
+get_object_compressed_exit:
+    return error;
+}
+
+static uint16_t operation_send_object_hash(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    const bool storage_locked = (mtp->storage_lock != NULL) ? *mtp->storage_lock : false;
+    UNUSED(request);
+
+    if (!mtp->storage.api->find_duplicate || !mtp->storage.api->create_copy)
+    {
+        error = MTP_RESPONSE_OPERATION_NOT_SUPPORTED;
+        goto send_object_hash_exit;
+    }
+
+    if (storage_locked)
+    {
+        error = MTP_RESPONSE_ACCESS_DENIED;
+        goto send_object_hash_exit;
+    }
+
+    error = 0;
+
+send_object_hash_exit:
+    return error;
+}
+
+static uint16_t operation_send_object_info(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    uint32_t storage_id = request->parameter[0];
+    uint32_t parent_handle = request->parameter[1];
+    UNUSED(parent_handle);
+
+    if (storage_id == mtp->storage.id)
+    {
+        error = 0;
+    }
+    else
+    {
+        error = MTP_RESPONSE_INVALID_STORAGE_ID;
+    }
+
+    return error;
+}
+
+static uint16_t operation_send_object(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error = 0;
+    UNUSED(request);
+
+    /* TODO: restore open mode, we're opening for write. */
+    if (mtp->storage.api->open(mtp->storage.api_arg, mtp->transaction.handle, "w+"))
+    {
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+    }
+    else {
+        mtp->transaction.file_open = true;
+        mtp->pending = 0;
+    }
+
+    return error;
+}
+
+static uint16_t operation_send_object_compressed(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error = 0;
+    UNUSED(request);
+
+    if (!mtp->transaction.keep)
+    {
+        error = MTP_RESPONSE_NO_VALID_OBJECT_INFO;
+        goto send_object_compressed_exit;
+    }
+
+    if (!(mtp->lz4 = malloc(sizeof(struct lz4_transfer))))
+    {
+        error = MTP_RESPONSE_DEVICE_BUSY;
+        goto send_object_compressed_exit;
+    }
+
+    if (mtp->storage.api->open(mtp->storage.api_arg, mtp->transaction.handle, "w+"))
+    {
+        release_lz4(mtp);
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+        goto send_object_compressed_exit;
+    }
+
+    mtp->transaction.file_open = true;
+    mtp->pending = 0;
+    mtp->lz4->write_failed = false;
+    mtp_lz4_decoder_init(&mtp->lz4->decoder);
+
+send_object_compressed_exit:
+    return error;
+}
+
+static uint16_t operation_send_partial_object(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    uint32_t handle = request->parameter[0];
+    uint32_t length = request->parameter[3];
+    struct staged_upload *staged = find_staged(mtp, handle);
+
+    if (!staged)
+    {
+        error = MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+        goto send_partial_object_exit;
+    }
+
+    /* Staged object can only be appended to */
+    if (request->parameter[2] || request->parameter[1] != staged->received
+            || length > staged->size - staged->received)
+    {
+        error = MTP_RESPONSE_INVALID_PARAMETER;
+        goto send_partial_object_exit;
+    }
+
+    if (mtp->storage.api->open(mtp->storage.api_arg, handle, "a"))
+    {
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+        goto send_partial_object_exit;
+    }
+
+    mtp->transaction.file_open = true;
+    mtp->transaction.handle = handle;
+    mtp->transaction.offset = staged->received;
+    mtp->transaction.total = length;
+    mtp->transaction.received = 0;
+    mtp->response.parameter[0] = length;
+    mtp->response.count = 1;
+    log_info("Upload %u resumed at %u", (unsigned int) handle, (unsigned int) staged->received);
+    error = 0;
+
+send_partial_object_exit:
+    return error;
+}
+
+static uint16_t operation_get_partial_upload(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    uint32_t handle = mtp->staging.latest;
+    const struct staged_upload *staged;
+
+    if (request->header.length >= MTP_CONTAINER_HEADER_SIZE + sizeof(uint32_t) && request->parameter[0])
+    {
+        handle = request->parameter[0];
+    }
+
+    if ((staged = find_staged(mtp, handle)))
+    {
+        mtp->response.parameter[0] = staged->handle;
+        mtp->response.parameter[1] = staged->received;
+        mtp->response.parameter[2] = staged->size;
+        mtp->response.count = 3;
         error = MTP_RESPONSE_OK;
     }
     else
+    {
+        error = MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+    }
+
+    return error;
+}
+
+static void release_archive(mtp_responder_t *mtp)
+{
+    free(mtp->archive);
+    mtp->archive = NULL;
+}
+
+static uint16_t operation_send_archive(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    const uint32_t storage_id = request->parameter[0];
+    const bool storage_locked = (mtp->storage_lock != NULL) ? *mtp->storage_lock : false;
+
+    if (storage_locked)
+    {
+        error = MTP_RESPONSE_ACCESS_DENIED;
+        goto send_archive_exit;
+    }
+
+    if (request->header.length < MTP_CONTAINER_HEADER_SIZE + sizeof(uint32_t) || storage_id != mtp->storage.id)
+    {
+        error = MTP_RESPONSE_INVALID_STORAGE_ID;
+        goto send_archive_exit;
+    }
+
+    if (!(mtp->archive = calloc(1, sizeof(struct archive_transfer))))
+    {
+        error = MTP_RESPONSE_DEVICE_BUSY;
+        goto send_archive_exit;
+    }
+
+    mtp->archive->first_failed = 0xFFFFFFFF;
+    error = 0;
+
+send_archive_exit:
+    return error;
+}
+
+/* Stage header of next listed object that can be opened, or end of
+ * archive. Returns false once the end has been staged. */
+static bool next_archive_entry(mtp_responder_t *mtp)
+{
+    struct archive_transfer *archive = mtp->archive;
+    mtp_object_info_t info;
+    uint32_t handle;
+
+    if (mtp->transaction.file_open)
+    {
+        mtp->storage.api->close(mtp->storage.api_arg);
+        mtp->transaction.file_open = false;
+    }
+
+    while ((handle = archive->next_handle))
+    {
+        if (!find_handles(mtp, &archive->next_handle, 1))
+        {
+            archive->next_handle = 0;
+        }
+        if (mtp->storage.api->stat(mtp->storage.api_arg, handle, &info)
+                || info.format_code == MTP_FORMAT_ASSOCIATION
+                || mtp->storage.api->open(mtp->storage.api_arg, handle, "r"))
+        {
+            continue;
+        }
+        mtp->transaction.file_open = true;
+        archive->length = serialize_archive_header(&info, archive->header);
+        archive->filled = 0;
+        archive->remaining = info.size;
+        archive->padding = (MTP_ARCHIVE_BLOCK_SIZE - info.size % MTP_ARCHIVE_BLOCK_SIZE) % MTP_ARCHIVE_BLOCK_SIZE;
+        archive->entries++;
+        return true;
+    }
+
+    if (archive->ended)
+    {
+        return false;
+    }
+    memset(archive->header, 0, 2 * MTP_ARCHIVE_BLOCK_SIZE);
+    archive->length = 2 * MTP_ARCHIVE_BLOCK_SIZE;
+    archive->filled = 0;
+    archive->ended = true;
+    return true;
+}
+
+/* Buffer is filled across file boundaries, so each container goes out full
+ * until the archive ends. Object which shrank since stat is padded with
+ * zeros, one which grew is cut, so the archive stays well formed. */
+static size_t fill_archive(mtp_responder_t *mtp, uint8_t *out, size_t space)
+{
+    struct archive_transfer *archive = mtp->archive;
+    size_t filled = 0;
+    size_t chunk;
+    int data_read;
+
+    while (filled < space)
+    {
+        if (archive->filled < archive->length)
+        {
+            chunk = MIN((size_t)(archive->length - archive->filled), space - filled);
+            memcpy(out + filled, &archive->header[archive->filled], chunk);
+            archive->filled += chunk;
+        }
+        else if (archive->remaining)
+        {
+            chunk = (size_t)MIN(archive->remaining, (uint64_t)(space - filled));
+            data_read = mtp->storage.api->read(mtp->storage.api_arg, out + filled, chunk);
+            if (data_read <= 0)
+            {
+                log_error("Archive entry %u: read failed", (unsigned int) (archive->entries - 1));
+                memset(out + filled, 0, chunk);
+            }
+            else
+            {
+                chunk = data_read;
+            }
+            archive->remaining -= chunk;
+        }
+        else if (archive->padding)
+        {
+            chunk = MIN((size_t)archive->padding, space - filled);
+            memset(out + filled, 0, chunk);
+            archive->padding -= chunk;
+        }
+        else if (next_archive_entry(mtp))
+        {
+            continue;
+        }
+        else
+        {
+            break;
+        }
+        filled += chunk;
+    }
+    return filled;
+}
+
+static void end_get_archive(mtp_responder_t *mtp)
+{
+    mtp->response.parameter[0] = mtp->archive->entries;
+    mtp->response.count = 1;
+    log_info("Archive: %u files sent", (unsigned int) mtp->archive->entries);
+    release_archive(mtp);
+}
+
+/* Length of archive isn't known until all objects are read. Archive is made
+ * of 512 byte blocks, after 12 byte container header it never ends on
+ * packet boundary, so the short packet always comes. */
+static uint16_t operation_get_archive(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    const uint32_t storage_id = request->parameter[0];
+    const uint32_t parent_handle = request->parameter[1];
+    const bool storage_locked = (mtp->storage_lock != NULL) ? *mtp->storage_lock : false;
+    size_t space = mtp->buf_size - MTP_CONTAINER_HEADER_SIZE;
+    uint32_t count = 0;
+    size_t filled;
+
+    if (storage_locked)
+    {
+        error = MTP_RESPONSE_ACCESS_DENIED;
+        goto get_archive_exit;
+    }
+
+    if (request->header.length < MTP_CONTAINER_HEADER_SIZE + 2 * sizeof(uint32_t)
+            || (storage_id != 0xFFFFFFFF && storage_id != mtp->storage.id))
+    {
+        error = MTP_RESPONSE_INVALID_STORAGE_ID;
+        goto get_archive_exit;
+    }
+
+    if (!(mtp->archive = calloc(1, sizeof(struct archive_transfer))))
+    {
+        error = MTP_RESPONSE_DEVICE_BUSY;
+        goto get_archive_exit;
+    }
+
+    mtp->archive->next_handle = mtp->storage.api->find_first(mtp->storage.api_arg, parent_handle, &count);
+    filled = fill_archive(mtp, mtp->cntr->payload, space);
+    if (filled < space)
+    {
+        end_get_archive(mtp);
+        mtp->transaction.total = filled;
+    }
+    else
+    {
+        mtp->transaction.total = DATA_LENGTH_UNKNOWN;
+    }
+    mtp->transaction.in_buffer = filled;
+    error = MTP_RESPONSE_OK;
+
+get_archive_exit:
+    return error;
+}
+
+static uint16_t operation_send_search_query(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    const uint32_t storage_id = request->parameter[0];
+    const bool storage_locked = (mtp->storage_lock != NULL) ? *mtp->storage_lock : false;
+
+    if (!mtp->storage.api || !mtp->storage.api->search || !mtp->storage.api->search_batch)
+    {
+        error = MTP_RESPONSE_OPERATION_NOT_SUPPORTED;
+        goto send_search_query_exit;
+    }
+
+    if (storage_locked)
+    {
+        error = MTP_RESPONSE_ACCESS_DENIED;
+        goto send_search_query_exit;
+    }
+
+    if (storage_id != 0xFFFFFFFF && storage_id != mtp->storage.id)
+    {
+        error = MTP_RESPONSE_INVALID_STORAGE_ID;
+        goto send_search_query_exit;
+    }
+
+    mtp->search.ready = false;
+    error = 0;
+
+send_search_query_exit:
+    return error;
+}
+
+/* Handles go like in GetObjectHandles, count first. Objects removed since the
+ * search are still listed, host finds them gone on the next operation. */
+static uint16_t operation_get_search_results(mtp_responder_t *mtp,
+        const mtp_op_cntr_t *request)
+{
+    uint16_t error;
+    uint32_t *ptr = (uint32_t *)mtp->cntr->payload;
+    uint32_t available = (mtp->buf_size - MTP_CONTAINER_HEADER_SIZE) / sizeof(uint32_t) - 1;
+    uint32_t fit_to_buf;
+    UNUSED(request);
+
+    if (!mtp->search.ready)
+    {
+        error = MTP_RESPONSE_NO_VALID_OBJECT_INFO;
+        goto get_search_results_exit;
+    }
+
+    mtp->search.ready = false;
+    fit_to_buf = MIN(mtp->search.count, available);
+    *ptr++ = mtp->search.count;
+    if (mtp->storage.api->search_batch(mtp->storage.api_arg, ptr, fit_to_buf) != fit_to_buf)
+    {
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+        goto get_search_results_exit;
+    }
+    mtp->transaction.in_buffer = (1 + fit_to_buf) * sizeof(uint32_t);
+    mtp->transaction.total = (1 + mtp->search.count) * sizeof(uint32_t);
+    error = MTP_RESPONSE_OK;
+
+get_search_results_exit:
+    return error;
+}
+
+/* Object the operation refers to. Data of SendObject goes to the one created
+ * by preceding SendObjectInfo, others name it in the first parameter. */
+static uint32_t command_object(mtp_responder_t *mtp, const mtp_op_cntr_t *request)
+{
+    switch (request->header.operation_code)
+    {
+        case MTP_OPERATION_SEND_OBJECT:
+        case MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED:
+            return mtp->transaction.handle;
+        case MTP_OPERATION_GET_OBJECT_INFO:
+        case MTP_OPERATION_GET_OBJECT:
+        case MTP_OPERATION_GET_PARTIAL_OBJECT:
+        case MTP_OPERATION_VENDOR_GET_OBJECT_COMPRESSED:
+        case MTP_OPERATION_SEND_PARTIAL_OBJECT:
+        case MTP_OPERATION_DELETE_OBJECT:
+        case MTP_OPERATION_GET_OBJECT_PROP_VALUE:
+        case MTP_OPERATION_SET_OBJECT_PROP_VALUE:
+            if (request->header.length >= MTP_CONTAINER_HEADER_SIZE + sizeof(uint32_t))
+                return request->parameter[0];
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static uint16_t handle_command(mtp_responder_t *mtp, const mtp_op_cntr_t *request)
+{
+    uint16_t error = MTP_RESPONSE_UNDEFINED;
+
+    mtp->transaction.id = request->header.transaction_id;
+    mtp->transaction.opcode = request->header.operation_code;
+    mtp->transaction.offset = 0;
+    mtp->response.count = 0;
+    if (mtp->transaction.opcode != MTP_OPERATION_SEND_OBJECT_INFO)
+    {
+        mtp->duplicate.source = 0;
+    }
+    if (!mtp->transaction.keep)
+    {
+        mtp->transaction.in_buffer = 0;
+        mtp->transaction.total = 0;
+    }
+    mtp->transaction.object = command_object(mtp, request);
+
+    log_info("OP> %s (0x%x)", dbg_operation(request->header.operation_code), (unsigned int) mtp->transaction.id);
+
+    switch(request->header.operation_code)
+    {
+        case MTP_OPERATION_OPEN_SESSION:
+            error = operation_open_session(mtp, request);
+            break;
+        case MTP_OPERATION_GET_DEVICE_INFO:
+            error = operation_get_device_info(mtp, request);
+            break;
+        case MTP_OPERATION_CLOSE_SESSION:
+            error = operation_close_session(mtp, request);
+            break;
+        case MTP_OPERATION_GET_STORAGE_IDS:
+            error = operation_get_storage_ids(mtp, request);
+            break;
+        case MTP_OPERATION_GET_STORAGE_INFO:
+            error = operation_get_storage_info(mtp, request);
+            break;
+        case MTP_OPERATION_GET_OBJECT_HANDLES:
+            error = operation_get_object_handles(mtp, request);
+            break;
+        case MTP_OPERATION_GET_OBJECT_INFO:
+            error = operation_get_object_info(mtp, request);
+            break;
+        case MTP_OPERATION_GET_OBJECT_PROPS_SUPPORTED:
+            error = operation_get_object_props_supported(mtp, request);
+            break;
+        case MTP_OPERATION_GET_OBJECT_PROP_DESC:
+            error = operation_get_object_prop_desc(mtp, request);
+            break;
+        case MTP_OPERATION_GET_OBJECT_PROP_VALUE:
+            error = operation_get_object_prop_value(mtp, request);
+            break;
+        case MTP_OPERATION_SET_OBJECT_PROP_VALUE:
+            error = operation_set_object_prop_value(mtp, request);
+            break;
+        case MTP_OPERATION_GET_OBJECT:
+            error = operation_get_object(mtp, request);
+            break;
+        case MTP_OPERATION_DELETE_OBJECT:
+            error = operation_delete_object(mtp, request);
+            break;
+        case MTP_OPERATION_SEND_OBJECT_INFO:
+            error = operation_send_object_info(mtp, request);
+            break;
+        case MTP_OPERATION_SEND_OBJECT:
+            error = operation_send_object(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_GET_SYNC_MANIFEST:
+            error = operation_get_sync_manifest(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_GET_OBJECT_COMPRESSED:
+            error = operation_get_object_compressed(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED:
+            error = operation_send_object_compressed(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_SEND_OBJECT_HASH:
+            error = operation_send_object_hash(mtp, request);
+            break;
+        case MTP_OPERATION_SEND_PARTIAL_OBJECT:
+            error = operation_send_partial_object(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_GET_PARTIAL_UPLOAD:
+            error = operation_get_partial_upload(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_SEND_ARCHIVE:
+            error = operation_send_archive(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_GET_ARCHIVE:
+            error = operation_get_archive(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_SEND_SEARCH_QUERY:
+            error = operation_send_search_query(mtp, request);
+            break;
+        case MTP_OPERATION_VENDOR_GET_SEARCH_RESULTS:
+            error = operation_get_search_results(mtp, request);
+            break;
+        default:
+            error = MTP_RESPONSE_OPERATION_NOT_SUPPORTED;
+            log_error("Operation %s not supported\n", dbg_operation(request->header.operation_code));
+    }
+
+    return error;
+}
+
+
+static uint16_t data_set_object_prop_value(mtp_responder_t *mtp, const mtp_data_cntr_t *incoming, size_t size)
+{
+    union {
+        char name[MTP_STORAGE_FILENAME_LENGTH];
+        time_t date;
+    } value;
+    uint16_t error = MTP_RESPONSE_OK;
+    UNUSED(size);
+
+    do {
+        int ret = deserialize_object_prop_value(mtp->transaction.prop_code, incoming->payload, &value, sizeof(value));
+        if (ret <= 0) {
+            log_error("Failed to deserialize object property value, retcode %d!", ret);
+            error = MTP_RESPONSE_INVALID_OBJECT_PROP_VALUE;
+            break;
+        }
+
+        switch (mtp->transaction.prop_code) {
+            case MTP_PROPERTY_OBJECT_FILE_NAME:
+                ret = mtp->storage.api->rename(mtp->storage.api_arg, mtp->transaction.handle, value.name);
+                if (ret) {
+                    error = MTP_RESPONSE_INVALID_OBJECT_PROP_VALUE;
+                }
+                break;
+
+            case MTP_PROPERTY_DATE_MODIFIED:
+                if (!mtp->storage.api->set_modified) {
+                    error = MTP_RESPONSE_ACCESS_DENIED;
+                    break;
+                }
+                ret = mtp->storage.api->set_modified(mtp->storage.api_arg, mtp->transaction.handle, value.date);
+                if (ret) {
+                    error = MTP_RESPONSE_INVALID_OBJECT_PROP_VALUE;
+                }
+                break;
+
+            default:
+                log_error("Unhandled property code: 0x%04X", mtp->transaction.prop_code);
+                break;
+        }
+
+    } while (0);
+
+    return error;
+}
+
+static uint16_t data_send_search_query(mtp_responder_t *mtp, const mtp_data_cntr_t *incoming, size_t size)
+{
+    uint16_t error;
+    mtp_search_query_t query;
+    size_t plen = incoming->header.length - MTP_CONTAINER_HEADER_SIZE;
+    UNUSED(size);
+
+    if (deserialize_search_query(incoming->payload, plen, &query))
+    {
+        error = MTP_RESPONSE_INVALID_DATASET;
+        goto data_send_search_query_exit;
+    }
+
+    mtp->search.count = mtp->storage.api->search(mtp->storage.api_arg, &query);
+    mtp->search.ready = true;
+    mtp->response.parameter[0] = mtp->search.count;
+    mtp->response.count = 1;
+    log_info("Search: %u objects", (unsigned int) mtp->search.count);
+    error = MTP_RESPONSE_OK;
+
+data_send_search_query_exit:
+    return error;
+}
+
+static uint16_t data_send_object_hash(mtp_responder_t *mtp, const mtp_data_cntr_t *incoming, size_t size)
+{
+    uint16_t error;
+    size_t plen = incoming->header.length - MTP_CONTAINER_HEADER_SIZE;
+    UNUSED(size);
+
+    if (deserialize_object_hash(incoming->payload, plen, &mtp->duplicate.hash))
+    {
+        error = MTP_RESPONSE_INVALID_DATASET;
+        goto data_send_object_hash_exit;
+    }
+
+    mtp->duplicate.source = mtp->storage.api->find_duplicate(mtp->storage.api_arg, &mtp->duplicate.hash);
+    error = mtp->duplicate.source ? MTP_RESPONSE_OK : MTP_RESPONSE_VENDOR_NO_MATCHING_OBJECT;
+    log_info("Object hash %08x: %s", (unsigned int) mtp->duplicate.hash.checksum,
+            mtp->duplicate.source ? "duplicate" : "new");
+
+data_send_object_hash_exit:
+    return error;
+}
+
+static uint16_t data_send_object_info(mtp_responder_t *mtp, const mtp_data_cntr_t* incoming, size_t size)
+{
+    uint16_t error;
+    mtp_object_info_t info;
+    uint32_t obj_handle = 0;
+    uint32_t source;
+    size_t plen = incoming->header.length - MTP_CONTAINER_HEADER_SIZE;
+    UNUSED(size);
+
+    /* Object announced before is superseded */
+    drop_pending(mtp);
+
+    if (deserialize_object_info(incoming->payload, plen, &info))
+    {
+        error = MTP_RESPONSE_INVALID_DATASET;
+        goto send_object_info_exit;
+    }
+
+    if (!is_format_code_supported(info.format_code))
+    {
+        error = MTP_RESPONSE_INVALID_OBJECT_FORMAT_CODE;
+        goto send_object_info_exit;
+    }
+
+    /* Host was told content is already here and won't send it */
+    source = (mtp->duplicate.hash.size == info.size) ? mtp->duplicate.source : 0;
+    mtp->duplicate.source = 0;
+    if (source)
+    {
+        info.checksum = mtp->duplicate.hash.checksum;
+        if (mtp->storage.api->create_copy(mtp->storage.api_arg, source, &mtp->duplicate.hash, &info, &obj_handle))
+        {
+            error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+            goto send_object_info_exit;
+        }
+        mtp->transaction.handle = obj_handle;
+        error = MTP_RESPONSE_OK;
+        goto send_object_info_exit;
+    }
+
+    if (mtp->storage.api->create(mtp->storage.api_arg, &info, &obj_handle))
+    {
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+        goto send_object_info_exit;
+    }
+
+    /* Empty object may come without data phase, there's nothing to wait for */
+    if (info.size == 0 && mtp->storage.api->commit
+            && mtp->storage.api->commit(mtp->storage.api_arg, obj_handle))
+    {
+        mtp->storage.api->remove(mtp->storage.api_arg, obj_handle);
+        error = MTP_RESPONSE_STORE_NOT_AVAILABLE;
+        goto send_object_info_exit;
+    }
+
+    mtp->pending = info.size ? obj_handle : 0;
+    mtp->transaction.handle = obj_handle;
+    mtp->transaction.total = info.size;
+    mtp->transaction.received = 0;
+    mtp->transaction.keep = true;
+    error = MTP_RESPONSE_OK;
+send_object_info_exit:
+    return error;
+}
+
+static int write_decoded(void *arg, const void *data, size_t length)
+{
+    mtp_responder_t *mtp = arg;
+
+    if (mtp->storage.api->write(mtp->storage.api_arg, data, length) < 0)
+    {
+        mtp->lz4->write_failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/* Entry which couldn't be stored leaves nothing behind, the rest of its
+ * payload is skipped */
+static void archive_entry_failed(mtp_responder_t *mtp)
+{
+    struct archive_transfer *archive = mtp->archive;
+
+    if (archive->handle)
+    {
+        if (mtp->transaction.file_open)
+        {
+            mtp->storage.api->close(mtp->storage.api_arg);
+            mtp->transaction.file_open = false;
+        }
+        mtp->storage.api->remove(mtp->storage.api_arg, archive->handle);
+        archive->handle = 0;
+    }
+    if (archive->first_failed == 0xFFFFFFFF)
+    {
+        archive->first_failed = archive->entries - 1;
+    }
+    log_error("Archive entry %u failed", (unsigned int) (archive->entries - 1));
+}
+
+static void end_archive_entry(mtp_responder_t *mtp)
+{
+    struct archive_transfer *archive = mtp->archive;
+
+    mtp->storage.api->close(mtp->storage.api_arg);
+    mtp->transaction.file_open = false;
+    if (mtp->storage.api->commit && mtp->storage.api->commit(mtp->storage.api_arg, archive->handle))
+    {
+        archive_entry_failed(mtp);
+        return;
+    }
+    archive->handle = 0;
+    archive->stored++;
+}
+
+/* Regular file becomes a new object, written while its payload arrives */
+static int begin_archive_entry(mtp_responder_t *mtp)
+{
+    struct archive_transfer *archive = mtp->archive;
+    mtp_object_info_t info;
+    uint32_t handle = 0;
+    int kind = deserialize_archive_header(archive->header, &info);
+
+    if (kind < 0)
+    {
+        log_error("Archive entry %u: malformed header", (unsigned int) archive->entries);
+        return -1;
+    }
+    if (kind == MTP_ARCHIVE_END)
+    {
+        archive->ended = true;
+        return 0;
+    }
+
+    archive->remaining = info.size;
+    archive->padding = (MTP_ARCHIVE_BLOCK_SIZE - info.size % MTP_ARCHIVE_BLOCK_SIZE) % MTP_ARCHIVE_BLOCK_SIZE;
+    if (kind == MTP_ARCHIVE_SKIP)
+    {
+        return 0;
+    }
+
+    archive->entries++;
+    if (kind == MTP_ARCHIVE_REJECT)
+    {
+        log_error("Archive entry %u: path %s not allowed", (unsigned int) (archive->entries - 1), info.filename);
+        archive_entry_failed(mtp);
+        return 0;
+    }
+    info.storage_id = mtp->storage.id;
+    if (mtp->storage.api->create(mtp->storage.api_arg, &info, &handle))
+    {
+        archive_entry_failed(mtp);
+        return 0;
+    }
+    if (mtp->storage.api->open(mtp->storage.api_arg, handle, "w+"))
+    {
+        mtp->storage.api->remove(mtp->storage.api_arg, handle);
+        archive_entry_failed(mtp);
+        return 0;
+    }
+    mtp->transaction.file_open = true;
+    archive->handle = handle;
+
+    if (!archive->remaining)
+    {
+        end_archive_entry(mtp);
+    }
+    return 0;
+}
+
+/* Only one header is held at a time, payloads go straight to storage.
+ * Anything past the end of archive is ignored. */
+static int extract_archive(mtp_responder_t *mtp, const uint8_t *data, size_t size)
+{
+    struct archive_transfer *archive = mtp->archive;
+    size_t chunk;
+
+    while (size && !archive->ended)
+    {
+        if (archive->remaining)
+        {
+            chunk = (size_t)MIN(archive->remaining, (uint64_t)size);
+            if (archive->handle && mtp->storage.api->write(mtp->storage.api_arg, data, chunk) < 0)
+            {
+                archive_entry_failed(mtp);
+            }
+            archive->remaining -= chunk;
+            if (!archive->remaining && archive->handle)
+            {
+                end_archive_entry(mtp);
+            }
+        }
+        else if (archive->padding)
+        {
+            chunk = MIN((size_t)archive->padding, size);
+            archive->padding -= chunk;
+        }
+        else
+        {
+            chunk = MIN((size_t)(MTP_ARCHIVE_BLOCK_SIZE - archive->filled), size);
+            memcpy(&archive->header[archive->filled], data, chunk);
+            archive->filled += chunk;
+            if (archive->filled == MTP_ARCHIVE_BLOCK_SIZE)
+            {
+                archive->filled = 0;
+                if (begin_archive_entry(mtp) < 0)
+                {
+                    return -1;
+                }
+            }
+        }
+        data += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+/* Objects stored before data phase ended stay, response tells which failed */
+static uint16_t store_archive_end(mtp_responder_t *mtp, uint16_t error)
+{
+    struct archive_transfer *archive = mtp->archive;
+
+    if (archive->handle)
+    {
+        archive_entry_failed(mtp);
+    }
+    mtp->response.parameter[0] = archive->entries;
+    mtp->response.parameter[1] = archive->stored;
+    mtp->response.parameter[2] = archive->first_failed;
+    mtp->response.count = 3;
+    log_info("Archive: %u of %u files stored", (unsigned int) archive->stored, (unsigned int) archive->entries);
+    release_archive(mtp);
+    return error;
+}
+
+/* Received object data goes to storage, through the decoder if it was sent compressed */
+static int store_object_data(mtp_responder_t *mtp, const void *data, size_t size)
+{
+    if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_SEND_ARCHIVE)
+        return extract_archive(mtp, data, size);
+
+    if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED)
+        return mtp_lz4_decoder_feed(&mtp->lz4->decoder, data, size, write_decoded, mtp);
+
+    return mtp->storage.api->write(mtp->storage.api_arg, data, size) < 0 ? -1 : 0;
+}
+
+/* Corrupted compressed frame or failed write leaves nothing worth keeping, so
+ * the object is removed and the rest of the data phase isn't taken as object
+ * data */
+static uint16_t store_object_failed(mtp_responder_t *mtp)
+{
+    uint16_t error = MTP_RESPONSE_OBJECT_TOO_LARGE;
+
+    if (mtp->archive)
+    {
+        /* Entries can't be told apart past malformed header */
+        mtp->transaction.total = mtp->transaction.received;
+        return store_archive_end(mtp, MTP_RESPONSE_INVALID_DATASET);
+    }
+
+    mtp->storage.api->close(mtp->storage.api_arg);
+    mtp->transaction.file_open = false;
+    mtp->transaction.keep = false;
+
+    if (mtp->lz4)
+    {
+        if (!mtp->lz4->write_failed)
+            error = MTP_RESPONSE_INVALID_DATASET;
+        mtp->storage.api->remove(mtp->storage.api_arg, mtp->transaction.handle);
+        mtp->transaction.handle = 0;
+        mtp->transaction.total = mtp->transaction.received;
+        release_lz4(mtp);
+    }
+    else if (mtp->transaction.opcode == MTP_OPERATION_SEND_OBJECT
+            || mtp->transaction.opcode == MTP_OPERATION_SEND_PARTIAL_OBJECT)
+    {
+        /* Staged data no longer ends at recorded offset */
+        forget_staged(mtp, mtp->transaction.handle);
+        mtp->storage.api->remove(mtp->storage.api_arg, mtp->transaction.handle);
+        mtp->transaction.handle = 0;
+    }
+    return error;
+}
+
+/* Data phase is over. Resumed object still short of its size stays staged,
+ * complete one is made visible. */
+static uint16_t commit_upload(mtp_responder_t *mtp)
+{
+    const uint32_t handle = mtp->transaction.handle;
+    struct staged_upload *staged = find_staged(mtp, handle);
+    const size_t end = mtp->transaction.offset + mtp->transaction.total;
+
+    if (staged && end < staged->size)
+    {
+        staged->received = end;
+        staged->since = mtp->staging.now;
+        return MTP_RESPONSE_OK;
+    }
+
+    forget_staged(mtp, handle);
+    if (mtp->storage.api->commit && mtp->storage.api->commit(mtp->storage.api_arg, handle))
+    {
+        log_error("Unable to commit object %u", (unsigned int) handle);
+        return MTP_RESPONSE_STORE_NOT_AVAILABLE;
+    }
+    return MTP_RESPONSE_OK;
+}
+
+static uint16_t store_object_complete(mtp_responder_t *mtp)
+{
+    uint16_t error = MTP_RESPONSE_OK;
+
+    if (mtp->archive)
+    {
+        return store_archive_end(mtp, MTP_RESPONSE_OK);
+    }
+
+    mtp->storage.api->close(mtp->storage.api_arg);
+    mtp->transaction.file_open = false;
+    mtp->transaction.keep = false;
+
+    if (mtp->lz4)
+    {
+        if (!mtp_lz4_decoder_done(&mtp->lz4->decoder))
+        {
+            log_error("Compressed object: frame not terminated");
+            mtp->storage.api->remove(mtp->storage.api_arg, mtp->transaction.handle);
+            mtp->transaction.handle = 0;
+            error = MTP_RESPONSE_INVALID_DATASET;
+        }
+        release_lz4(mtp);
+    }
+    if (error == MTP_RESPONSE_OK)
+    {
+        error = commit_upload(mtp);
+    }
+    return error;
+}
+
+static uint16_t data_send_object(mtp_responder_t *mtp, const mtp_data_cntr_t* incoming, size_t size)
+{
+    uint16_t error;
+    size_t plen = size - MTP_CONTAINER_HEADER_SIZE;
+
+    if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED
+            || mtp->transaction.opcode == MTP_OPERATION_VENDOR_SEND_ARCHIVE)
+    {
+        /* Nothing announced the size, data phase carries the frame or the archive */
+        mtp->transaction.total = incoming->header.length - MTP_CONTAINER_HEADER_SIZE;
+        mtp->transaction.received = 0;
+    }
+
+    if (plen > 0)
+    {
+        if (store_object_data(mtp, incoming->payload, plen) < 0)
+        {
+            error = store_object_failed(mtp);
+            goto data_send_object_exit;
+        }
+    }
+
+    if (plen >= mtp->transaction.total)
+    {
+        error = store_object_complete(mtp);
+    }
+    else
     {
         mtp->transaction.received = plen;
         error = 0;
@@ -816,7 +2229,16 @@ static uint16_t handle_data(mtp_responder_t *mtp, const mtp_data_cntr_t *incomin
         case MTP_OPERATION_SEND_OBJECT_INFO:
             error = data_send_object_info(mtp, incoming, size);
             break;
+        case MTP_OPERATION_VENDOR_SEND_OBJECT_HASH:
+            error = data_send_object_hash(mtp, incoming, size);
+            break;
+        case MTP_OPERATION_VENDOR_SEND_SEARCH_QUERY:
+            error = data_send_search_query(mtp, incoming, size);
+            break;
         case MTP_OPERATION_SEND_OBJECT:
+        case MTP_OPERATION_SEND_PARTIAL_OBJECT:
+        case MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED:
+        case MTP_OPERATION_VENDOR_SEND_ARCHIVE:
             error = data_send_object(mtp, incoming, size);
             break;
         default:
@@ -826,10 +2248,6 @@ handle_data_exit:
     return error;
 }
 
-void mtp_cancel_transaction_from_event(mtp_responder_t *mtp)
-{
-}
-
 uint16_t mtp_responder_handle_request(mtp_responder_t *mtp, const void *request, const size_t req_size)
 {
     assert(mtp && request);
@@ -872,19 +2290,68 @@ size_t mtp_responder_get_data(mtp_responder_t *mtp)
         if (mtp->transaction.sent < mtp->transaction.total)
         {
             uint32_t available = (mtp->buf_size) / sizeof(uint32_t);
-            uint32_t *ptr = (uint32_t*)mtp->buffer;
-            uint32_t i;
-            for (i = 0; i < available; i++, ptr++)
+            cntr_length = find_handles(mtp, (uint32_t*)mtp->buffer, available) * sizeof(uint32_t);
+            mtp->transaction.sent += cntr_length;
+        }
+    }
+    else if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_GET_SEARCH_RESULTS)
+    {
+        if (mtp->transaction.sent < mtp->transaction.total)
+        {
+            size_t space = MIN(mtp->buf_size, mtp->transaction.total - mtp->transaction.sent);
+            cntr_length = mtp->storage.api->search_batch(mtp->storage.api_arg,
+                    (uint32_t *)mtp->buffer, space / sizeof(uint32_t)) * sizeof(uint32_t);
+            if (cntr_length < space)
             {
-                *ptr = mtp->storage.api->find_next(mtp->storage.api_arg);
-                if (*ptr == 0) {
-                    break;
-                }
+                memset((uint8_t *)mtp->buffer + cntr_length, 0, space - cntr_length);
+                cntr_length = space;
+            }
+            mtp->transaction.sent += cntr_length;
+        }
+    }
+    else if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_GET_SYNC_MANIFEST)
+    {
+        if (mtp->transaction.sent < mtp->transaction.total)
+        {
+            size_t space = MIN(mtp->buf_size, mtp->transaction.total - mtp->transaction.sent);
+            cntr_length = fill_manifest(mtp, mtp->buffer, space);
+            if (cntr_length < space)
+            {
+                memset((uint8_t *)mtp->buffer + cntr_length, 0, space - cntr_length);
+                cntr_length = space;
             }
-            cntr_length = i * sizeof(uint32_t);
             mtp->transaction.sent += cntr_length;
         }
     }
+    else if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_GET_OBJECT_COMPRESSED)
+    {
+        if (mtp->lz4)
+        {
+            cntr_length = fill_lz4(mtp, mtp->buffer, mtp->buf_size);
+            mtp->transaction.sent += cntr_length;
+            if (cntr_length < mtp->buf_size)
+            {
+                /* Frame ended, data transaction no longer open */
+                end_get_object_compressed(mtp);
+                mtp->transaction.total = mtp->transaction.sent;
+                log_info("DT total>: 0x%x", mtp->transaction.sent);
+            }
+        }
+    }
+    else if (mtp->transaction.opcode == MTP_OPERATION_VENDOR_GET_ARCHIVE)
+    {
+        if (mtp->archive)
+        {
+            cntr_length = fill_archive(mtp, mtp->buffer, mtp->buf_size);
+            mtp->transaction.sent += cntr_length;
+            if (cntr_length < mtp->buf_size)
+            {
+                end_get_archive(mtp);
+                mtp->transaction.total = mtp->transaction.sent;
+                log_info("DT total>: 0x%x", mtp->transaction.sent);
+            }
+        }
+    }
     else if (mtp->transaction.opcode == MTP_OPERATION_GET_OBJECT)
     {
         if (mtp->transaction.sent < mtp->transaction.total)
@@ -910,20 +2377,70 @@ bool mtp_responder_data_transaction_open(mtp_responder_t *mtp)
     return (mtp->transaction.received) > 0 && (mtp->transaction.received < mtp->transaction.total);
 }
 
-uint16_t mtp_responder_cancel_data_transaction(mtp_responder_t *mtp)
+uint16_t mtp_responder_transaction_operation(mtp_responder_t *mtp, uint32_t *object)
 {
-    if (mtp->transaction.opcode == MTP_OPERATION_SEND_OBJECT) {
-        mtp->storage.api->close(mtp->storage.api_arg);
-        mtp->transaction.file_open = false;
-        mtp->storage.api->remove(mtp->storage.api_arg, mtp->transaction.handle);
-    } else if (mtp->transaction.opcode == MTP_OPERATION_GET_OBJECT) {
+    *object = mtp->transaction.object;
+    return mtp->transaction.opcode;
+}
+
+size_t mtp_responder_data_transaction_size(mtp_responder_t *mtp)
+{
+    return mtp->transaction.total;
+}
+
+/* Release whatever the interrupted transaction holds. A partially received
+ * object is staged for resuming or removed, so it doesn't show up as a valid
+ * but truncated file. */
+static void abort_transaction(mtp_responder_t *mtp)
+{
+    if (mtp->transaction.file_open)
+    {
         mtp->storage.api->close(mtp->storage.api_arg);
         mtp->transaction.file_open = false;
+        switch (mtp->transaction.opcode)
+        {
+            case MTP_OPERATION_SEND_OBJECT:
+            case MTP_OPERATION_SEND_PARTIAL_OBJECT:
+                if (stage_upload(mtp))
+                    break;
+                /* fall through */
+            case MTP_OPERATION_VENDOR_SEND_OBJECT_COMPRESSED:
+                /* Decoder state is gone, compressed upload can't be resumed */
+                forget_staged(mtp, mtp->transaction.handle);
+                mtp->storage.api->remove(mtp->storage.api_arg, mtp->transaction.handle);
+                break;
+            case MTP_OPERATION_VENDOR_SEND_ARCHIVE:
+                /* Entries stored so far are complete, only the one being written goes */
+                mtp->storage.api->remove(mtp->storage.api_arg, mtp->archive->handle);
+                break;
+            default:
+                break;
+        }
     }
-    mtp->transaction.received = 0;
+    release_lz4(mtp);
+    release_archive(mtp);
+
+    mtp->transaction.keep = false;
+    mtp->transaction.offset = 0;
     mtp->transaction.total = 0;
+    mtp->transaction.sent = 0;
+    mtp->transaction.received = 0;
+    mtp->transaction.in_buffer = 0;
     mtp->transaction.handle = 0;
-    mtp->transaction.keep = false;
+}
+
+uint16_t mtp_responder_cancel_transaction(mtp_responder_t *mtp, uint32_t transaction_id)
+{
+    assert(mtp);
+
+    if (transaction_id != mtp->transaction.id) {
+        log_info("mtp_responder: cancel %u, but current is %u",
+                (unsigned int) transaction_id,
+                (unsigned int) mtp->transaction.id);
+    }
+
+    abort_transaction(mtp);
+    log_info("mtp_responder: cancelled %u", (unsigned int) mtp->transaction.id);
     return MTP_RESPONSE_TRANSACTION_CANCELLED;
 }
 
@@ -940,13 +2457,9 @@ uint16_t mtp_responder_set_data(mtp_responder_t *mtp, void *incoming, size_t siz
         goto mtp_responder_receive_data_exit;
     }
 
-    if (mtp->storage.api->write(mtp->storage.api_arg, incoming, size) < 0)
+    if (store_object_data(mtp, incoming, size) < 0)
     {
-        error = MTP_RESPONSE_OBJECT_TOO_LARGE;
-        mtp->storage.api->close(mtp->storage.api_arg);
-        mtp->transaction.file_open = false;
-        mtp->transaction.keep = false;
-
+        error = store_object_failed(mtp);
         log_error("DT< %s Write error", dbg_operation(mtp->transaction.opcode));
         goto mtp_responder_receive_data_exit;
     }
@@ -955,10 +2468,7 @@ uint16_t mtp_responder_set_data(mtp_responder_t *mtp, void *incoming, size_t siz
 
     if (mtp->transaction.received >= mtp->transaction.total)
     {
-        error = MTP_RESPONSE_OK;
-        mtp->storage.api->close(mtp->storage.api_arg);
-        mtp->transaction.file_open = false;
-        mtp->transaction.keep = false;
+        error = store_object_complete(mtp);
         goto mtp_responder_receive_data_exit;
     }
 
@@ -983,7 +2493,12 @@ void mtp_responder_get_response(mtp_responder_t *mtp, uint16_t code, void *data_
         log_info("CANCELED TID: %x", (unsigned int) mtp->transaction.id);
     }
 
-    if (mtp->transaction.handle)
+    if (mtp->response.count)
+    {
+        memcpy(response->parameter, mtp->response.parameter, mtp->response.count * sizeof(uint32_t));
+        response->header.length += mtp->response.count * sizeof(uint32_t);
+    }
+    else if (mtp->transaction.handle)
     {
         response->parameter[0] = mtp->storage.id;
         response->parameter[1] = 0xFFFFFFFF;
@@ -1007,20 +2522,55 @@ void mtp_responder_get_event(mtp_responder_t *mtp, uint16_t code, void *data_out
     *size = event->length;
 }
 
-void mtp_responder_transaction_reset(mtp_responder_t *mtp)
+void mtp_responder_get_object_event(mtp_responder_t *mtp, uint16_t code, uint32_t handle, void *data_out, size_t *size)
 {
-    if (mtp->transaction.opcode == MTP_OPERATION_SEND_OBJECT) {
-        mtp->storage.api->close(mtp->storage.api_arg);
-        mtp->storage.api->remove(mtp->storage.api_arg, mtp->transaction.handle);
-    } else if (mtp->transaction.opcode == MTP_OPERATION_GET_OBJECT) {
-        mtp->storage.api->close(mtp->storage.api_arg);
+    assert(mtp && data_out && size);
+
+    /* Events have no meaning for host without session, handles are gone */
+    if (!mtp->session_open)
+    {
+        *size = 0;
+        return;
     }
 
-    mtp->transaction.keep = false;
-    mtp->transaction.sent = 0;
-    mtp->transaction.received = 0;
-    mtp->transaction.in_buffer = 0;
-    mtp->transaction.handle = 0;
+    mtp_op_cntr_t *event = (mtp_op_cntr_t*)data_out;
+    event->header.type = MTP_CONTAINER_TYPE_EVENT;
+    event->header.event_code = code;
+    event->header.transaction_id = 0;
+    event->parameter[0] = handle;
+    event->header.length = MTP_CONTAINER_HEADER_SIZE + sizeof(uint32_t);
+    *size = event->header.length;
+}
+
+void mtp_responder_transaction_reset(mtp_responder_t *mtp)
+{
+    abort_transaction(mtp);
     log_info("mtp_responder: reset %u", (unsigned int) mtp->transaction.id);
 }
 
+void mtp_responder_set_staging_timeout(mtp_responder_t *mtp, uint32_t timeout)
+{
+    assert(mtp);
+    mtp->staging.timeout = timeout;
+}
+
+void mtp_responder_collect_staged(mtp_responder_t *mtp, uint32_t now)
+{
+    int i;
+    assert(mtp);
+
+    mtp->staging.now = now;
+    for (i = 0; i < CONFIG_MTP_STAGED_UPLOADS; i++)
+    {
+        struct staged_upload *staged = &mtp->staging.uploads[i];
+        if (!staged->handle || now - staged->since < mtp->staging.timeout)
+            continue;
+        /* Being resumed right now */
+        if (mtp->transaction.file_open && staged->handle == mtp->transaction.handle)
+            continue;
+        log_info("Staged upload %u expired", (unsigned int) staged->handle);
+        mtp->storage.api->remove(mtp->storage.api_arg, staged->handle);
+        memset(staged, 0, sizeof(struct staged_upload));
+    }
+}
+
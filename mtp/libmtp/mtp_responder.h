@@ -15,6 +15,15 @@
 /* TODO: need to implement this */
 #define CONFIG_MTP_OBJECTS_PER_NODE
 
+/* Interrupted uploads kept for resuming, the oldest one is dropped when full */
+#ifndef CONFIG_MTP_STAGED_UPLOADS
+#define CONFIG_MTP_STAGED_UPLOADS 4
+#endif
+/* Seconds an interrupted upload waits to be resumed before it's removed */
+#ifndef CONFIG_MTP_STAGING_TIMEOUT
+#define CONFIG_MTP_STAGING_TIMEOUT (30 * 60)
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -109,6 +118,20 @@ size_t mtp_responder_get_data(mtp_responder_t *mtp);
  *  */
 bool mtp_responder_data_transaction_open(mtp_responder_t *mtp);
 
+/** @brief Size of data phase of current transaction
+ *  @param mtp library handle
+ *  @returns number of bytes to be sent or received, 0 if no data phase
+ */
+size_t mtp_responder_data_transaction_size(mtp_responder_t *mtp);
+
+/** @brief Operation of current transaction and object it works on
+ *  @param mtp library handle
+ *  @param object set to handle of the object, 0 if operation doesn't refer
+ *         to a single object
+ *  @returns operation code, 0 before the first transaction
+ */
+uint16_t mtp_responder_transaction_operation(mtp_responder_t *mtp, uint32_t *object);
+
 /** @brief Returns amount of data to be received in current transaction
  *  @param mtp library handle
  *  @param incoming data to be written
@@ -134,8 +157,46 @@ void mtp_responder_get_response(mtp_responder_t *mtp, uint16_t code, void *data_
  */
 void mtp_responder_get_event(mtp_responder_t *mtp, uint16_t code, void *data_out, size_t *size);
 
+/** @brief Create an event container telling the host about object changed
+ *         outside of MTP, to be sent over interrupt endpoint
+ *  @param mtp library handle
+ *  @param code MTP_EVENT_OBJECT_ADDED, MTP_EVENT_OBJECT_REMOVED or
+ *         MTP_EVENT_OBJECT_INFO_CHANGED
+ *  @param handle object handle
+ *  @param data_out buffer to store the frame
+ *  @param size frame length to be send, 0 when there's no open session
+ */
+void mtp_responder_get_object_event(mtp_responder_t *mtp, uint16_t code, uint32_t handle, void *data_out, size_t *size);
+
+/** @brief Abort current transaction without sending response. Open file is
+ *         closed and partially received object is staged for resuming when
+ *         storage supports it, removed otherwise.
+ *  @param mtp library handle
+ */
 void mtp_responder_transaction_reset(mtp_responder_t *mtp);
 
+/** @brief Handle cancel request issued by the host (Still Image class
+ *         request or cancel event). Releases transaction resources the same
+ *         way as @mtp_responder_transaction_reset.
+ *  @param mtp library handle
+ *  @param transaction_id id of transaction to cancel, as sent by the host
+ *  @returns MTP_RESPONSE_TRANSACTION_CANCELLED
+ */
+uint16_t mtp_responder_cancel_transaction(mtp_responder_t *mtp, uint32_t transaction_id);
+
+/** @brief Set how long interrupted uploads are kept for resuming
+ *  @param mtp library handle
+ *  @param timeout in seconds, 0 removes partially received objects right away
+ */
+void mtp_responder_set_staging_timeout(mtp_responder_t *mtp, uint32_t timeout);
+
+/** @brief Remove interrupted uploads not resumed within staging timeout.
+ *         Meant to be called periodically, also provides time for staging.
+ *  @param mtp library handle
+ *  @param now current time in seconds, from any monotonic clock
+ */
+void mtp_responder_collect_staged(mtp_responder_t *mtp, uint32_t now);
+
 
 #endif /* _MTP_RESPONDER_H */
 
@@ -6,6 +6,7 @@
 #include "mtp_responder.h"
 #include "mtp_storage.h"
 #include "mtp_util.h"
+#include <stdio.h>
 #include <string.h>
 
 typedef struct {
@@ -29,9 +30,46 @@ static const obj_property_t properties[] =
     { MTP_PROPERTY_DATE_MODIFIED,    MTP_TYPE_STR,    true,  3, offsetof(mtp_object_info_t, modified)},
     { MTP_PROPERTY_PARENT_OBJECT,    MTP_TYPE_UINT32, false, 0, offsetof(mtp_object_info_t, parent)},
     { MTP_PROPERTY_OBJECT_FILE_NAME, MTP_TYPE_STR,    true,  0, offsetof(mtp_object_info_t, filename)},
+    // Vendor:
+    { MTP_PROPERTY_VENDOR_CRC32C,    MTP_TYPE_UINT32, false, 0, offsetof(mtp_object_info_t, checksum)},
 };
 static const int properties_num = sizeof(properties) / sizeof(obj_property_t);
 
+/* Properties of mtp_media_info_t, reported for matching formats only */
+static const obj_property_t audio_properties[] =
+{
+    { MTP_PROPERTY_ARTIST,           MTP_TYPE_STR,    false, 0, offsetof(mtp_media_info_t, artist)},
+    { MTP_PROPERTY_ALBUM_NAME,       MTP_TYPE_STR,    false, 0, offsetof(mtp_media_info_t, album)},
+    { MTP_PROPERTY_ALBUM_ARTIST,     MTP_TYPE_STR,    false, 0, offsetof(mtp_media_info_t, album_artist)},
+    { MTP_PROPERTY_GENRE,            MTP_TYPE_STR,    false, 0, offsetof(mtp_media_info_t, genre)},
+    { MTP_PROPERTY_TRACK,            MTP_TYPE_UINT16, false, 0, offsetof(mtp_media_info_t, track)},
+    { MTP_PROPERTY_DURATION,         MTP_TYPE_UINT32, false, 0, offsetof(mtp_media_info_t, duration)},
+};
+static const int audio_properties_num = sizeof(audio_properties) / sizeof(obj_property_t);
+
+static const obj_property_t image_properties[] =
+{
+    { MTP_PROPERTY_WIDTH,            MTP_TYPE_UINT32, false, 0, offsetof(mtp_media_info_t, width)},
+    { MTP_PROPERTY_HEIGHT,           MTP_TYPE_UINT32, false, 0, offsetof(mtp_media_info_t, height)},
+};
+static const int image_properties_num = sizeof(image_properties) / sizeof(obj_property_t);
+
+static const obj_property_t* find_media_property(uint16_t prop_code)
+{
+    int i;
+    for (i = 0; i < audio_properties_num; i++)
+    {
+        if (audio_properties[i].id == prop_code)
+            return &audio_properties[i];
+    }
+    for (i = 0; i < image_properties_num; i++)
+    {
+        if (image_properties[i].id == prop_code)
+            return &image_properties[i];
+    }
+    return NULL;
+}
+
 uint32_t serialize_storage_list(mtp_storage_t *storage, uint32_t parent, uint8_t *data)
 {
     uint32_t handle = 0;
@@ -40,14 +78,40 @@ uint32_t serialize_storage_list(mtp_storage_t *storage, uint32_t parent, uint8_t
 
     if ((handle = storage->api->find_first(storage->api_arg, parent, &count))) {
         *ptr++ = handle;
-        while((handle = storage->api->find_next(storage->api_arg))) {
-            *ptr++ = handle;
+        if (storage->api->find_batch) {
+            uint32_t found = 1;
+            uint32_t batch;
+            while (found < count &&
+                   (batch = storage->api->find_batch(storage->api_arg, ptr, count - found))) {
+                ptr += batch;
+                found += batch;
+            }
+        } else {
+            while((handle = storage->api->find_next(storage->api_arg))) {
+                *ptr++ = handle;
+            }
         }
     }
     *(uint32_t*)data = count;
     return (1 + count)*sizeof(uint32_t);
 }
 
+uint32_t serialize_manifest_entry(uint32_t handle, const mtp_object_info_t *info, uint8_t *data)
+{
+    const uint64_t modified = (uint64_t)info->modified;
+    const uint16_t name_length = strnlen(info->filename, sizeof(info->filename) - 1);
+
+    /* Entries are packed, copy to stay clear of unaligned stores */
+    memcpy(data, &handle, 4);
+    memcpy(data + 4, &info->size, 8);
+    memcpy(data + 12, &modified, 8);
+    memcpy(data + 20, &info->format_code, 2);
+    memcpy(data + 22, &info->checksum, 4);
+    memcpy(data + 26, &name_length, 2);
+    memcpy(data + MTP_MANIFEST_ENTRY_HEADER_SIZE, info->filename, name_length);
+    return MTP_MANIFEST_ENTRY_HEADER_SIZE + name_length;
+}
+
 uint32_t serialize_object_info(mtp_object_info_t* info, uint8_t *data)
 {
     uint32_t length = 0;
@@ -94,6 +158,9 @@ int deserialize_object_info(const uint8_t *data, size_t length, mtp_object_info_
     }
     ptr += returned_length;
 
+    /* Dates are optional, 0 when host didn't send them */
+    info->created = 0;
+    info->modified = 0;
     returned_length = get_date(ptr, &info->created);
     if (returned_length > 0) {
         ptr += returned_length;
@@ -107,19 +174,212 @@ int deserialize_object_info(const uint8_t *data, size_t length, mtp_object_info_
     return 0;
 }
 
-uint32_t serialize_object_props_supported(uint8_t *data)
+int deserialize_search_query(const uint8_t *data, size_t length, mtp_search_query_t *query)
 {
+    uint64_t modified_from;
+    uint64_t modified_to;
+    uint16_t name_length;
+
+    if (length < MTP_SEARCH_QUERY_HEADER_SIZE) {
+        return -1;
+    }
+    /* Dataset is packed, copy to stay clear of unaligned loads */
+    memcpy(&query->format_code, data, 2);
+    memcpy(&query->name_match, data + 2, 2);
+    memcpy(&query->size_min, data + 4, 8);
+    memcpy(&query->size_max, data + 12, 8);
+    memcpy(&modified_from, data + 20, 8);
+    memcpy(&modified_to, data + 28, 8);
+    memcpy(&name_length, data + 36, 2);
+
+    if (query->name_match > MTP_SEARCH_NAME_SUFFIX
+            || (size_t)name_length >= sizeof(query->name)
+            || MTP_SEARCH_QUERY_HEADER_SIZE + (size_t)name_length > length) {
+        return -1;
+    }
+    query->modified_from = (time_t)modified_from;
+    query->modified_to = (time_t)modified_to;
+    memcpy(query->name, data + MTP_SEARCH_QUERY_HEADER_SIZE, name_length);
+    query->name[name_length] = '\0';
+    return 0;
+}
+
+int deserialize_object_hash(const uint8_t *data, size_t length, mtp_object_hash_t *hash)
+{
+    if (length < MTP_OBJECT_HASH_SIZE) {
+        return -1;
+    }
+    memcpy(&hash->checksum, data, 4);
+    memcpy(&hash->size, data + 4, 8);
+    memcpy(hash->digest, data + 12, MTP_SHA256_SIZE);
+    return 0;
+}
+
+static void put_archive_block(uint8_t *data, const char *name, uint64_t size, time_t modified, char type)
+{
+    uint32_t sum = 0;
     int i;
-    uint16_t *item;
+
+    memset(data, 0, MTP_ARCHIVE_BLOCK_SIZE);
+    strncpy((char *)data, name, 100);
+    memcpy(data + 100, "0000644", 8);
+    memcpy(data + 108, "0000000", 8);
+    memcpy(data + 116, "0000000", 8);
+    if (size < (1ULL << 33)) {
+        sprintf((char *)data + 124, "%011llo", (unsigned long long)size);
+    }
+    else {
+        data[124] = 0x80;
+        for (i = 0; i < 8; i++) {
+            data[135 - i] = (uint8_t)(size >> (8 * i));
+        }
+    }
+    sprintf((char *)data + 136, "%011llo", (unsigned long long)(modified > 0 ? modified : 0));
+    data[156] = type;
+    memcpy(data + 257, "ustar", 6);
+    memcpy(data + 263, "00", 2);
+
+    memset(data + 148, ' ', 8);
+    for (i = 0; i < MTP_ARCHIVE_BLOCK_SIZE; i++) {
+        sum += data[i];
+    }
+    sprintf((char *)data + 148, "%06o", (unsigned int)sum);
+}
+
+uint32_t serialize_archive_header(const mtp_object_info_t *info, uint8_t *data)
+{
+    const size_t name_length = strlen(info->filename);
     uint32_t length = 0;
 
+    if (name_length >= 100) {
+        put_archive_block(data, "././@LongLink", name_length + 1, 0, 'L');
+        memset(data + MTP_ARCHIVE_BLOCK_SIZE, 0, MTP_ARCHIVE_BLOCK_SIZE);
+        memcpy(data + MTP_ARCHIVE_BLOCK_SIZE, info->filename, name_length);
+        length = 2 * MTP_ARCHIVE_BLOCK_SIZE;
+    }
+    put_archive_block(data + length, info->filename, info->size, info->modified, '0');
+    return length + MTP_ARCHIVE_BLOCK_SIZE;
+}
+
+/* Numeric header field: octal digits, optionally padded with spaces and
+ * terminated by NUL or space, or base-256 when the top bit is set */
+static int get_archive_number(const uint8_t *field, size_t length, uint64_t *value)
+{
+    size_t i = 0;
+
+    *value = 0;
+    if (field[0] & 0x80) {
+        *value = field[0] & 0x3f;
+        for (i = 1; i < length; i++) {
+            *value = (*value << 8) | field[i];
+        }
+        return 0;
+    }
+
+    while (i < length && field[i] == ' ') {
+        i++;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        *value = (*value << 3) | (field[i] - '0');
+    }
+    if (i < length && field[i] != '\0' && field[i] != ' ') {
+        return -1;
+    }
+    return 0;
+}
+
+int deserialize_archive_header(const uint8_t *data, mtp_object_info_t *info)
+{
+    const char *prefix = (const char *)data + 345;
+    const char *name = (const char *)data;
+    uint64_t checksum;
+    uint64_t modified;
+    uint32_t sum = 0;
+    size_t prefix_length;
+    size_t name_length;
+    int i;
+
+    for (i = 0; i < MTP_ARCHIVE_BLOCK_SIZE; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : data[i];
+    }
+    if (sum == 8 * ' ') {
+        return MTP_ARCHIVE_END;
+    }
+
+    memset(info, 0, sizeof(mtp_object_info_t));
+    if (get_archive_number(data + 148, 8, &checksum) || checksum != sum
+            || get_archive_number(data + 124, 12, &info->size)
+            || get_archive_number(data + 136, 12, &modified)) {
+        return -1;
+    }
+    info->modified = (time_t)modified;
+    info->created = info->modified;
+    info->format_code = MTP_FORMAT_UNDEFINED;
+
+    if (data[156] != '0' && data[156] != '\0') {
+        return MTP_ARCHIVE_SKIP;
+    }
+
+    /* Prefix is there in ustar only, older headers may use its space */
+    prefix_length = memcmp(data + 257, "ustar", 5) ? 0 : strnlen(prefix, 155);
+    name_length = strnlen(name, 100);
+    if (prefix_length + 1 + name_length >= sizeof(info->filename)) {
+        return -1;
+    }
+    if (prefix_length) {
+        memcpy(info->filename, prefix, prefix_length);
+        info->filename[prefix_length++] = '/';
+    }
+    memcpy(info->filename + prefix_length, name, name_length);
+
+    /* Archives made from a directory have "./" in front of each name */
+    while (info->filename[0] == '.' && info->filename[1] == '/') {
+        memmove(info->filename, info->filename + 2, strlen(info->filename + 2) + 1);
+    }
+    if (!info->filename[0]) {
+        return -1;
+    }
+
+    /* Objects are created in storage root, name mustn't lead anywhere else
+     * nor replace files of the storage itself */
+    if (strchr(info->filename, '/') || !strcmp(info->filename, ".") || !strcmp(info->filename, "..")
+            || !strncmp(info->filename, MTP_STORAGE_RESERVED_PREFIX, strlen(MTP_STORAGE_RESERVED_PREFIX))) {
+        return MTP_ARCHIVE_REJECT;
+    }
+    return MTP_ARCHIVE_FILE;
+}
+
+uint32_t serialize_object_props_supported(uint16_t format_code, uint8_t *data)
+{
+    int i;
+    int count = 0;
+    uint16_t *item;
+    const obj_property_t *media = NULL;
+    int media_num = 0;
+
+    switch (format_code)
+    {
+        case MTP_FORMAT_MP3:
+        case MTP_FORMAT_WAV:
+        case MTP_FORMAT_FLAC:
+            media = audio_properties;
+            media_num = audio_properties_num;
+            break;
+        case MTP_FORMAT_EXIF_JPEG:
+            media = image_properties;
+            media_num = image_properties_num;
+            break;
+    }
+
     item = (uint16_t *)(data + 4);
     for (i = 0; i < properties_num; i++) {
-        item[i] = properties[i].id;
+        item[count++] = properties[i].id;
     }
-    *(uint32_t *)data = properties_num;
-    length = 4 + 2 * properties_num;
-    return length;
+    for (i = 0; i < media_num; i++) {
+        item[count++] = media[i].id;
+    }
+    *(uint32_t *)data = count;
+    return 4 + 2 * count;
 }
 
 uint32_t serialize_storage_info(mtp_storage_t *storage, uint8_t *data)
@@ -238,6 +498,7 @@ static uint32_t serialize_type_desc(const obj_property_t* prop, uint8_t *data)
 uint32_t serialize_object_prop_desc(uint16_t prop_code, uint8_t *data)
 {
     uint32_t length = 0;
+    const obj_property_t *media;
     int i;
     for(i = 0; i < properties_num; i++)
     {
@@ -247,67 +508,72 @@ uint32_t serialize_object_prop_desc(uint16_t prop_code, uint8_t *data)
             break;
         }
     }
+    if (!length && (media = find_media_property(prop_code)))
+    {
+        length = serialize_type_desc(media, data);
+    }
     return length;
 }
 
-static uint32_t serialize_type_value_uint16(const obj_property_t *prop, mtp_object_info_t *info, uint8_t *data)
+static uint32_t serialize_type_value_uint16(const obj_property_t *prop, const void *values, uint8_t *data)
 {
-    *(uint16_t*)data = *(uint16_t*)((uint8_t*)info + prop->offset);
+    *(uint16_t*)data = *(const uint16_t*)((const uint8_t*)values + prop->offset);
     return 2;
 }
 
-static uint32_t serialize_type_value_uint32(const obj_property_t *prop, mtp_object_info_t *info, uint8_t *data)
+static uint32_t serialize_type_value_uint32(const obj_property_t *prop, const void *values, uint8_t *data)
 {
-    *(uint32_t*)data = *(uint32_t*)((uint8_t*)info + prop->offset);
+    *(uint32_t*)data = *(const uint32_t*)((const uint8_t*)values + prop->offset);
     return 4;
 }
 
-static uint32_t serialize_type_value_uint64(const obj_property_t *prop, mtp_object_info_t *info, uint8_t *data)
+static uint32_t serialize_type_value_uint64(const obj_property_t *prop, const void *values, uint8_t *data)
 {
-    memcpy(data, (uint8_t*)info + prop->offset, 8);
+    memcpy(data, (const uint8_t*)values + prop->offset, 8);
     return 8;
 }
 
-static uint32_t serialize_type_value_uint128(const obj_property_t *prop, mtp_object_info_t *info, uint8_t *data)
+static uint32_t serialize_type_value_uint128(const obj_property_t *prop, const void *values, uint8_t *data)
 {
-    memcpy(data, (uint8_t*)info + prop->offset, 16);
+    memcpy(data, (const uint8_t*)values + prop->offset, 16);
     return 16;
 }
 
-static uint32_t serialize_type_value_str(const obj_property_t *prop, mtp_object_info_t *info, uint8_t *data)
+static uint32_t serialize_type_value_str(const obj_property_t *prop, const void *values, uint8_t *data)
 {
     uint32_t length = 0;
     if (prop->form == 0)
     {
-        length = put_string(data, (char*)info + prop->offset);
+        length = put_string(data, (const char*)values + prop->offset);
     }
     else if (prop->form == 3)
     {
-        time_t *t  = (time_t*)((uint8_t*)info + prop->offset);
+        const time_t *t  = (const time_t*)((const uint8_t*)values + prop->offset);
         length = put_date(data, *t);
     }
     return length;
 }
 
-static uint32_t serialize_prop_value(const obj_property_t *prop, mtp_object_info_t *info, uint8_t *data)
+/* values is mtp_object_info_t or mtp_media_info_t, as offsets of prop tell */
+static uint32_t serialize_prop_value(const obj_property_t *prop, const void *values, uint8_t *data)
 {
     uint32_t length = 0;
     switch(prop->type)
     {
         case MTP_TYPE_UINT16:
-            length = serialize_type_value_uint16(prop, info, data);
+            length = serialize_type_value_uint16(prop, values, data);
             break;
         case MTP_TYPE_UINT32:
-            length = serialize_type_value_uint32(prop, info, data);
+            length = serialize_type_value_uint32(prop, values, data);
             break;
         case MTP_TYPE_UINT64:
-            length = serialize_type_value_uint64(prop, info, data);
+            length = serialize_type_value_uint64(prop, values, data);
             break;
         case MTP_TYPE_UINT128:
-            length = serialize_type_value_uint128(prop, info, data);
+            length = serialize_type_value_uint128(prop, values, data);
             break;
         case MTP_TYPE_STR:
-            length = serialize_type_value_str(prop, info, data);
+            length = serialize_type_value_str(prop, values, data);
             break;
     }
     return length;
@@ -328,12 +594,26 @@ uint32_t serialize_object_prop_value(uint16_t prop_code, mtp_object_info_t *info
     return length;
 }
 
+uint32_t serialize_media_prop_value(uint16_t prop_code, const mtp_media_info_t *media, uint8_t *data)
+{
+    const obj_property_t *prop = find_media_property(prop_code);
+    return prop ? serialize_prop_value(prop, media, data) : 0;
+}
+
 static int deserialize_prop_value(const obj_property_t *prop, const uint8_t *data, void *value, int value_size)
 {
     int length = 0;
     switch (prop->type)
     {
         case MTP_TYPE_STR:
+            /* DateTime form, parsed to time_t */
+            if (prop->form == 3)
+            {
+                if (value_size < (int)sizeof(time_t))
+                    return -1;
+                length = get_date(data, (time_t*)value);
+                break;
+            }
             length = get_string(data, value, value_size);
             break;
     }
@@ -10,6 +10,41 @@
 #include <time.h>
 
 #define MTP_STORAGE_FILENAME_LENGTH (255 + 1)
+/* Storage keeps its own files in root under names with this prefix, objects
+ * can't be named so */
+#define MTP_STORAGE_RESERVED_PREFIX ".mtp_"
+
+/* Sync manifest entry, little endian, packed:
+ * handle (4), size (8), modified (8), format (2), checksum (4),
+ * name length (2), UTF-8 name without terminator */
+#define MTP_MANIFEST_ENTRY_HEADER_SIZE (28)
+#define MTP_MANIFEST_ENTRY_MAX_SIZE (MTP_MANIFEST_ENTRY_HEADER_SIZE + MTP_STORAGE_FILENAME_LENGTH - 1)
+
+/* Archive taken by SendArchive is ustar: 512 byte header followed by payload
+ * padded to 512 bytes for each entry, zero block after the last one */
+#define MTP_ARCHIVE_BLOCK_SIZE (512)
+#define MTP_ARCHIVE_FILE (0)    /* regular file, becomes an object */
+#define MTP_ARCHIVE_SKIP (1)    /* directory, link or extended header */
+#define MTP_ARCHIVE_END (2)
+#define MTP_ARCHIVE_REJECT (3)  /* regular file with a path or reserved name */
+/* Header of file with long name is preceded by GNU long name entry */
+#define MTP_ARCHIVE_HEADER_MAX_SIZE (3 * MTP_ARCHIVE_BLOCK_SIZE)
+
+/* Search query taken by SendSearchQuery, little endian, packed:
+ * format (2), name match (2), size min (8), size max (8), modified from (8),
+ * modified to (8), name length (2), UTF-8 name without terminator.
+ * Ranges are inclusive, times are signed seconds since epoch. Format 0
+ * matches any. */
+#define MTP_SEARCH_QUERY_HEADER_SIZE (38)
+#define MTP_SEARCH_NAME_ANY (0)
+#define MTP_SEARCH_NAME_PREFIX (1)
+#define MTP_SEARCH_NAME_SUBSTRING (2)
+#define MTP_SEARCH_NAME_SUFFIX (3)
+
+/* Content announced by SendObjectHash, little endian, packed:
+ * CRC32C (4), size (8), SHA-256 (32) */
+#define MTP_OBJECT_HASH_SIZE (44)
+#define MTP_SHA256_SIZE (32)
 
 typedef struct mtp_object_info {
     uint32_t storage_id;
@@ -22,9 +57,41 @@ typedef struct mtp_object_info {
     uint32_t parent;
     uint64_t size;
     uint8_t uuid[16];
+    uint32_t checksum;  /* CRC32C of content, 0 if not known */
     char filename[MTP_STORAGE_FILENAME_LENGTH];
 } mtp_object_info_t;
 
+/* Media metadata read from file headers, empty or 0 when not found */
+#define MTP_MEDIA_TEXT_LENGTH (64)
+typedef struct mtp_media_info {
+    char artist[MTP_MEDIA_TEXT_LENGTH];
+    char album[MTP_MEDIA_TEXT_LENGTH];
+    char album_artist[MTP_MEDIA_TEXT_LENGTH];
+    char genre[MTP_MEDIA_TEXT_LENGTH];
+    uint32_t duration;  /* milliseconds */
+    uint16_t track;
+    uint32_t width;
+    uint32_t height;
+} mtp_media_info_t;
+
+/* Names are matched ignoring case of ASCII letters */
+typedef struct mtp_search_query {
+    uint16_t format_code;
+    uint16_t name_match;
+    uint64_t size_min;
+    uint64_t size_max;
+    time_t modified_from;
+    time_t modified_to;
+    char name[MTP_STORAGE_FILENAME_LENGTH];
+} mtp_search_query_t;
+
+/* CRC32C and size only narrow down candidates, SHA-256 tells the content is the same */
+typedef struct mtp_object_hash {
+    uint32_t checksum;
+    uint64_t size;
+    uint8_t digest[MTP_SHA256_SIZE];
+} mtp_object_hash_t;
+
 typedef struct mtp_storage_props {
     uint16_t type;
     uint16_t fs_type;
@@ -38,11 +105,41 @@ typedef struct mtp_storage_api {
     const mtp_storage_properties_t* (*get_properties)(void *arg);
     uint32_t (*find_first)(void *arg, uint32_t parent, uint32_t *count);
     uint32_t (*find_next)(void *arg);
+    /* Optional. Continues listing started by find_first, storing up to max
+     * handles in out. Returns number of stored handles, less than max only
+     * when there are no more. */
+    uint32_t (*find_batch)(void *arg, uint32_t *out, uint32_t max);
     uint64_t (*get_free_space)(void *arg);
     int (*stat)(void *arg, uint32_t handle, mtp_object_info_t *info);
+    /* Optional. Finds objects matching query, returns number of them. Their
+     * handles are taken with search_batch, until the next search. */
+    uint32_t (*search)(void *arg, const mtp_search_query_t *query);
+    /* Optional, along with search. Stores up to max next matching handles in
+     * out, returns number of stored ones. */
+    uint32_t (*search_batch)(void *arg, uint32_t *out, uint32_t max);
+    /* Optional. Reads audio tags or image dimensions of object. */
+    int (*get_media_info)(void *arg, uint32_t handle, mtp_media_info_t *media);
     int (*rename)(void *arg, uint32_t handle, const char *new_name);
+    /* Optional. Sets modification time of object. */
+    int (*set_modified)(void *arg, uint32_t handle, time_t modified);
     int (*create)(void *arg, const mtp_object_info_t *info, uint32_t *handle);
+    /* Optional. Finds object with content of given hash, its SHA-256 has to
+     * match. Returns its handle, 0 when there is none. */
+    uint32_t (*find_duplicate)(void *arg, const mtp_object_hash_t *hash);
+    /* Optional, along with find_duplicate. Creates object described by info
+     * as a device local copy of source, fails unless the copy has content of
+     * given hash. info->checksum holds content CRC32C. */
+    int (*create_copy)(void *arg, uint32_t source, const mtp_object_hash_t *hash,
+            const mtp_object_info_t *info, uint32_t *handle);
     int (*remove)(void *arg, uint32_t handle);
+    /* Optional. Keeps partially received object aside, out of listings, so
+     * its upload can be resumed by opening it in "a" mode. */
+    int (*stage)(void *arg, uint32_t handle);
+    /* Optional. Called once all data of created object arrived. Storage may
+     * keep new object hidden until then, so it's never seen half-written. */
+    int (*commit)(void *arg, uint32_t handle);
+    /* Optional. Removes given objects at once. Returns number of removed. */
+    uint32_t (*remove_batch)(void *arg, const uint32_t *handles, uint32_t count);
     int (*open)(void *arg, uint32_t handle, const char *mode);
     int (*read)(void *arg, void *buffer, size_t count);
     int (*write)(void *arg, const void *buffer, size_t count);
@@ -60,11 +157,23 @@ uint32_t serialize_storage_list(mtp_storage_t *storage, uint32_t parent, uint8_t
 uint32_t serialize_storage_info(mtp_storage_t *storage, uint8_t *data);
 uint32_t serialize_storage_ids(mtp_storage_t *storage, int count, uint8_t *data);
 uint32_t serialize_object_info(mtp_object_info_t* info, uint8_t *data);
-uint32_t serialize_object_props_supported(uint8_t *data);
+uint32_t serialize_manifest_entry(uint32_t handle, const mtp_object_info_t *info, uint8_t *data);
+/* Writes archive header of object, at most MTP_ARCHIVE_HEADER_MAX_SIZE bytes */
+uint32_t serialize_archive_header(const mtp_object_info_t *info, uint8_t *data);
+/* Object properties along with media ones matching format */
+uint32_t serialize_object_props_supported(uint16_t format_code, uint8_t *data);
 uint32_t serialize_object_prop_desc(uint16_t prop_code, uint8_t *data);
 uint32_t serialize_object_prop_value(uint16_t prop_code, mtp_object_info_t *info, uint8_t *data);
+/* Returns 0 for property which isn't a media one */
+uint32_t serialize_media_prop_value(uint16_t prop_code, const mtp_media_info_t *media, uint8_t *data);
 int deserialize_object_prop_value(uint16_t prop_code, const uint8_t *data, void *value, int value_size);
 
 int deserialize_object_info(const uint8_t *data, size_t length, mtp_object_info_t *info);
+int deserialize_search_query(const uint8_t *data, size_t length, mtp_search_query_t *query);
+int deserialize_object_hash(const uint8_t *data, size_t length, mtp_object_hash_t *hash);
+/* Returns MTP_ARCHIVE_FILE, MTP_ARCHIVE_SKIP, MTP_ARCHIVE_REJECT or
+ * MTP_ARCHIVE_END, -1 for malformed header. info->size is payload size of
+ * skipped and rejected entries too. */
+int deserialize_archive_header(const uint8_t *data, mtp_object_info_t *info);
 
 #endif /* _MTP_STORAGE_H */
@@ -0,0 +1,52 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_lz4.h"
+
+uint32_t mtp_lz4_xxh32(const void *data, size_t length, uint32_t seed)
+{
+    return (uint32_t)mock(data, length, seed);
+}
+
+size_t mtp_lz4_compress(mtp_lz4_encoder_t *encoder, const uint8_t *src, size_t length,
+        uint8_t *dst, size_t capacity)
+{
+    return (size_t)mock(encoder, src, length, dst, capacity);
+}
+
+int mtp_lz4_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity)
+{
+    return (int)mock(src, length, dst, capacity);
+}
+
+size_t mtp_lz4_frame_header(uint8_t *dst)
+{
+    return (size_t)mock(dst);
+}
+
+size_t mtp_lz4_frame_block(mtp_lz4_encoder_t *encoder, const uint8_t *src, size_t length,
+        uint8_t *dst, bool compress)
+{
+    return (size_t)mock(encoder, src, length, dst, compress);
+}
+
+size_t mtp_lz4_frame_end(uint8_t *dst, size_t stream_length)
+{
+    return (size_t)mock(dst, stream_length);
+}
+
+void mtp_lz4_decoder_init(mtp_lz4_decoder_t *decoder)
+{
+    mock(decoder);
+}
+
+int mtp_lz4_decoder_feed(mtp_lz4_decoder_t *decoder, const void *data, size_t length,
+        mtp_lz4_sink_t sink, void *arg)
+{
+    return (int)mock(decoder, data, length, sink, arg);
+}
+
+bool mtp_lz4_decoder_done(const mtp_lz4_decoder_t *decoder)
+{
+    return (bool)mock(decoder);
+}
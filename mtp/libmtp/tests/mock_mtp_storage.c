@@ -18,14 +18,24 @@ uint32_t serialize_storage_ids(mtp_storage_t *storage, int count,  uint8_t *data
     return (uint32_t)mock(storage, data);
 }
 
+uint32_t serialize_manifest_entry(uint32_t handle, const mtp_object_info_t *info, uint8_t *data)
+{
+    return (uint32_t)mock(handle, info, data);
+}
+
+uint32_t serialize_archive_header(const mtp_object_info_t *info, uint8_t *data)
+{
+    return (uint32_t)mock(info, data);
+}
+
 uint32_t serialize_object_info(mtp_object_info_t *info, uint8_t *data)
 {
     return (uint32_t)mock(info, data);
 }
 
-uint32_t serialize_object_props_supported(uint8_t *data)
+uint32_t serialize_object_props_supported(uint16_t format_code, uint8_t *data)
 {
-    return (uint32_t)mock(data);
+    return (uint32_t)mock(format_code, data);
 }
 
 uint32_t serialize_object_prop_desc(uint16_t prop_code, uint8_t *data)
@@ -38,6 +48,11 @@ uint32_t serialize_object_prop_value(uint16_t prop_code, mtp_object_info_t *info
     return (uint32_t)mock(prop_code, info, data);
 }
 
+uint32_t serialize_media_prop_value(uint16_t prop_code, const mtp_media_info_t *media, uint8_t *data)
+{
+    return (uint32_t)mock(prop_code, media, data);
+}
+
 int deserialize_object_prop_value(uint16_t prop_code, const uint8_t *data, void *value)
 {
     return (int)mock(prop_code, data, value);
@@ -47,3 +62,18 @@ int deserialize_object_info(const uint8_t *data, size_t length, mtp_object_info_
 {
     return (int)mock(data, length, info);
 }
+
+int deserialize_search_query(const uint8_t *data, size_t length, mtp_search_query_t *query)
+{
+    return (int)mock(data, length, query);
+}
+
+int deserialize_object_hash(const uint8_t *data, size_t length, mtp_object_hash_t *hash)
+{
+    return (int)mock(data, length, hash);
+}
+
+int deserialize_archive_header(const uint8_t *data, mtp_object_info_t *info)
+{
+    return (int)mock(data, info);
+}
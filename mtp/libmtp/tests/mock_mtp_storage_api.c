@@ -18,6 +18,11 @@ uint32_t mock_find_next(void *arg)
     return (uint32_t)mock(arg);
 }
 
+uint32_t mock_find_batch(void *arg, uint32_t *out, uint32_t max)
+{
+    return (uint32_t)mock(arg, out, max);
+}
+
 uint64_t mock_free_space(void *arg)
 {
     return (uint64_t)mock(arg);
@@ -28,16 +33,67 @@ int mock_stat(void *arg, uint32_t handle, mtp_object_info_t *info)
     return (int)mock(arg, handle, info);
 }
 
+uint32_t mock_search(void *arg, const mtp_search_query_t *query)
+{
+    return (uint32_t)mock(arg, query);
+}
+
+uint32_t mock_search_batch(void *arg, uint32_t *out, uint32_t max)
+{
+    return (uint32_t)mock(arg, out, max);
+}
+
+int mock_get_media_info(void *arg, uint32_t handle, mtp_media_info_t *media)
+{
+    return (int)mock(arg, handle, media);
+}
+
+int mock_rename(void *arg, uint32_t handle, const char *new_name)
+{
+    return (int)mock(arg, handle, new_name);
+}
+
+int mock_set_modified(void *arg, uint32_t handle, time_t modified)
+{
+    return (int)mock(arg, handle, modified);
+}
+
 int mock_create(void *arg, const mtp_object_info_t *info, uint32_t *handle)
 {
     return (int)mock(arg, info, handle);
 }
 
+uint32_t mock_find_duplicate(void *arg, const mtp_object_hash_t *hash)
+{
+    return (uint32_t)mock(arg, hash);
+}
+
+int mock_create_copy(void *arg, uint32_t source, const mtp_object_hash_t *hash,
+        const mtp_object_info_t *info, uint32_t *handle)
+{
+    return (int)mock(arg, source, hash, info, handle);
+}
+
 int mock_remove(void *arg, uint32_t handle)
 {
     return (int)mock(arg, handle);
 }
 
+uint32_t mock_remove_batch(void *arg, const uint32_t *handles, uint32_t count)
+{
+    return (uint32_t)mock(arg, handles, count);
+}
+
+int mock_stage(void *arg, uint32_t handle)
+{
+    return (int)mock(arg, handle);
+}
+
+int mock_commit(void *arg, uint32_t handle)
+{
+    return (int)mock(arg, handle);
+}
+
 int mock_open(void *arg, uint32_t handle, const char *mode)
 {
     return (int)mock(arg, handle, mode);
@@ -73,3 +129,43 @@ const struct mtp_storage_api mock_api =
     .close = mock_close,
 };
 
+const struct mtp_storage_api mock_batch_api =
+{
+    .get_properties = mock_get_properties,
+    .find_first = mock_find_first,
+    .find_next = mock_find_next,
+    .find_batch = mock_find_batch,
+    .get_free_space = mock_free_space,
+    .stat = mock_stat,
+    .search = mock_search,
+    .search_batch = mock_search_batch,
+    .get_media_info = mock_get_media_info,
+    .create = mock_create,
+    .find_duplicate = mock_find_duplicate,
+    .create_copy = mock_create_copy,
+    .remove = mock_remove,
+    .remove_batch = mock_remove_batch,
+    .open = mock_open,
+    .read = mock_read,
+    .write = mock_write,
+    .close = mock_close,
+};
+
+const struct mtp_storage_api mock_staging_api =
+{
+    .get_properties = mock_get_properties,
+    .find_first = mock_find_first,
+    .find_next = mock_find_next,
+    .get_free_space = mock_free_space,
+    .stat = mock_stat,
+    .rename = mock_rename,
+    .set_modified = mock_set_modified,
+    .create = mock_create,
+    .remove = mock_remove,
+    .stage = mock_stage,
+    .commit = mock_commit,
+    .open = mock_open,
+    .read = mock_read,
+    .write = mock_write,
+    .close = mock_close,
+};
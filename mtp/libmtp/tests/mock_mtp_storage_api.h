@@ -2,14 +2,28 @@
 #define _MOCK_MTP_STORAGE_API_H
 
 extern const struct mtp_storage_api mock_api;
+extern const struct mtp_storage_api mock_batch_api;
+extern const struct mtp_storage_api mock_staging_api;
 
 const mtp_storage_properties_t* mock_get_properties(void* arg);
 uint32_t mock_find_first(void *arg, uint32_t parent);
 uint32_t mock_find_next(void *arg);
+uint32_t mock_find_batch(void *arg, uint32_t *out, uint32_t max);
 uint64_t mock_free_space(void *arg);
 int mock_stat(void *arg, uint32_t handle, mtp_object_info_t *info);
+uint32_t mock_search(void *arg, const mtp_search_query_t *query);
+uint32_t mock_search_batch(void *arg, uint32_t *out, uint32_t max);
+int mock_get_media_info(void *arg, uint32_t handle, mtp_media_info_t *media);
+int mock_rename(void *arg, uint32_t handle, const char *new_name);
+int mock_set_modified(void *arg, uint32_t handle, time_t modified);
 int mock_create(void *arg, const mtp_object_info_t *info, uint32_t *handle);
+uint32_t mock_find_duplicate(void *arg, const mtp_object_hash_t *hash);
+int mock_create_copy(void *arg, uint32_t source, const mtp_object_hash_t *hash,
+        const mtp_object_info_t *info, uint32_t *handle);
 int mock_remove(void *arg, uint32_t handle);
+uint32_t mock_remove_batch(void *arg, const uint32_t *handles, uint32_t count);
+int mock_stage(void *arg, uint32_t handle);
+int mock_commit(void *arg, uint32_t handle);
 int mock_open(void *arg, uint32_t handle);
 int mock_read(void *arg, uint32_t handle, void *buffer, size_t count);
 int mock_write(void *arg, uint32_t handle, void *buffer, size_t count);
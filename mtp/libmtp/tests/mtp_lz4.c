@@ -0,0 +1,216 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_lz4.h"
+
+static mtp_lz4_encoder_t encoder;
+static mtp_lz4_decoder_t decoder;
+static uint8_t source[2 * MTP_LZ4_DECODER_BLOCK_SIZE];
+static uint8_t frame[2 * (4 + MTP_LZ4_DECODER_BLOCK_SIZE) + MTP_LZ4_FRAME_HEADER_SIZE + MTP_LZ4_FRAME_END_MAX_SIZE];
+static uint8_t given[2 * MTP_LZ4_DECODER_BLOCK_SIZE];
+static size_t given_length;
+
+static int collect(void *arg, const void *data, size_t length)
+{
+    (void)arg;
+    memcpy(&given[given_length], data, length);
+    given_length += length;
+    return 0;
+}
+
+static void fill_text(uint8_t *data, size_t length)
+{
+    static const char line[] = "BEGIN:VCARD\nVERSION:2.1\nN:Doe;John\nEND:VCARD\n";
+    size_t i;
+    for (i = 0; i < length; i++)
+    {
+        data[i] = line[i % (sizeof(line) - 1)] + (i / 997) % 3;
+    }
+}
+
+static void fill_noise(uint8_t *data, size_t length)
+{
+    uint32_t state = 0x12345678;
+    size_t i;
+    for (i = 0; i < length; i++)
+    {
+        state = state * 1103515245 + 12345;
+        data[i] = (uint8_t)(state >> 16);
+    }
+}
+
+Describe(mtp_lz4);
+
+BeforeEach(mtp_lz4)
+{
+    memset(given, 0, sizeof(given));
+    given_length = 0;
+    mtp_lz4_decoder_init(&decoder);
+}
+
+AfterEach(mtp_lz4)
+{
+}
+
+Ensure(mtp_lz4, xxh32_matches_reference)
+{
+    assert_that(mtp_lz4_xxh32("", 0, 0), is_equal_to(0x02CC5D05));
+    assert_that(mtp_lz4_xxh32("abc", 3, 0), is_equal_to(0x32D153FF));
+}
+
+Ensure(mtp_lz4, frame_header_for_independent_blocks)
+{
+    const uint8_t expected[] = { 0x04, 0x22, 0x4d, 0x18, 0x60, 0x40, 0x82 };
+
+    given_length = mtp_lz4_frame_header(given);
+    assert_that(given_length, is_equal_to(sizeof(expected)));
+    assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(mtp_lz4, decompress_overlapping_match)
+{
+    const uint8_t block[] = { 0x35, 'a', 'b', 'c', 0x03, 0x00, 0x50, 'a', 'b', 'c', 'a', 'b' };
+    const char expected[] = "abcabcabcabcabcab";
+
+    int length = mtp_lz4_decompress(block, sizeof(block), given, sizeof(given));
+    assert_that(length, is_equal_to(17));
+    assert_that(given, is_equal_to_contents_of(expected, 17));
+}
+
+Ensure(mtp_lz4, decompress_rejects_offset_before_start)
+{
+    const uint8_t block[] = { 0x15, 'a', 0x03, 0x00, 0x50, 'a', 'b', 'c', 'a', 'b' };
+
+    assert_that(mtp_lz4_decompress(block, sizeof(block), given, sizeof(given)), is_equal_to(-1));
+}
+
+Ensure(mtp_lz4, compressed_block_round_trips)
+{
+    uint8_t packed[MTP_LZ4_BLOCK_SIZE];
+    size_t length;
+
+    fill_text(source, MTP_LZ4_BLOCK_SIZE);
+    length = mtp_lz4_compress(&encoder, source, MTP_LZ4_BLOCK_SIZE, packed, sizeof(packed));
+    assert_that(length, is_greater_than(0));
+    assert_that(length, is_less_than(MTP_LZ4_BLOCK_SIZE / 4));
+
+    assert_that(mtp_lz4_decompress(packed, length, given, sizeof(given)), is_equal_to(MTP_LZ4_BLOCK_SIZE));
+    assert_that(given, is_equal_to_contents_of(source, MTP_LZ4_BLOCK_SIZE));
+}
+
+Ensure(mtp_lz4, incompressible_block_stored_as_is)
+{
+    fill_noise(source, 100);
+
+    given_length = mtp_lz4_frame_block(&encoder, source, 100, given, true);
+    assert_that(given_length, is_equal_to(104));
+    assert_that(*(uint32_t *)given, is_equal_to(0x80000064));
+    assert_that(&given[4], is_equal_to_contents_of(source, 100));
+}
+
+Ensure(mtp_lz4, frame_end_pads_packet_boundary)
+{
+    const uint8_t padded[] = { 0x00, 0x00, 0x00, 0x00,
+                               0x50, 0x2a, 0x4d, 0x18, 0x00, 0x00, 0x00, 0x00 };
+
+    assert_that(mtp_lz4_frame_end(given, 61), is_equal_to(4));
+    assert_that(mtp_lz4_frame_end(given, 60), is_equal_to(sizeof(padded)));
+    assert_that(given, is_equal_to_contents_of(padded, sizeof(padded)));
+}
+
+Ensure(mtp_lz4, decoder_reassembles_frame_fed_bytewise)
+{
+    size_t length = 0;
+    size_t i;
+
+    fill_text(source, MTP_LZ4_BLOCK_SIZE);
+    fill_noise(&source[MTP_LZ4_BLOCK_SIZE], MTP_LZ4_BLOCK_SIZE);
+    length += mtp_lz4_frame_header(frame);
+    length += mtp_lz4_frame_block(&encoder, source, MTP_LZ4_BLOCK_SIZE, &frame[length], true);
+    length += mtp_lz4_frame_block(&encoder, &source[MTP_LZ4_BLOCK_SIZE], MTP_LZ4_BLOCK_SIZE, &frame[length], true);
+    length += mtp_lz4_frame_end(&frame[length], length);
+
+    for (i = 0; i < length; i++)
+    {
+        assert_that(mtp_lz4_decoder_feed(&decoder, &frame[i], 1, collect, NULL), is_equal_to(0));
+    }
+    assert_that(mtp_lz4_decoder_done(&decoder), is_true);
+    assert_that(given_length, is_equal_to(2 * MTP_LZ4_BLOCK_SIZE));
+    assert_that(given, is_equal_to_contents_of(source, 2 * MTP_LZ4_BLOCK_SIZE));
+}
+
+/* Blocks as LZ4F encoders write them with default 64 KiB maximum, fed in
+ * pieces of a bulk packet */
+Ensure(mtp_lz4, decoder_takes_blocks_up_to_64k)
+{
+    const size_t compressed = 40000;
+    size_t length = 0;
+    size_t packed;
+    size_t i;
+
+    fill_text(source, compressed);
+    fill_noise(&source[compressed], MTP_LZ4_DECODER_BLOCK_SIZE);
+    length += mtp_lz4_frame_header(frame);
+    packed = mtp_lz4_compress(&encoder, source, compressed, &frame[length + 4], compressed);
+    assert_that(packed, is_greater_than(0));
+    frame[length++] = (uint8_t)packed;
+    frame[length++] = (uint8_t)(packed >> 8);
+    frame[length++] = 0;
+    frame[length++] = 0;
+    length += packed;
+    length += mtp_lz4_frame_block(&encoder, &source[compressed], MTP_LZ4_DECODER_BLOCK_SIZE, &frame[length], false);
+    length += mtp_lz4_frame_end(&frame[length], length);
+
+    for (i = 0; i < length; i += 512)
+    {
+        const size_t piece = (length - i < 512) ? length - i : 512;
+        assert_that(mtp_lz4_decoder_feed(&decoder, &frame[i], piece, collect, NULL), is_equal_to(0));
+    }
+    assert_that(mtp_lz4_decoder_done(&decoder), is_true);
+    assert_that(given_length, is_equal_to(compressed + MTP_LZ4_DECODER_BLOCK_SIZE));
+    assert_that(given, is_equal_to_contents_of(source, compressed + MTP_LZ4_DECODER_BLOCK_SIZE));
+}
+
+Ensure(mtp_lz4, decoder_refuses_block_maximum_over_64k)
+{
+    uint8_t header[] = { 0x04, 0x22, 0x4d, 0x18, 0x60, 0x50, 0x00 };
+    header[6] = (uint8_t)(mtp_lz4_xxh32(&header[4], 2, 0) >> 8);
+
+    assert_that(mtp_lz4_decoder_feed(&decoder, header, sizeof(header), collect, NULL), is_equal_to(-1));
+    assert_that(mtp_lz4_decoder_done(&decoder), is_false);
+}
+
+Ensure(mtp_lz4, decoder_rejects_block_ending_inside_sequence)
+{
+    const uint8_t block[] = { 0x35, 'a', 'b', 'c', 0x03 };
+    uint8_t data[MTP_LZ4_FRAME_HEADER_SIZE + 4 + sizeof(block)];
+    size_t length = mtp_lz4_frame_header(data);
+    data[length++] = sizeof(block);
+    data[length++] = 0x00;
+    data[length++] = 0x00;
+    data[length++] = 0x00;
+    memcpy(&data[length], block, sizeof(block));
+    length += sizeof(block);
+
+    assert_that(mtp_lz4_decoder_feed(&decoder, data, length, collect, NULL), is_equal_to(-1));
+}
+
+Ensure(mtp_lz4, decoder_rejects_linked_blocks)
+{
+    const uint8_t header[] = { 0x04, 0x22, 0x4d, 0x18, 0x40, 0x40, 0xc0 };
+
+    assert_that(mtp_lz4_decoder_feed(&decoder, header, sizeof(header), collect, NULL), is_equal_to(-1));
+    assert_that(mtp_lz4_decoder_done(&decoder), is_false);
+}
+
+Ensure(mtp_lz4, decoder_rejects_oversized_block)
+{
+    uint8_t data[MTP_LZ4_FRAME_HEADER_SIZE + 4];
+    size_t length = mtp_lz4_frame_header(data);
+    data[length++] = 0x01;
+    data[length++] = 0x00;
+    data[length++] = 0x01;
+    data[length++] = 0x80;
+
+    assert_that(mtp_lz4_decoder_feed(&decoder, data, length, collect, NULL), is_equal_to(-1));
+}
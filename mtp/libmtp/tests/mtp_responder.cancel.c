@@ -0,0 +1,213 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static size_t given_data_size;
+
+static const uint8_t get_object_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x09, 0x10,
+    0x06, 0x00, 0x00, 0x30, 0x01, 0x00, 0x00, 0x01,
+};
+
+static const uint8_t send_object_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0d, 0x10,
+    0xe3, 0x03, 0x00, 0x00,
+};
+
+static const uint8_t send_object_data[] = {
+    0x30, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0d, 0x10,
+    0xe3, 0x03, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+
+static const uint8_t object_info_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t object_info_data[] = {
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static mtp_object_info_t dummy_file = {
+    .filename = "welcome.txt",
+    .created = 1580371617,
+    .modified = 1580371617,
+    .format_code = MTP_FORMAT_TEXT,
+    .parent = 0,
+    .size = 4096,
+};
+
+/* Starts upload of 4096 bytes object, only first chunk arrives */
+static void send_first_chunk(void)
+{
+    const uint32_t handle = 0x0000000f;
+    uint8_t data[sizeof(send_object_data)];
+
+    memcpy(data, send_object_data, sizeof(data));
+    data[0] = 0x0c;
+    data[1] = 0x10;
+
+    expect(deserialize_object_info,
+            will_set_contents_of_parameter(info, &dummy_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(is_format_code_supported, will_return(true));
+    expect(mock_create,
+            will_set_contents_of_parameter(handle, &handle, sizeof(handle)),
+            will_return(0));
+    expect(mock_open, will_return(0));
+    expect(mock_write, will_return(0));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    mtp_responder_handle_request(mtp, send_object_request, sizeof(send_object_request));
+    mtp_responder_handle_request(mtp, data, sizeof(data));
+}
+
+Describe(cancel);
+
+BeforeEach(cancel)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    given_data_size = 0xaabbccdd;
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(cancel)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(cancel, does_nothing_if_no_transaction_in_progress)
+{
+    error = mtp_responder_cancel_transaction(mtp, 0x30000006);
+    assert_that(error, is_equal_to(MTP_RESPONSE_TRANSACTION_CANCELLED));
+}
+
+Ensure(cancel, closes_file_and_stops_get_object)
+{
+    expect(mock_stat,
+            will_set_contents_of_parameter(info, &dummy_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_open,
+            will_return(0));
+    expect(mock_read,
+            will_return(500));
+    expect(mock_close);
+
+    error = mtp_responder_handle_request(mtp, get_object_request, sizeof(get_object_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(512));
+
+    error = mtp_responder_cancel_transaction(mtp, 0x30000006);
+    assert_that(error, is_equal_to(MTP_RESPONSE_TRANSACTION_CANCELLED));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(0));
+}
+
+Ensure(cancel, removes_partially_received_object)
+{
+    expect(mock_open,
+            will_return(0));
+    expect(mock_close);
+    expect(mock_remove);
+
+    error = mtp_responder_handle_request(mtp, send_object_request, sizeof(send_object_request));
+    assert_that(error, is_equal_to(0));
+
+    error = mtp_responder_cancel_transaction(mtp, 0x000003e3);
+    assert_that(error, is_equal_to(MTP_RESPONSE_TRANSACTION_CANCELLED));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(false));
+}
+
+Ensure(cancel, reset_keeps_completely_received_object)
+{
+    expect(mock_open,
+            will_return(0));
+    expect(mock_write,
+            will_return(0));
+    expect(mock_close);
+
+    mtp_responder_handle_request(mtp, send_object_request, sizeof(send_object_request));
+    error = mtp_responder_handle_request(mtp, send_object_data, sizeof(send_object_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_transaction_reset(mtp);
+}
+
+Ensure(cancel, mid_transfer_leaves_object_uncommitted)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_staging_api, NULL);
+    send_first_chunk();
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(true));
+
+    expect(mock_close);
+    expect(mock_stage,
+            when(handle, is_equal_to(0x0000000f)),
+            will_return(0));
+    never_expect(mock_commit);
+    never_expect(mock_remove);
+
+    error = mtp_responder_cancel_transaction(mtp, 0x000003e3);
+    assert_that(error, is_equal_to(MTP_RESPONSE_TRANSACTION_CANCELLED));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(false));
+}
+
+Ensure(cancel, mid_transfer_removes_uncommitted_object_if_not_staged)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_staging_api, NULL);
+    mtp_responder_set_staging_timeout(mtp, 0);
+    send_first_chunk();
+
+    expect(mock_close);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+    never_expect(mock_commit);
+
+    mtp_responder_cancel_transaction(mtp, 0x000003e3);
+}
+
+Ensure(cancel, last_chunk_commits_object)
+{
+    uint8_t chunk[512];
+    size_t left = 4096 - 36;
+
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_staging_api, NULL);
+    send_first_chunk();
+
+    expect(mock_close);
+    expect(mock_commit,
+            when(handle, is_equal_to(0x0000000f)),
+            will_return(0));
+
+    while (left > sizeof(chunk))
+    {
+        expect(mock_write, will_return(0));
+        error = mtp_responder_set_data(mtp, chunk, sizeof(chunk));
+        assert_that(error, is_equal_to(0));
+        left -= sizeof(chunk);
+    }
+    expect(mock_write, will_return(0));
+    error = mtp_responder_set_data(mtp, chunk, left);
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
@@ -0,0 +1,210 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+#include "mtp_lz4.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static size_t given_data_size;
+static const mtp_data_cntr_t *given = (mtp_data_cntr_t*)given_data;
+
+static const uint8_t get_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x97,
+    0x06, 0x00, 0x00, 0x30, 0x01, 0x00, 0x00, 0x01,
+};
+
+static const uint8_t object_info_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t object_info_data[] = {
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t send_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x03, 0x97,
+    0xe3, 0x03, 0x00, 0x00,
+};
+
+static const uint8_t send_data[] = {
+    0x30, 0x00, 0x00, 0x00, 0x02, 0x00, 0x03, 0x97,
+    0xe3, 0x03, 0x00, 0x00, 0x04, 0x22, 0x4d, 0x18,
+    0x60, 0x40, 0x82, 0x1c, 0x00, 0x00, 0x00, 0xf0,
+    0x0d, 0x41, 0x01, 0x00, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x00, 0x00, 0x00, 0x00,
+};
+
+static mtp_object_info_t text_file = {
+    .filename = "contacts.vcf",
+    .format_code = MTP_FORMAT_TEXT,
+    .size = 100,
+};
+
+static mtp_object_info_t photo_file = {
+    .filename = "photo.jpg",
+    .format_code = MTP_FORMAT_EXIF_JPEG,
+    .size = 100,
+};
+
+static void expect_object_info(void)
+{
+    const uint32_t handle = 0x0000000f;
+
+    expect(deserialize_object_info, will_return(0));
+    expect(is_format_code_supported, will_return(true));
+    expect(mock_create,
+            will_set_contents_of_parameter(handle, &handle, sizeof(handle)),
+            will_return(0));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+}
+
+Describe(compressed);
+
+BeforeEach(compressed)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    given_data_size = 0xaabbccdd;
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(compressed)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(compressed, small_object_has_known_length)
+{
+    expect(mock_stat,
+            will_set_contents_of_parameter(info, &text_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_open, will_return(0));
+    expect(mtp_lz4_frame_header, will_return(MTP_LZ4_FRAME_HEADER_SIZE));
+    expect(mock_read, will_return(100));
+    expect(mtp_lz4_frame_block,
+            when(length, is_equal_to(100)),
+            when(compress, is_equal_to(true)),
+            will_return(60));
+    expect(mock_read, will_return(0));
+    expect(mtp_lz4_frame_end,
+            when(stream_length, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 67)),
+            will_return(4));
+    expect(mock_close);
+
+    error = mtp_responder_handle_request(mtp, get_request, sizeof(get_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 71));
+    assert_that(given->header.length, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 71));
+    assert_that(mtp_responder_get_data(mtp), is_equal_to(0));
+}
+
+Ensure(compressed, already_compressed_format_is_stored)
+{
+    expect(mock_stat,
+            will_set_contents_of_parameter(info, &photo_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_open, will_return(0));
+    expect(mtp_lz4_frame_header, will_return(MTP_LZ4_FRAME_HEADER_SIZE));
+    expect(mock_read, will_return(100));
+    expect(mtp_lz4_frame_block,
+            when(compress, is_equal_to(false)),
+            will_return(104));
+    expect(mock_read, will_return(0));
+    expect(mtp_lz4_frame_end, will_return(4));
+    expect(mock_close);
+
+    error = mtp_responder_handle_request(mtp, get_request, sizeof(get_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(compressed, large_object_streams_with_unknown_length)
+{
+    size_t total = 0;
+
+    expect(mock_stat,
+            will_set_contents_of_parameter(info, &text_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_open, will_return(0));
+    expect(mtp_lz4_frame_header, will_return(MTP_LZ4_FRAME_HEADER_SIZE));
+    expect(mock_read, will_return(MTP_LZ4_BLOCK_SIZE));
+    expect(mtp_lz4_frame_block, will_return(MTP_LZ4_BLOCK_MAX_SIZE));
+    expect(mock_read, will_return(0));
+    expect(mtp_lz4_frame_end,
+            when(stream_length, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 7 + MTP_LZ4_BLOCK_MAX_SIZE)),
+            will_return(4));
+    expect(mock_close);
+
+    error = mtp_responder_handle_request(mtp, get_request, sizeof(get_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(sizeof(given_data)));
+    assert_that(given->header.length, is_equal_to(0xFFFFFFFF));
+
+    while (given_data_size == sizeof(given_data))
+    {
+        total += given_data_size;
+        given_data_size = mtp_responder_get_data(mtp);
+    }
+    total += given_data_size;
+
+    assert_that(total, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 7 + MTP_LZ4_BLOCK_MAX_SIZE + 4));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(false));
+}
+
+Ensure(compressed, send_requires_object_info)
+{
+    error = mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_NO_VALID_OBJECT_INFO));
+}
+
+Ensure(compressed, send_decodes_frame_into_object)
+{
+    expect_object_info();
+    expect(mock_open, will_return(0));
+    expect(mtp_lz4_decoder_init);
+    expect(mtp_lz4_decoder_feed,
+            when(length, is_equal_to(36)),
+            will_return(0));
+    expect(mtp_lz4_decoder_done, will_return(true));
+    expect(mock_close);
+
+    error = mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    assert_that(error, is_equal_to(0));
+    error = mtp_responder_handle_request(mtp, send_data, sizeof(send_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(compressed, malformed_frame_removes_object)
+{
+    expect_object_info();
+    expect(mock_open, will_return(0));
+    expect(mtp_lz4_decoder_init);
+    expect(mtp_lz4_decoder_feed, will_return(-1));
+    expect(mock_close);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+
+    mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    error = mtp_responder_handle_request(mtp, send_data, sizeof(send_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_DATASET));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(false));
+}
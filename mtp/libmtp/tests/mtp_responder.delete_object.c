@@ -0,0 +1,142 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+
+static const uint8_t delete_single_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0b, 0x10,
+    0x01, 0x00, 0x00, 0x30, 0x05, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t delete_all_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0b, 0x10,
+    0x01, 0x00, 0x00, 0x30, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t delete_all_text_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0b, 0x10,
+    0x01, 0x00, 0x00, 0x30, 0xff, 0xff, 0xff, 0xff,
+    0x04, 0x30, 0x00, 0x00,
+};
+
+static const uint32_t COUNT = 3;
+
+static void expect_listing(void)
+{
+    expect(mock_find_first,
+            when(parent, is_equal_to(0xFFFFFFFF)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(1));
+    expect(mock_find_next, will_return(2));
+    expect(mock_find_next, will_return(3));
+    expect(mock_find_next, will_return(0));
+}
+
+Describe(delete_object);
+
+BeforeEach(delete_object)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(delete_object)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(delete_object, removes_single_object)
+{
+    expect(mock_remove,
+            when(handle, is_equal_to(5)),
+            will_return(0));
+
+    error = mtp_responder_handle_request(mtp, delete_single_request, sizeof(delete_single_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(delete_object, removes_all_objects_in_one_transaction)
+{
+    expect_listing();
+    expect(mock_remove, when(handle, is_equal_to(1)), will_return(0));
+    expect(mock_remove, when(handle, is_equal_to(2)), will_return(0));
+    expect(mock_remove, when(handle, is_equal_to(3)), will_return(0));
+
+    error = mtp_responder_handle_request(mtp, delete_all_request, sizeof(delete_all_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(delete_object, reports_partial_deletion)
+{
+    expect_listing();
+    expect(mock_remove, when(handle, is_equal_to(1)), will_return(0));
+    expect(mock_remove, when(handle, is_equal_to(2)), will_return(-1));
+    expect(mock_remove, when(handle, is_equal_to(3)), will_return(0));
+
+    error = mtp_responder_handle_request(mtp, delete_all_request, sizeof(delete_all_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_PARTIAL_DELETION));
+}
+
+Ensure(delete_object, removes_only_objects_of_given_format)
+{
+    mtp_object_info_t text = { .format_code = MTP_FORMAT_TEXT };
+    mtp_object_info_t image = { .format_code = MTP_FORMAT_EXIF_JPEG };
+
+    expect(mock_find_first,
+            when(parent, is_equal_to(0xFFFFFFFF)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(1));
+    expect(mock_stat,
+            when(handle, is_equal_to(1)),
+            will_set_contents_of_parameter(info, &image, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_find_next, will_return(2));
+    expect(mock_find_next, will_return(3));
+    expect(mock_find_next, will_return(0));
+    expect(mock_stat,
+            when(handle, is_equal_to(2)),
+            will_set_contents_of_parameter(info, &text, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_stat,
+            when(handle, is_equal_to(3)),
+            will_set_contents_of_parameter(info, &image, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_remove, when(handle, is_equal_to(2)), will_return(0));
+
+    error = mtp_responder_handle_request(mtp, delete_all_text_request, sizeof(delete_all_text_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(delete_object, removes_all_with_single_batch_call)
+{
+    const uint32_t handles[] = { 2, 3 };
+
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_batch_api, NULL);
+    expect(mock_find_first,
+            when(parent, is_equal_to(0xFFFFFFFF)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(1));
+    expect(mock_find_batch,
+            will_set_contents_of_parameter(out, handles, sizeof(handles)),
+            will_return(2));
+    expect(mock_remove_batch,
+            when(count, is_equal_to(3)),
+            will_return(3));
+
+    error = mtp_responder_handle_request(mtp, delete_all_request, sizeof(delete_all_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
@@ -0,0 +1,145 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static const mtp_data_cntr_t *given = (mtp_data_cntr_t*)given_data;
+static uint8_t response[64];
+static const mtp_resp_cntr_t *given_response = (mtp_resp_cntr_t*)response;
+static size_t response_size;
+
+static const uint8_t request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x07, 0x97,
+    0x05, 0x00, 0x00, 0x30, 0x01, 0x00, 0x01, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint32_t COUNT = 2;
+
+static mtp_object_info_t notes_file = {
+    .filename = "notes.txt",
+    .format_code = MTP_FORMAT_TEXT,
+    .size = 100,
+};
+
+static void expect_listing(uint32_t count)
+{
+    uint32_t i;
+
+    expect(mock_find_first,
+            when(parent, is_equal_to(0xFFFFFFFF)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(1));
+    for (i = 2; i <= count; i++)
+    {
+        expect(mock_find_next, will_return(i));
+    }
+    expect(mock_find_next, will_return(0));
+}
+
+static void expect_entry(uint32_t handle)
+{
+    expect(mock_stat,
+            when(handle, is_equal_to(handle)),
+            will_set_contents_of_parameter(info, &notes_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_open,
+            when(handle, is_equal_to(handle)),
+            when(mode, is_equal_to_string("r")),
+            will_return(0));
+    expect(serialize_archive_header, will_return(MTP_ARCHIVE_BLOCK_SIZE));
+}
+
+/* Stream length of data phase, response parameter tells number of files */
+static size_t receive_archive(void)
+{
+    size_t total;
+    size_t length;
+
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+    total = mtp_responder_get_data(mtp) - MTP_CONTAINER_HEADER_SIZE;
+    assert_that(given->header.length, is_equal_to(0xFFFFFFFF));
+    while ((length = mtp_responder_get_data(mtp)) == sizeof(given_data))
+    {
+        total += length;
+    }
+    return total + length;
+}
+
+Describe(get_archive);
+
+BeforeEach(get_archive)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    memset(given_data, 0xaa, sizeof(given_data));
+    memset(response, 0xaa, sizeof(response));
+    error = 0xaa;
+}
+
+AfterEach(get_archive)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(get_archive, streams_files_across_containers)
+{
+    expect_listing(2);
+    expect_entry(1);
+    expect(mock_read,
+            when(count, is_equal_to(100)),
+            will_return(100));
+    expect(mock_close);
+    expect_entry(2);
+    expect(mock_read,
+            when(count, is_equal_to(100)),
+            will_return(100));
+    expect(mock_close);
+
+    /* Two headers with padded payloads and end of archive */
+    assert_that(receive_archive(), is_equal_to(4 * MTP_ARCHIVE_BLOCK_SIZE + 2 * MTP_ARCHIVE_BLOCK_SIZE));
+
+    mtp_responder_get_response(mtp, MTP_RESPONSE_OK, response, &response_size);
+    assert_that(response_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + sizeof(uint32_t)));
+    assert_that(given_response->parameter[0], is_equal_to(2));
+}
+
+Ensure(get_archive, objects_failing_to_open_are_left_out)
+{
+    expect_listing(2);
+    expect(mock_stat,
+            will_set_contents_of_parameter(info, &notes_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(mock_open,
+            when(handle, is_equal_to(1)),
+            will_return(-1));
+    expect_entry(2);
+    expect(mock_read, will_return(100));
+    expect(mock_close);
+
+    assert_that(receive_archive(), is_equal_to(2 * MTP_ARCHIVE_BLOCK_SIZE + 2 * MTP_ARCHIVE_BLOCK_SIZE));
+
+    mtp_responder_get_response(mtp, MTP_RESPONSE_OK, response, &response_size);
+    assert_that(given_response->parameter[0], is_equal_to(1));
+}
+
+Ensure(get_archive, shrunk_object_is_padded_with_zeros)
+{
+    expect_listing(1);
+    expect_entry(1);
+    expect(mock_read, will_return(0));
+    expect(mock_close);
+
+    assert_that(receive_archive(), is_equal_to(2 * MTP_ARCHIVE_BLOCK_SIZE + 2 * MTP_ARCHIVE_BLOCK_SIZE));
+}
@@ -118,6 +118,38 @@ Ensure(get_object_handles, returns_for_all_storages)
     test_return_list_for(request, sizeof(request));
 }
 
+Ensure(get_object_handles, fills_frame_with_single_batch_call)
+{
+    const uint8_t request[] = {
+        0x18, 0x00, 0x00, 0x00, 0x01, 0x00, 0x07, 0x10,
+        0x01, 0x00, 0x00, 0x30, 0x01, 0x00, 0x01, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    };
+    const uint32_t COUNT = 3;
+    const uint32_t handles[] = { 2, 3 };
+
+    expect(mock_find_first,
+            when(parent, is_equal_to(0xFFFFFFFF)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(1));
+    expect(mock_find_batch,
+            when(max, is_equal_to(2)),
+            will_set_contents_of_parameter(out, handles, sizeof(handles)),
+            will_return(2));
+
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_batch_api, NULL);
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 4 * sizeof(uint32_t)));
+    uint32_t* given_list = (uint32_t*)given->parameter;
+    assert_that(given_list[0], is_equal_to(3));
+    assert_that(given_list[1], is_equal_to(1));
+    assert_that(given_list[2], is_equal_to(2));
+    assert_that(given_list[3], is_equal_to(3));
+}
+
 Ensure(get_object_handles, return_error_when_unknown_storage_id)
 {
     const uint8_t request[] = {
@@ -0,0 +1,98 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static const mtp_data_cntr_t *given = (mtp_data_cntr_t*)given_data;
+
+/* Handle 0x0f, Artist */
+static const uint8_t artist_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x03, 0x98,
+    0xe2, 0x03, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00,
+    0x46, 0xdc, 0x00, 0x00,
+};
+
+static const mtp_object_info_t song = {
+    .filename = "song.mp3",
+    .format_code = MTP_FORMAT_MP3,
+};
+
+static const mtp_media_info_t song_tags = {
+    .artist = "Artist",
+    .duration = 180000,
+};
+
+static void expect_song_stat(void)
+{
+    expect(mock_stat,
+            when(handle, is_equal_to(0x0000000f)),
+            will_set_contents_of_parameter(info, &song, sizeof(song)),
+            will_return(0));
+    expect(serialize_object_prop_value, will_return(0));
+}
+
+Describe(get_obj_prop_value);
+
+BeforeEach(get_obj_prop_value)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(get_obj_prop_value)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(get_obj_prop_value, media_property_is_read_from_storage)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_batch_api, NULL);
+    expect_song_stat();
+    expect(mock_get_media_info,
+            when(handle, is_equal_to(0x0000000f)),
+            will_set_contents_of_parameter(media, &song_tags, sizeof(song_tags)),
+            will_return(0));
+    expect(serialize_media_prop_value,
+            when(prop_code, is_equal_to(MTP_PROPERTY_ARTIST)),
+            will_return(15));
+
+    error = mtp_responder_handle_request(mtp, artist_request, sizeof(artist_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+    assert_that(mtp_responder_get_data(mtp), is_equal_to(MTP_CONTAINER_HEADER_SIZE + 15));
+    assert_that(given->header.operation_code, is_equal_to(MTP_OPERATION_GET_OBJECT_PROP_VALUE));
+}
+
+Ensure(get_obj_prop_value, media_property_is_empty_without_storage_support)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    expect_song_stat();
+    never_expect(mock_get_media_info);
+    expect(serialize_media_prop_value,
+            when(prop_code, is_equal_to(MTP_PROPERTY_ARTIST)),
+            will_return(1));
+
+    error = mtp_responder_handle_request(mtp, artist_request, sizeof(artist_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(get_obj_prop_value, fails_for_unknown_property)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_batch_api, NULL);
+    expect_song_stat();
+    expect(mock_get_media_info, will_return(-1));
+    expect(serialize_media_prop_value, will_return(0));
+
+    error = mtp_responder_handle_request(mtp, artist_request, sizeof(artist_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_OBJECT_PROP_CODE));
+}
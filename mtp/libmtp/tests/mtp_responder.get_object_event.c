@@ -0,0 +1,57 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint8_t given_data[512];
+static uint8_t event[64];
+static size_t event_size;
+
+static const uint8_t open_session_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x10,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t object_added_event[] = {
+    0x10, 0x00, 0x00, 0x00, 0x04, 0x00, 0x02, 0x40,
+    0x00, 0x00, 0x00, 0x00, 0x2a, 0x00, 0x00, 0x00,
+};
+
+Describe(get_object_event);
+
+BeforeEach(get_object_event)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    memset(event, 0xaa, sizeof(event));
+    event_size = 0xaa;
+}
+
+AfterEach(get_object_event)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(get_object_event, is_none_without_session)
+{
+    mtp_responder_get_object_event(mtp, MTP_EVENT_OBJECT_ADDED, 0x2a, event, &event_size);
+    assert_that(event_size, is_equal_to(0));
+}
+
+Ensure(get_object_event, carries_object_handle)
+{
+    expect(mtp_container_get_param_count, will_return(1));
+    mtp_responder_handle_request(mtp, open_session_request, sizeof(open_session_request));
+
+    mtp_responder_get_object_event(mtp, MTP_EVENT_OBJECT_ADDED, 0x2a, event, &event_size);
+    assert_that(event_size, is_equal_to(sizeof(object_added_event)));
+    assert_that(event, is_equal_to_contents_of(object_added_event, sizeof(object_added_event)));
+}
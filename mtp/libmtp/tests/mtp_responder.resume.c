@@ -0,0 +1,324 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static uint8_t chunk[512];
+static uint8_t response[64];
+static const mtp_resp_cntr_t *given_response = (mtp_resp_cntr_t*)response;
+static size_t response_size;
+
+static const uint8_t object_info_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t object_info_data[] = {
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t send_object_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0d, 0x10,
+    0xe3, 0x03, 0x00, 0x00,
+};
+
+/* First 36 of 1000 bytes */
+static const uint8_t send_object_data[] = {
+    0xf4, 0x03, 0x00, 0x00, 0x02, 0x00, 0x0d, 0x10,
+    0xe3, 0x03, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+
+static const uint8_t open_session_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x10,
+    0xe0, 0x03, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t close_session_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x03, 0x10,
+    0xe6, 0x03, 0x00, 0x00,
+};
+
+static const uint8_t get_partial_upload_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x05, 0x97,
+    0xe4, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* Handle 0x0f, offset 548, 452 bytes */
+static const uint8_t send_partial_request[] = {
+    0x1c, 0x00, 0x00, 0x00, 0x01, 0x00, 0xc2, 0x95,
+    0xe5, 0x03, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00,
+    0x24, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xc4, 0x01, 0x00, 0x00,
+};
+
+static const uint8_t send_partial_data[] = {
+    0xd0, 0x01, 0x00, 0x00, 0x02, 0x00, 0xc2, 0x95,
+    0xe5, 0x03, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41,
+};
+
+static mtp_object_info_t video_file = {
+    .filename = "video.mp4",
+    .format_code = MTP_FORMAT_UNDEFINED,
+    .size = 1000,
+};
+
+static void open_session(void)
+{
+    expect(mtp_container_get_param_count, will_return(1));
+    open_session();
+}
+
+static void announce_object(const mtp_object_info_t *info, const uint32_t *handle)
+{
+    expect(deserialize_object_info,
+            will_set_contents_of_parameter(info, info, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(is_format_code_supported, will_return(true));
+    expect(mock_create,
+            will_set_contents_of_parameter(handle, handle, sizeof(uint32_t)),
+            will_return(0));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+}
+
+/* Object of 1000 bytes gets 548 of them before transfer stops */
+static void send_part_of_object(void)
+{
+    const uint32_t handle = 0x0000000f;
+
+    announce_object(&video_file, &handle);
+    expect(mock_open,
+            when(mode, is_equal_to_string("w+")),
+            will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_close);
+
+    mtp_responder_handle_request(mtp, send_object_request, sizeof(send_object_request));
+    mtp_responder_handle_request(mtp, send_object_data, sizeof(send_object_data));
+    mtp_responder_set_data(mtp, chunk, sizeof(chunk));
+}
+
+static void stage_interrupted_upload(void)
+{
+    send_part_of_object();
+    expect(mock_stage,
+            when(handle, is_equal_to(0x0000000f)),
+            will_return(0));
+    mtp_responder_transaction_reset(mtp);
+}
+
+Describe(resume);
+
+BeforeEach(resume)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_staging_api, NULL);
+    memset(given_data, 0xaa, sizeof(given_data));
+    memset(response, 0xaa, sizeof(response));
+    error = 0xaa;
+}
+
+AfterEach(resume)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(resume, interrupted_upload_is_staged)
+{
+    never_expect(mock_remove);
+    stage_interrupted_upload();
+
+    error = mtp_responder_handle_request(mtp, get_partial_upload_request, sizeof(get_partial_upload_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(response_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 3 * sizeof(uint32_t)));
+    assert_that(given_response->parameter[0], is_equal_to(0x0000000f));
+    assert_that(given_response->parameter[1], is_equal_to(548));
+    assert_that(given_response->parameter[2], is_equal_to(1000));
+}
+
+Ensure(resume, upload_is_removed_when_staging_disabled)
+{
+    mtp_responder_set_staging_timeout(mtp, 0);
+    send_part_of_object();
+    never_expect(mock_stage);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+
+    mtp_responder_transaction_reset(mtp);
+
+    error = mtp_responder_handle_request(mtp, get_partial_upload_request, sizeof(get_partial_upload_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_OBJECT_HANDLE));
+}
+
+Ensure(resume, partial_object_appends_and_commits)
+{
+    stage_interrupted_upload();
+    expect(mock_open,
+            when(handle, is_equal_to(0x0000000f)),
+            when(mode, is_equal_to_string("a")),
+            will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_close);
+    expect(mock_commit,
+            when(handle, is_equal_to(0x0000000f)),
+            will_return(0));
+
+    error = mtp_responder_handle_request(mtp, send_partial_request, sizeof(send_partial_request));
+    assert_that(error, is_equal_to(0));
+    error = mtp_responder_handle_request(mtp, send_partial_data, sizeof(send_partial_data));
+    assert_that(error, is_equal_to(0));
+    error = mtp_responder_set_data(mtp, chunk, 416);
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(given_response->parameter[0], is_equal_to(452));
+
+    error = mtp_responder_handle_request(mtp, get_partial_upload_request, sizeof(get_partial_upload_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_OBJECT_HANDLE));
+}
+
+Ensure(resume, partial_object_must_continue_at_received_offset)
+{
+    uint8_t request[sizeof(send_partial_request)];
+    memcpy(request, send_partial_request, sizeof(request));
+    request[16] = 0x00;
+
+    stage_interrupted_upload();
+    never_expect(mock_open);
+
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_PARAMETER));
+}
+
+Ensure(resume, interrupted_resume_is_staged_again)
+{
+    stage_interrupted_upload();
+    expect(mock_open, will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_close);
+    expect(mock_stage, will_return(0));
+    never_expect(mock_commit);
+
+    mtp_responder_handle_request(mtp, send_partial_request, sizeof(send_partial_request));
+    mtp_responder_handle_request(mtp, send_partial_data, sizeof(send_partial_data));
+    mtp_responder_transaction_reset(mtp);
+
+    mtp_responder_handle_request(mtp, get_partial_upload_request, sizeof(get_partial_upload_request));
+    mtp_responder_get_response(mtp, MTP_RESPONSE_OK, response, &response_size);
+    assert_that(given_response->parameter[1], is_equal_to(548 + 36));
+}
+
+Ensure(resume, abandoned_upload_expires)
+{
+    mtp_responder_set_staging_timeout(mtp, 60);
+    mtp_responder_collect_staged(mtp, 100);
+    stage_interrupted_upload();
+
+    mtp_responder_collect_staged(mtp, 159);
+
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+    mtp_responder_collect_staged(mtp, 160);
+
+    error = mtp_responder_handle_request(mtp, get_partial_upload_request, sizeof(get_partial_upload_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_OBJECT_HANDLE));
+}
+
+Ensure(resume, announced_object_is_removed_by_next_object_info)
+{
+    const uint32_t first = 0x0000000f;
+    const uint32_t second = 0x00000010;
+
+    announce_object(&video_file, &first);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+    announce_object(&video_file, &second);
+}
+
+Ensure(resume, announced_object_is_removed_on_close_session)
+{
+    const uint32_t handle = 0x0000000f;
+
+    open_session();
+    announce_object(&video_file, &handle);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+
+    error = mtp_responder_handle_request(mtp, close_session_request, sizeof(close_session_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(resume, staged_upload_stays_on_close_session)
+{
+    open_session();
+    stage_interrupted_upload();
+    never_expect(mock_remove);
+
+    mtp_responder_handle_request(mtp, close_session_request, sizeof(close_session_request));
+}
+
+Ensure(resume, failed_write_removes_object)
+{
+    const uint32_t handle = 0x0000000f;
+
+    announce_object(&video_file, &handle);
+    expect(mock_open, will_return(0));
+    expect(mock_write, will_return(-1));
+    expect(mock_close);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+
+    mtp_responder_handle_request(mtp, send_object_request, sizeof(send_object_request));
+    error = mtp_responder_handle_request(mtp, send_object_data, sizeof(send_object_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OBJECT_TOO_LARGE));
+
+    never_expect(mock_remove);
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+}
+
+Ensure(resume, empty_object_failing_commit_is_removed)
+{
+    const uint32_t handle = 0x0000000f;
+    mtp_object_info_t empty_file = video_file;
+    empty_file.size = 0;
+
+    expect(deserialize_object_info,
+            will_set_contents_of_parameter(info, &empty_file, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(is_format_code_supported, will_return(true));
+    expect(mock_create,
+            will_set_contents_of_parameter(handle, &handle, sizeof(handle)),
+            will_return(0));
+    expect(mock_commit, will_return(-1));
+    expect(mock_remove,
+            when(handle, is_equal_to(0x0000000f)));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    error = mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_STORE_NOT_AVAILABLE));
+}
@@ -0,0 +1,159 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static size_t given_data_size;
+static const mtp_data_cntr_t *given = (mtp_data_cntr_t*)given_data;
+static uint8_t response[32];
+static size_t response_size;
+static const mtp_resp_cntr_t *given_response = (mtp_resp_cntr_t*)response;
+
+static const uint8_t query_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08, 0x97,
+    0xe1, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+};
+
+/* Files with ".wav" suffix, dataset itself is parsed by mocked deserializer */
+static const uint8_t query_data[] = {
+    0x36, 0x00, 0x00, 0x00, 0x02, 0x00, 0x08, 0x97,
+    0xe1, 0x03, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f,
+    0x04, 0x00, 0x2e, 0x77, 0x61, 0x76,
+};
+
+static const uint8_t results_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x09, 0x97,
+    0xe2, 0x03, 0x00, 0x00,
+};
+
+static const mtp_search_query_t wav_query = {
+    .name_match = MTP_SEARCH_NAME_SUFFIX,
+    .size_max = UINT64_MAX,
+    .modified_from = INT64_MIN,
+    .modified_to = INT64_MAX,
+    .name = ".wav",
+};
+
+static const uint32_t handles[] = { 3, 7 };
+
+static void search(uint32_t count)
+{
+    expect(deserialize_search_query,
+            when(length, is_equal_to(sizeof(query_data) - MTP_CONTAINER_HEADER_SIZE)),
+            will_set_contents_of_parameter(query, &wav_query, sizeof(wav_query)),
+            will_return(0));
+    expect(mock_search, will_return(count));
+
+    error = mtp_responder_handle_request(mtp, query_request, sizeof(query_request));
+    assert_that(error, is_equal_to(0));
+    error = mtp_responder_handle_request(mtp, query_data, sizeof(query_data));
+}
+
+Describe(search);
+
+BeforeEach(search)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_batch_api, NULL);
+    given_data_size = 0xaabbccdd;
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(search)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(search, not_supported_without_storage_hooks)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+
+    error = mtp_responder_handle_request(mtp, query_request, sizeof(query_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OPERATION_NOT_SUPPORTED));
+}
+
+Ensure(search, malformed_query_is_rejected)
+{
+    expect(deserialize_search_query, will_return(-1));
+    never_expect(mock_search);
+
+    mtp_responder_handle_request(mtp, query_request, sizeof(query_request));
+    error = mtp_responder_handle_request(mtp, query_data, sizeof(query_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_DATASET));
+}
+
+Ensure(search, response_carries_number_of_matches)
+{
+    search(2);
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(response_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + sizeof(uint32_t)));
+    assert_that(given_response->parameter[0], is_equal_to(2));
+}
+
+Ensure(search, results_are_sent_like_object_handles)
+{
+    search(2);
+    expect(mock_search_batch,
+            when(max, is_equal_to(2)),
+            will_set_contents_of_parameter(out, handles, sizeof(handles)),
+            will_return(2));
+
+    error = mtp_responder_handle_request(mtp, results_request, sizeof(results_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 3 * sizeof(uint32_t)));
+    assert_that(given->header.length, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 3 * sizeof(uint32_t)));
+    assert_that(((uint32_t*)given->payload)[0], is_equal_to(2));
+    assert_that(((uint32_t*)given->payload)[1], is_equal_to(3));
+    assert_that(((uint32_t*)given->payload)[2], is_equal_to(7));
+}
+
+Ensure(search, results_not_fitting_buffer_follow_in_next_frames)
+{
+    const uint32_t first = (sizeof(given_data) - MTP_CONTAINER_HEADER_SIZE) / sizeof(uint32_t) - 1;
+
+    search(200);
+    expect(mock_search_batch,
+            when(max, is_equal_to(first)),
+            will_return(first));
+    expect(mock_search_batch,
+            when(max, is_equal_to(200 - first)),
+            will_return(200 - first));
+
+    mtp_responder_handle_request(mtp, results_request, sizeof(results_request));
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(sizeof(given_data)));
+    assert_that(given->header.length, is_equal_to((1 + 200) * sizeof(uint32_t) + MTP_CONTAINER_HEADER_SIZE));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to((200 - first) * sizeof(uint32_t)));
+}
+
+Ensure(search, results_are_given_once)
+{
+    search(0);
+    expect(mock_search_batch, will_return(0));
+
+    error = mtp_responder_handle_request(mtp, results_request, sizeof(results_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+    error = mtp_responder_handle_request(mtp, results_request, sizeof(results_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_NO_VALID_OBJECT_INFO));
+}
@@ -0,0 +1,232 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static uint8_t response[64];
+static const mtp_resp_cntr_t *given_response = (mtp_resp_cntr_t*)response;
+static size_t response_size;
+
+static const uint8_t send_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x06, 0x97,
+    0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+};
+
+/* Header of 100 byte file with its padded payload, header of empty file,
+ * end of archive. Headers are parsed by mocked deserialize_archive_header. */
+static uint8_t send_data[MTP_CONTAINER_HEADER_SIZE + 4 * MTP_ARCHIVE_BLOCK_SIZE] = {
+    0x0c, 0x08, 0x00, 0x00, 0x02, 0x00, 0x06, 0x97,
+    0xe2, 0x03, 0x00, 0x00,
+};
+
+static mtp_object_info_t notes_file = {
+    .filename = "notes.txt",
+    .format_code = MTP_FORMAT_UNDEFINED,
+    .size = 100,
+};
+
+static mtp_object_info_t empty_file = {
+    .filename = "empty.txt",
+    .format_code = MTP_FORMAT_UNDEFINED,
+    .size = 0,
+};
+
+static const uint32_t notes_handle = 0x10;
+static const uint32_t empty_handle = 0x11;
+
+static void expect_entry(const mtp_object_info_t *info, const uint32_t *handle)
+{
+    expect(deserialize_archive_header,
+            will_set_contents_of_parameter(info, info, sizeof(mtp_object_info_t)),
+            will_return(MTP_ARCHIVE_FILE));
+    expect(mock_create,
+            will_set_contents_of_parameter(handle, handle, sizeof(uint32_t)),
+            will_return(0));
+}
+
+Describe(send_archive);
+
+BeforeEach(send_archive)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_staging_api, NULL);
+    memset(response, 0xaa, sizeof(response));
+    error = 0xaa;
+}
+
+AfterEach(send_archive)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(send_archive, requires_storage_id)
+{
+    uint8_t request[sizeof(send_request)];
+    memcpy(request, send_request, sizeof(request));
+    request[12] = 0x02;
+
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_STORAGE_ID));
+}
+
+Ensure(send_archive, stores_each_file_as_object)
+{
+    expect_entry(&notes_file, &notes_handle);
+    expect(mock_open,
+            when(handle, is_equal_to(0x10)),
+            when(mode, is_equal_to_string("w+")),
+            will_return(0));
+    expect(mock_write,
+            when(count, is_equal_to(100)),
+            will_return(0));
+    expect(mock_close);
+    expect(mock_commit,
+            when(handle, is_equal_to(0x10)),
+            will_return(0));
+    expect_entry(&empty_file, &empty_handle);
+    expect(mock_open, will_return(0));
+    never_expect(mock_write);
+    expect(mock_close);
+    expect(mock_commit,
+            when(handle, is_equal_to(0x11)),
+            will_return(0));
+    expect(deserialize_archive_header, will_return(MTP_ARCHIVE_END));
+
+    error = mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    assert_that(error, is_equal_to(0));
+    error = mtp_responder_handle_request(mtp, send_data, sizeof(send_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(response_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 3 * sizeof(uint32_t)));
+    assert_that(given_response->parameter[0], is_equal_to(2));
+    assert_that(given_response->parameter[1], is_equal_to(2));
+    assert_that(given_response->parameter[2], is_equal_to(0xFFFFFFFF));
+}
+
+Ensure(send_archive, failed_entry_is_skipped_and_reported)
+{
+    expect(deserialize_archive_header,
+            will_set_contents_of_parameter(info, &notes_file, sizeof(mtp_object_info_t)),
+            will_return(MTP_ARCHIVE_FILE));
+    expect(mock_create, will_return(-1));
+    never_expect(mock_write);
+    expect_entry(&empty_file, &empty_handle);
+    expect(mock_open, will_return(0));
+    expect(mock_close);
+    expect(mock_commit, will_return(0));
+    expect(deserialize_archive_header, will_return(MTP_ARCHIVE_END));
+
+    mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    error = mtp_responder_handle_request(mtp, send_data, sizeof(send_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(given_response->parameter[0], is_equal_to(2));
+    assert_that(given_response->parameter[1], is_equal_to(1));
+    assert_that(given_response->parameter[2], is_equal_to(0));
+}
+
+Ensure(send_archive, entry_with_path_is_skipped_and_reported)
+{
+    expect(deserialize_archive_header,
+            will_set_contents_of_parameter(info, &notes_file, sizeof(mtp_object_info_t)),
+            will_return(MTP_ARCHIVE_REJECT));
+    never_expect(mock_create);
+    never_expect(mock_write);
+    expect_entry(&empty_file, &empty_handle);
+    expect(mock_open, will_return(0));
+    expect(mock_close);
+    expect(mock_commit, will_return(0));
+    expect(deserialize_archive_header, will_return(MTP_ARCHIVE_END));
+
+    mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    error = mtp_responder_handle_request(mtp, send_data, sizeof(send_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(given_response->parameter[0], is_equal_to(2));
+    assert_that(given_response->parameter[1], is_equal_to(1));
+    assert_that(given_response->parameter[2], is_equal_to(0));
+}
+
+Ensure(send_archive, entry_spans_data_frames)
+{
+    /* Rest of payload, padding and header of the next entry */
+    uint8_t chunk[50 + 412 + MTP_ARCHIVE_BLOCK_SIZE];
+    uint8_t data[MTP_CONTAINER_HEADER_SIZE + MTP_ARCHIVE_BLOCK_SIZE + 50];
+    memcpy(data, send_data, MTP_CONTAINER_HEADER_SIZE);
+    memset(data + MTP_CONTAINER_HEADER_SIZE, 0, sizeof(data) - MTP_CONTAINER_HEADER_SIZE);
+    memset(chunk, 0, sizeof(chunk));
+
+    expect_entry(&notes_file, &notes_handle);
+    expect(mock_open, will_return(0));
+    expect(mock_write,
+            when(count, is_equal_to(50)),
+            will_return(0));
+    expect(mock_write,
+            when(count, is_equal_to(50)),
+            will_return(0));
+    expect(mock_close);
+    expect(mock_commit, will_return(0));
+
+    mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    error = mtp_responder_handle_request(mtp, data, sizeof(data));
+    assert_that(error, is_equal_to(0));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(true));
+
+    expect(deserialize_archive_header,
+            will_set_contents_of_parameter(info, &empty_file, sizeof(mtp_object_info_t)),
+            will_return(MTP_ARCHIVE_SKIP));
+    error = mtp_responder_set_data(mtp, chunk, sizeof(chunk));
+    assert_that(error, is_equal_to(0));
+}
+
+Ensure(send_archive, malformed_header_ends_transfer)
+{
+    expect_entry(&notes_file, &notes_handle);
+    expect(mock_open, will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_close);
+    expect(mock_commit, will_return(0));
+    expect(deserialize_archive_header, will_return(-1));
+    never_expect(mock_remove);
+
+    mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    error = mtp_responder_handle_request(mtp, send_data, sizeof(send_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_DATASET));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(false));
+
+    mtp_responder_get_response(mtp, error, response, &response_size);
+    assert_that(given_response->parameter[0], is_equal_to(1));
+    assert_that(given_response->parameter[1], is_equal_to(1));
+}
+
+Ensure(send_archive, interrupted_transfer_removes_partial_entry)
+{
+    uint8_t data[MTP_CONTAINER_HEADER_SIZE + MTP_ARCHIVE_BLOCK_SIZE + 50];
+    memcpy(data, send_data, MTP_CONTAINER_HEADER_SIZE);
+    memset(data + MTP_CONTAINER_HEADER_SIZE, 0, sizeof(data) - MTP_CONTAINER_HEADER_SIZE);
+
+    expect_entry(&notes_file, &notes_handle);
+    expect(mock_open, will_return(0));
+    expect(mock_write, will_return(0));
+    expect(mock_close);
+    never_expect(mock_commit);
+    expect(mock_remove,
+            when(handle, is_equal_to(0x10)));
+
+    mtp_responder_handle_request(mtp, send_request, sizeof(send_request));
+    mtp_responder_handle_request(mtp, data, sizeof(data));
+    mtp_responder_transaction_reset(mtp);
+}
@@ -0,0 +1,175 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+
+static const uint8_t hash_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x04, 0x97,
+    0xe1, 0x03, 0x00, 0x00,
+};
+
+/* Payload is parsed by mocked deserialize_object_hash */
+static const uint8_t hash_data[MTP_CONTAINER_HEADER_SIZE + MTP_OBJECT_HASH_SIZE] = {
+    0x38, 0x00, 0x00, 0x00, 0x02, 0x00, 0x04, 0x97,
+    0xe1, 0x03, 0x00, 0x00,
+};
+
+static const uint8_t object_info_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t object_info_data[] = {
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static mtp_object_info_t song = {
+    .filename = "song.mp3",
+    .format_code = MTP_FORMAT_MP3,
+    .size = 4096,
+};
+
+static mtp_object_hash_t song_hash = {
+    .checksum = 0xe3069283,
+    .size = 4096,
+};
+
+static void expect_hash(const mtp_object_hash_t *hash, uint32_t source)
+{
+    expect(deserialize_object_hash,
+            will_set_contents_of_parameter(hash, hash, sizeof(mtp_object_hash_t)),
+            will_return(0));
+    expect(mock_find_duplicate, will_return(source));
+}
+
+/* Returns response of SendObjectHash */
+static uint16_t send_hash(void)
+{
+    mtp_responder_handle_request(mtp, hash_request, sizeof(hash_request));
+    return mtp_responder_handle_request(mtp, hash_data, sizeof(hash_data));
+}
+
+static void expect_object_info(const mtp_object_info_t *info)
+{
+    expect(deserialize_object_info,
+            will_set_contents_of_parameter(info, info, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(is_format_code_supported, will_return(true));
+}
+
+Describe(send_object_hash);
+
+BeforeEach(send_object_hash)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_batch_api, NULL);
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(send_object_hash)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(send_object_hash, not_supported_without_storage_hooks)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+
+    error = mtp_responder_handle_request(mtp, hash_request, sizeof(hash_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OPERATION_NOT_SUPPORTED));
+}
+
+Ensure(send_object_hash, unknown_content_goes_through_data_phase)
+{
+    expect_hash(&song_hash, 0);
+    expect_object_info(&song);
+    expect(mock_create, will_return(0));
+    never_expect(mock_create_copy);
+
+    error = send_hash();
+    assert_that(error, is_equal_to(MTP_RESPONSE_VENDOR_NO_MATCHING_OBJECT));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    error = mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(send_object_hash, known_content_is_copied_on_device)
+{
+    const uint32_t handle = 0x10;
+
+    expect_hash(&song_hash, 7);
+    expect_object_info(&song);
+    expect(mock_create_copy,
+            when(source, is_equal_to(7)),
+            will_set_contents_of_parameter(handle, &handle, sizeof(handle)),
+            will_return(0));
+    never_expect(mock_create);
+
+    error = send_hash();
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    error = mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+    assert_that(mtp_responder_data_transaction_open(mtp), is_equal_to(false));
+}
+
+Ensure(send_object_hash, size_mismatch_falls_back_to_create)
+{
+    mtp_object_info_t other = song;
+    other.size = 100;
+
+    expect_hash(&song_hash, 7);
+    expect_object_info(&other);
+    expect(mock_create, will_return(0));
+    never_expect(mock_create_copy);
+
+    send_hash();
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    error = mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(send_object_hash, hint_is_dropped_by_other_operation)
+{
+    const uint8_t get_info_request[] = {
+        0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08, 0x10,
+        0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    };
+
+    expect_hash(&song_hash, 7);
+    expect(mock_stat, will_return(-1));
+    expect_object_info(&song);
+    expect(mock_create, will_return(0));
+    never_expect(mock_create_copy);
+
+    send_hash();
+    mtp_responder_handle_request(mtp, get_info_request, sizeof(get_info_request));
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    error = mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(send_object_hash, malformed_hash_is_rejected)
+{
+    expect(deserialize_object_hash, will_return(-1));
+    never_expect(mock_find_duplicate);
+
+    error = send_hash();
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_DATASET));
+}
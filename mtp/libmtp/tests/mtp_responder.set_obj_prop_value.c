@@ -0,0 +1,102 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+
+/* Handle 0x0f, DateModified */
+static const uint8_t date_modified_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x04, 0x98,
+    0xe2, 0x03, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00,
+    0x09, 0xdc, 0x00, 0x00,
+};
+
+/* "20200130T080657" */
+static const uint8_t date_modified_data[] = {
+    0x2d, 0x00, 0x00, 0x00, 0x02, 0x00, 0x04, 0x98,
+    0xe2, 0x03, 0x00, 0x00, 0x10, 0x32, 0x00, 0x30,
+    0x00, 0x32, 0x00, 0x30, 0x00, 0x30, 0x00, 0x31,
+    0x00, 0x33, 0x00, 0x30, 0x00, 0x54, 0x00, 0x30,
+    0x00, 0x38, 0x00, 0x30, 0x00, 0x36, 0x00, 0x35,
+    0x00, 0x37, 0x00, 0x00, 0x00,
+};
+
+static const time_t modified = 1580371617;
+
+static void expect_date_deserialized(void)
+{
+    expect(deserialize_object_prop_value,
+            when(prop_code, is_equal_to(MTP_PROPERTY_DATE_MODIFIED)),
+            will_set_contents_of_parameter(value, &modified, sizeof(modified)),
+            will_return(33));
+}
+
+Describe(set_object_prop_value);
+
+BeforeEach(set_object_prop_value)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_staging_api, NULL);
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(set_object_prop_value)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(set_object_prop_value, fails_for_unknown_object)
+{
+    expect(mock_stat, will_return(-1));
+
+    error = mtp_responder_handle_request(mtp, date_modified_request, sizeof(date_modified_request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_OBJECT_HANDLE));
+}
+
+Ensure(set_object_prop_value, date_modified_is_set_in_storage)
+{
+    expect(mock_stat, will_return(0));
+    expect_date_deserialized();
+    expect(mock_set_modified,
+            when(handle, is_equal_to(0x0000000f)),
+            when(modified, is_equal_to(modified)),
+            will_return(0));
+
+    error = mtp_responder_handle_request(mtp, date_modified_request, sizeof(date_modified_request));
+    assert_that(error, is_equal_to(0));
+    error = mtp_responder_handle_request(mtp, date_modified_data, sizeof(date_modified_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+}
+
+Ensure(set_object_prop_value, date_modified_failure_is_reported)
+{
+    expect(mock_stat, will_return(0));
+    expect_date_deserialized();
+    expect(mock_set_modified, will_return(-1));
+
+    mtp_responder_handle_request(mtp, date_modified_request, sizeof(date_modified_request));
+    error = mtp_responder_handle_request(mtp, date_modified_data, sizeof(date_modified_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_INVALID_OBJECT_PROP_VALUE));
+}
+
+Ensure(set_object_prop_value, date_modified_is_denied_without_storage_support)
+{
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    expect(mock_stat, will_return(0));
+    expect_date_deserialized();
+
+    mtp_responder_handle_request(mtp, date_modified_request, sizeof(date_modified_request));
+    error = mtp_responder_handle_request(mtp, date_modified_data, sizeof(date_modified_data));
+    assert_that(error, is_equal_to(MTP_RESPONSE_ACCESS_DENIED));
+}
@@ -0,0 +1,162 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint16_t error;
+static uint8_t given_data[512];
+static size_t given_data_size;
+static const mtp_data_cntr_t *given = (mtp_data_cntr_t*)given_data;
+
+static const uint8_t request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x97,
+    0x05, 0x00, 0x00, 0x30, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint32_t COUNT = 2;
+static uint8_t entries[3][MTP_MANIFEST_ENTRY_MAX_SIZE];
+
+static void expect_listing(uint32_t count)
+{
+    uint32_t i;
+
+    expect(mock_find_first,
+            when(parent, is_equal_to(0xFFFFFFFF)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(1));
+    for (i = 2; i <= count; i++)
+    {
+        expect(mock_find_next, will_return(i));
+    }
+    expect(mock_find_next, will_return(0));
+}
+
+/* Contents are copied when mock is called, so every entry needs own buffer */
+static void expect_entry(uint32_t handle, uint32_t length, uint8_t fill)
+{
+    uint8_t *entry = entries[handle - 1];
+    memset(entry, fill, sizeof(entries[0]));
+    expect(mock_stat,
+            when(handle, is_equal_to(handle)),
+            will_return(0));
+    expect(serialize_manifest_entry,
+            when(handle, is_equal_to(handle)),
+            will_set_contents_of_parameter(data, entry, length),
+            will_return(length));
+}
+
+Describe(sync_manifest);
+
+BeforeEach(sync_manifest)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    given_data_size = 0xaabbccdd;
+    memset(given_data, 0xaa, sizeof(given_data));
+    error = 0xaa;
+}
+
+AfterEach(sync_manifest)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(sync_manifest, streams_all_entries_in_one_transaction)
+{
+    expect_listing(2);
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(40));
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(40));
+    expect_listing(2);
+    expect_entry(1, 40, 0x11);
+    expect_entry(2, 40, 0x22);
+
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 4 + 80));
+    assert_that(given->header.length, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 4 + 80));
+    assert_that(given->header.operation_code, is_equal_to(MTP_OPERATION_VENDOR_GET_SYNC_MANIFEST));
+    assert_that(*(uint32_t*)given->payload, is_equal_to(2));
+    assert_that(given->payload[4], is_equal_to(0x11));
+    assert_that(given->payload[4 + 40], is_equal_to(0x22));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(0));
+}
+
+Ensure(sync_manifest, splits_entries_across_frames)
+{
+    const uint32_t THREE = 3;
+
+    expect(mock_find_first,
+            will_set_contents_of_parameter(count, &THREE, sizeof(uint32_t)),
+            will_return(1));
+    expect(mock_find_next, will_return(2));
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(250));
+    expect(mock_find_next, will_return(3));
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(250));
+    expect(mock_find_next, will_return(0));
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(250));
+
+    expect(mock_find_first,
+            will_set_contents_of_parameter(count, &THREE, sizeof(uint32_t)),
+            will_return(1));
+    expect(mock_find_next, will_return(2));
+    expect_entry(1, 250, 0x11);
+    expect(mock_find_next, will_return(3));
+    expect_entry(2, 250, 0x22);
+
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(512));
+    assert_that(given->header.length, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 4 + 750));
+    assert_that(given_data[511], is_equal_to(0x22));
+
+    expect(mock_find_next, will_return(0));
+    expect_entry(3, 250, 0x33);
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(750 + 4 - 500));
+    assert_that(given_data[3], is_equal_to(0x22));
+    assert_that(given_data[4], is_equal_to(0x33));
+}
+
+Ensure(sync_manifest, pads_entries_removed_while_streaming)
+{
+    expect_listing(2);
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(40));
+    expect(mock_stat, will_return(0));
+    expect(serialize_manifest_entry, will_return(40));
+    expect_listing(2);
+    expect_entry(1, 40, 0x11);
+    expect(mock_stat, will_return(-1));
+
+    error = mtp_responder_handle_request(mtp, request, sizeof(request));
+    assert_that(error, is_equal_to(MTP_RESPONSE_OK));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(MTP_CONTAINER_HEADER_SIZE + 4 + 40));
+
+    given_data_size = mtp_responder_get_data(mtp);
+    assert_that(given_data_size, is_equal_to(40));
+    assert_that(given_data[0], is_equal_to(0));
+    assert_that(given_data[39], is_equal_to(0));
+}
@@ -0,0 +1,112 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+
+#include "mtp_responder.h"
+#include "mtp_container.h"
+#include "mtp_storage.h"
+#include "mtp_util.h"
+
+#include "mock_mtp_storage_api.h"
+
+static mtp_responder_t *mtp = NULL;
+static uint8_t given_data[512];
+static uint32_t given_object;
+static uint16_t given_operation;
+
+static const uint8_t open_session_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x10,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t get_object_info_request[] = {
+    0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t object_info_request[] = {
+    0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t object_info_data[] = {
+    0x10, 0x00, 0x00, 0x00, 0x02, 0x00, 0x0c, 0x10,
+    0xe2, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t send_object_request[] = {
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x0d, 0x10,
+    0xe3, 0x03, 0x00, 0x00,
+};
+
+static mtp_object_info_t song = {
+    .filename = "song.mp3",
+    .format_code = MTP_FORMAT_MP3,
+    .size = 4096,
+};
+
+Describe(transaction_operation);
+
+BeforeEach(transaction_operation)
+{
+    mtp = mtp_responder_alloc();
+    mtp_responder_init(mtp);
+    mtp_responder_set_data_buffer(mtp, given_data, sizeof(given_data));
+    mtp_responder_set_storage(mtp, 0x00010001, &mock_api, NULL);
+    given_object = 0xaabbccdd;
+}
+
+AfterEach(transaction_operation)
+{
+    mtp_responder_free(mtp);
+}
+
+Ensure(transaction_operation, is_none_before_first_transaction)
+{
+    given_operation = mtp_responder_transaction_operation(mtp, &given_object);
+    assert_that(given_operation, is_equal_to(0));
+    assert_that(given_object, is_equal_to(0));
+}
+
+Ensure(transaction_operation, has_no_object_for_session_operation)
+{
+    expect(mtp_container_get_param_count, will_return(1));
+    mtp_responder_handle_request(mtp, open_session_request, sizeof(open_session_request));
+
+    given_operation = mtp_responder_transaction_operation(mtp, &given_object);
+    assert_that(given_operation, is_equal_to(MTP_OPERATION_OPEN_SESSION));
+    assert_that(given_object, is_equal_to(0));
+}
+
+Ensure(transaction_operation, has_object_given_in_request)
+{
+    expect(mock_stat, will_return(-1));
+
+    mtp_responder_handle_request(mtp, get_object_info_request, sizeof(get_object_info_request));
+
+    given_operation = mtp_responder_transaction_operation(mtp, &given_object);
+    assert_that(given_operation, is_equal_to(MTP_OPERATION_GET_OBJECT_INFO));
+    assert_that(given_object, is_equal_to(7));
+}
+
+Ensure(transaction_operation, send_object_has_object_created_by_send_object_info)
+{
+    const uint32_t handle = 0x0000000f;
+
+    expect(deserialize_object_info,
+            will_set_contents_of_parameter(info, &song, sizeof(mtp_object_info_t)),
+            will_return(0));
+    expect(is_format_code_supported, will_return(true));
+    expect(mock_create,
+            will_set_contents_of_parameter(handle, &handle, sizeof(handle)),
+            will_return(0));
+    expect(mock_open, will_return(0));
+
+    mtp_responder_handle_request(mtp, object_info_request, sizeof(object_info_request));
+    mtp_responder_handle_request(mtp, object_info_data, sizeof(object_info_data));
+    mtp_responder_handle_request(mtp, send_object_request, sizeof(send_object_request));
+
+    given_operation = mtp_responder_transaction_operation(mtp, &given_object);
+    assert_that(given_operation, is_equal_to(MTP_OPERATION_SEND_OBJECT));
+    assert_that(given_object, is_equal_to(handle));
+}
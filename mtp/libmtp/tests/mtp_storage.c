@@ -65,6 +65,84 @@ Ensure(mtp_storage, list_serialize_exactly_into_array)
     assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
 }
 
+Ensure(mtp_storage, list_serialize_with_batch_find)
+{
+    uint8_t expected[] = { 0x03, 0x00, 0x00, 0x00,
+                           0x00, 0x00, 0x00, 0x81,
+                           0x00, 0x00, 0x00, 0x82,
+                           0x00, 0x00, 0x00, 0x83};
+    const uint32_t handles[] = { 0x82000000, 0x83000000 };
+    uint32_t COUNT = 3;
+    storage.api = &mock_batch_api;
+    expect(mock_find_first,
+            when(parent, is_equal_to(0)),
+            will_set_contents_of_parameter(count, &COUNT, sizeof(uint32_t)),
+            will_return(0x81000000));
+    expect(mock_find_batch,
+            when(max, is_equal_to(2)),
+            will_set_contents_of_parameter(out, handles, sizeof(handles)),
+            will_return(2));
+
+    given_length = serialize_storage_list(&storage, 0, given);
+    assert_that(given_length, is_equal_to(sizeof(expected)));
+    assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(mtp_storage, manifest_entry)
+{
+    mtp_object_info_t info = {
+        .size = 0x0102030405060708,
+        .modified = 0x5e3306dc,
+        .format_code = MTP_FORMAT_TEXT,
+        .checksum = 0xe3069283,
+        .filename = "a.txt",
+    };
+    uint8_t expected[] = { 0x07, 0x00, 0x00, 0x00,
+                           0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01,
+                           0xdc, 0x06, 0x33, 0x5e, 0x00, 0x00, 0x00, 0x00,
+                           0x04, 0x30,
+                           0x83, 0x92, 0x06, 0xe3,
+                           0x05, 0x00,
+                           'a', '.', 't', 'x', 't' };
+
+    given_length = serialize_manifest_entry(7, &info, given);
+    assert_that(given_length, is_equal_to(sizeof(expected)));
+    assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(mtp_storage, archive_header_reads_back)
+{
+    uint8_t block[MTP_ARCHIVE_HEADER_MAX_SIZE];
+    mtp_object_info_t read = {0};
+    mtp_object_info_t info = {
+        .size = 100,
+        .modified = 0x5e3306dc,
+        .format_code = MTP_FORMAT_TEXT,
+        .filename = "a.txt",
+    };
+
+    assert_that(serialize_archive_header(&info, block), is_equal_to(MTP_ARCHIVE_BLOCK_SIZE));
+    assert_that(block + 257, is_equal_to_contents_of("ustar", 6));
+    assert_that(deserialize_archive_header(block, &read), is_equal_to(MTP_ARCHIVE_FILE));
+    assert_that(read.filename, is_equal_to_string("a.txt"));
+    assert_that(read.size, is_equal_to(100));
+    assert_that(read.modified, is_equal_to(0x5e3306dc));
+}
+
+Ensure(mtp_storage, archive_header_of_long_name_has_long_name_entry)
+{
+    uint8_t block[MTP_ARCHIVE_HEADER_MAX_SIZE];
+    mtp_object_info_t read = {0};
+    mtp_object_info_t info = { .size = 1 };
+    memset(info.filename, 'a', 120);
+
+    assert_that(serialize_archive_header(&info, block), is_equal_to(3 * MTP_ARCHIVE_BLOCK_SIZE));
+    assert_that(deserialize_archive_header(block, &read), is_equal_to(MTP_ARCHIVE_SKIP));
+    assert_that(read.size, is_equal_to(121));
+    assert_that((const char *)block + MTP_ARCHIVE_BLOCK_SIZE, is_equal_to_string(info.filename));
+    assert_that(deserialize_archive_header(block + 2 * MTP_ARCHIVE_BLOCK_SIZE, &read), is_equal_to(MTP_ARCHIVE_FILE));
+}
+
 Ensure(mtp_storage, storage_info)
 {
     expect(mock_get_properties,
@@ -162,11 +240,25 @@ Ensure(mtp_storage, serialize_supported_object_properties)
         MTP_PROPERTY_DATE_MODIFIED,
         MTP_PROPERTY_PARENT_OBJECT,
         MTP_PROPERTY_OBJECT_FILE_NAME,
+        MTP_PROPERTY_VENDOR_CRC32C,
     };
     const int number_items = sizeof(expected_list)/sizeof(uint16_t);
 
-    given_length = serialize_object_props_supported(given);
+    given_length = serialize_object_props_supported(MTP_FORMAT_UNDEFINED, given);
     assert_that(given_length, is_equal_to(4+sizeof(expected_list)));
     assert_that(*(uint32_t*)given, is_equal_to(number_items));
     assert_that(&given[4], is_equal_to_contents_of(expected_list, number_items));
 }
+
+Ensure(mtp_storage, serialize_supported_properties_of_image)
+{
+    const uint16_t expected_media[] = {
+        MTP_PROPERTY_WIDTH,
+        MTP_PROPERTY_HEIGHT,
+    };
+
+    given_length = serialize_object_props_supported(MTP_FORMAT_EXIF_JPEG, given);
+    assert_that(*(uint32_t*)given, is_equal_to(10 + 2));
+    assert_that(given_length, is_equal_to(4 + 2 * (10 + 2)));
+    assert_that(&given[4 + 2 * 10], is_equal_to_contents_of(expected_media, sizeof(expected_media)));
+}
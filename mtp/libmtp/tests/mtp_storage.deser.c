@@ -68,3 +68,209 @@ Ensure(deser, object_info)
     assert_that(given.modified, is_equal_to(0));
 }
 
+
+Ensure(deser, date_modified_prop_value)
+{
+    const time_t modified = 1580371617;
+    const uint8_t data[] = { 0x01, 0x00 };
+    time_t given = 0;
+    int length;
+
+    expect(get_date,
+            when(buffer, is_equal_to(data)),
+            will_set_contents_of_parameter(time, &modified, sizeof(time_t)),
+            will_return(33));
+
+    length = deserialize_object_prop_value(MTP_PROPERTY_DATE_MODIFIED, data, &given, sizeof(given));
+    assert_that(length, is_equal_to(33));
+    assert_that(given, is_equal_to(modified));
+}
+
+Ensure(deser, date_created_prop_value_is_read_only)
+{
+    const uint8_t data[] = { 0x01, 0x00 };
+    time_t given = 0;
+
+    never_expect(get_date);
+
+    assert_that(deserialize_object_prop_value(MTP_PROPERTY_DATE_CREATED, data, &given, sizeof(given)), is_equal_to(0));
+}
+
+static void make_archive_header(uint8_t *block, const char *name, const char *size, char type)
+{
+    unsigned int sum = 0;
+    int i;
+
+    memset(block, 0, MTP_ARCHIVE_BLOCK_SIZE);
+    strcpy((char *)block, name);
+    strcpy((char *)block + 124, size);
+    strcpy((char *)block + 136, "13620322641");
+    block[156] = type;
+    memcpy(block + 257, "ustar", 6);
+    memset(block + 148, ' ', 8);
+    for (i = 0; i < MTP_ARCHIVE_BLOCK_SIZE; i++) {
+        sum += block[i];
+    }
+    sprintf((char *)block + 148, "%06o", sum);
+}
+
+Ensure(deser, archive_regular_file)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "./notes.txt", "00000000144", '0');
+
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_FILE));
+    assert_that(given.filename, is_equal_to_string("notes.txt"));
+    assert_that(given.size, is_equal_to(100));
+    assert_that(given.modified, is_equal_to(1581360545));
+    assert_that(given.format_code, is_equal_to(MTP_FORMAT_UNDEFINED));
+}
+
+Ensure(deser, archive_directory_is_skipped)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "./", "00000000000", '5');
+
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_SKIP));
+    assert_that(given.size, is_equal_to(0));
+}
+
+Ensure(deser, archive_absolute_path_is_rejected)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "/etc/passwd", "00000000144", '0');
+
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_REJECT));
+    assert_that(given.size, is_equal_to(100));
+}
+
+Ensure(deser, archive_parent_path_is_rejected)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "./../notes.txt", "00000000144", '0');
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_REJECT));
+
+    make_archive_header(block, "..", "00000000144", '0');
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_REJECT));
+}
+
+Ensure(deser, archive_nested_path_is_rejected)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "./music/notes.txt", "00000000144", '0');
+
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_REJECT));
+}
+
+Ensure(deser, archive_reserved_name_is_rejected)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "./.mtp_uid_index", "00000000144", '0');
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_REJECT));
+
+    make_archive_header(block, ".mtp_staged_7", "00000000144", '0');
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_REJECT));
+}
+
+Ensure(deser, archive_zero_block_ends_archive)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    memset(block, 0, sizeof(block));
+
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(MTP_ARCHIVE_END));
+}
+
+Ensure(deser, archive_header_with_bad_checksum_is_malformed)
+{
+    uint8_t block[MTP_ARCHIVE_BLOCK_SIZE];
+    mtp_object_info_t given;
+
+    make_archive_header(block, "notes.txt", "00000000144", '0');
+    block[0] = 'N';
+
+    assert_that(deserialize_archive_header(block, &given), is_equal_to(-1));
+}
+
+/* MP3 files named "rec*", 1 KiB or more, modified in 2023 */
+static const uint8_t search_query[] = {
+    0x09, 0x30, 0x01, 0x00,
+    0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0xcd, 0xb0, 0x63, 0x00, 0x00, 0x00, 0x00,
+    0x7f, 0x00, 0x92, 0x65, 0x00, 0x00, 0x00, 0x00,
+    0x03, 0x00, 0x72, 0x65, 0x63,
+};
+
+Ensure(deser, search_query)
+{
+    mtp_search_query_t given;
+    memset(&given, 0x55, sizeof(given));
+
+    assert_that(deserialize_search_query(search_query, sizeof(search_query), &given), is_equal_to(0));
+    assert_that(given.format_code, is_equal_to(MTP_FORMAT_MP3));
+    assert_that(given.name_match, is_equal_to(MTP_SEARCH_NAME_PREFIX));
+    assert_that(given.size_min, is_equal_to(1024));
+    assert_that(given.size_max, is_equal_to(UINT64_MAX));
+    assert_that(given.modified_from, is_equal_to(1672531200));
+    assert_that(given.modified_to, is_equal_to(1704067199));
+    assert_that(given.name, is_equal_to_string("rec"));
+}
+
+Ensure(deser, search_query_with_name_past_dataset_is_malformed)
+{
+    mtp_search_query_t given;
+
+    assert_that(deserialize_search_query(search_query, sizeof(search_query) - 1, &given), is_equal_to(-1));
+    assert_that(deserialize_search_query(search_query, MTP_SEARCH_QUERY_HEADER_SIZE - 1, &given), is_equal_to(-1));
+}
+
+Ensure(deser, search_query_with_unknown_name_match_is_malformed)
+{
+    uint8_t query[sizeof(search_query)];
+    mtp_search_query_t given;
+
+    memcpy(query, search_query, sizeof(query));
+    query[2] = 4;
+
+    assert_that(deserialize_search_query(query, sizeof(query), &given), is_equal_to(-1));
+}
+
+/* 4096 bytes, CRC32C e3069283, SHA-256 00 01 .. 1f */
+static const uint8_t object_hash[] = {
+    0x83, 0x92, 0x06, 0xe3,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+Ensure(deser, object_hash)
+{
+    mtp_object_hash_t given;
+
+    assert_that(deserialize_object_hash(object_hash, sizeof(object_hash), &given), is_equal_to(0));
+    assert_that(given.checksum, is_equal_to(0xe3069283));
+    assert_that(given.size, is_equal_to(4096));
+    assert_that(given.digest[0], is_equal_to(0x00));
+    assert_that(given.digest[MTP_SHA256_SIZE - 1], is_equal_to(0x1f));
+}
+
+Ensure(deser, truncated_object_hash_is_malformed)
+{
+    mtp_object_hash_t given;
+
+    assert_that(deserialize_object_hash(object_hash, sizeof(object_hash) - 1, &given), is_equal_to(-1));
+}
@@ -23,6 +23,7 @@ static mtp_object_info_t info = {
                  0x01, 0x02, 0x03, 0x04,
                  0x01, 0x02, 0x03, 0x04,
                  0x01, 0x02, 0x03, 0x04},
+        .checksum = 0xe3069283,
     };
 
 Describe(get_obj_prop_value);
@@ -125,3 +126,44 @@ Ensure(get_obj_prop_value, file_name)
     assert_that(given_length, is_equal_to(5));
 }
 
+Ensure(get_obj_prop_value, checksum)
+{
+    uint8_t expected[] = {
+        0x83, 0x92, 0x06, 0xe3,
+    };
+    given_length = serialize_object_prop_value(MTP_PROPERTY_VENDOR_CRC32C, &info, given);
+    assert_that(given_length, is_equal_to(sizeof(expected)));
+    assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(get_obj_prop_value, media_artist)
+{
+    const mtp_media_info_t media = {
+        .artist = "Artist",
+    };
+    expect(put_string,
+            when(text, is_equal_to_contents_of("Artist", 7)),
+            will_return(15));
+    given_length = serialize_media_prop_value(MTP_PROPERTY_ARTIST, &media, given);
+    assert_that(given_length, is_equal_to(15));
+}
+
+Ensure(get_obj_prop_value, media_track)
+{
+    const mtp_media_info_t media = {
+        .track = 0x0107,
+    };
+    uint8_t expected[] = {
+        0x07, 0x01,
+    };
+    given_length = serialize_media_prop_value(MTP_PROPERTY_TRACK, &media, given);
+    assert_that(given_length, is_equal_to(sizeof(expected)));
+    assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
+}
+
+Ensure(get_obj_prop_value, media_value_of_object_property_is_none)
+{
+    const mtp_media_info_t media = {0};
+    given_length = serialize_media_prop_value(MTP_PROPERTY_STORAGE_ID, &media, given);
+    assert_that(given_length, is_equal_to(0));
+}
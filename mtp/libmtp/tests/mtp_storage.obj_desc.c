@@ -155,3 +155,18 @@ Ensure(obj_prop_desc, object_name_property)
     assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
 }
 
+
+Ensure(obj_prop_desc, duration_property)
+{
+    uint8_t expected[] = {
+        0x89, 0xDC,
+        0x06, 0x00,
+        0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x00
+    };
+    given_length = serialize_object_prop_desc(MTP_PROPERTY_DURATION, given);
+    assert_that(given_length, is_equal_to(sizeof(expected)));
+    assert_that(given, is_equal_to_contents_of(expected, sizeof(expected)));
+}
@@ -14,6 +14,7 @@
 #include "composite.h"
 
 #include "mtp_responder.h"
+#include "mtp_container.h"
 #include "mtp_fs.h"
 #include "log.hpp"
 
@@ -23,6 +24,9 @@
 #define CONFIG_RX_STREAM_SIZE (4)
 #define CONFIG_TX_STREAM_SIZE (1)
 #define CONFIG_MTP_STORAGE_ID (0x00010001)
+#ifndef CONFIG_MTP_FS_IO
+#define CONFIG_MTP_FS_IO MTP_FS_IO_STDIO
+#endif
 
 USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE)
 uint8_t rx_buffer[HS_MTP_BULK_IN_PACKET_SIZE];
@@ -30,11 +34,56 @@ USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE)
 uint8_t tx_buffer[HS_MTP_BULK_OUT_PACKET_SIZE];
 USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE)
 uint8_t event_response[HS_MTP_INTR_IN_PACKET_SIZE];
+USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE) static uint8_t object_event[HS_MTP_INTR_IN_PACKET_SIZE];
 USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE) static uint8_t mtp_request[sizeof(rx_buffer)];
 USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE) static uint8_t mtp_response[sizeof(tx_buffer)];
 USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE) static char mtpRootPath[256];
 
-#define MTP_TASK_STACK_SIZE (3U * 1024U)
+/* Deepest path is GetObjectPropValue of a media property, which reads tags of
+ * the file through stdio. Its frames add up to about 2.3 KiB before libc, so
+ * 3 KiB left too little for fread. Buffers of journal records and media tags
+ * are allocated, not on the stack. */
+#ifndef CONFIG_MTP_TASK_STACK_SIZE
+#define CONFIG_MTP_TASK_STACK_SIZE (4U * 1024U)
+#endif
+
+/* Changes of files made outside of MTP reported to the host per idle poll */
+#ifndef CONFIG_MTP_EVENTS_PER_POLL
+#define CONFIG_MTP_EVENTS_PER_POLL (4U)
+#endif
+
+/* MTP task runs at CONFIG_MTP_TASK_PRIORITY and is raised to
+ * CONFIG_MTP_TASK_BOOST_PRIORITY for data phases of at least
+ * CONFIG_MTP_BOOST_MIN_SIZE bytes. Priority drops back once there was no data
+ * phase for CONFIG_MTP_BOOST_HOLD_MS, so back to back objects don't flip it. */
+#ifndef CONFIG_MTP_TASK_PRIORITY
+#define CONFIG_MTP_TASK_PRIORITY (tskIDLE_PRIORITY)
+#endif
+#ifndef CONFIG_MTP_TASK_BOOST_PRIORITY
+#define CONFIG_MTP_TASK_BOOST_PRIORITY (tskIDLE_PRIORITY + 2)
+#endif
+#ifndef CONFIG_MTP_BOOST_MIN_SIZE
+#define CONFIG_MTP_BOOST_MIN_SIZE (64U * 1024U)
+#endif
+#ifndef CONFIG_MTP_BOOST_HOLD_MS
+#define CONFIG_MTP_BOOST_HOLD_MS (200U)
+#endif
+
+/* Progress reports interval when listener doesn't set one */
+#ifndef CONFIG_MTP_PROGRESS_INTERVAL_MS
+#define CONFIG_MTP_PROGRESS_INTERVAL_MS (250U)
+#endif
+
+/* Data stage of Still Image class Cancel Request, little endian */
+struct mtp_cancel_request
+{
+    uint16_t code;
+    uint32_t transaction_id;
+} __attribute__((packed));
+typedef struct mtp_cancel_request mtp_cancel_request_t;
+_Static_assert(sizeof(mtp_cancel_request_t) == 6, "Cancel Request data stage is 6 bytes");
+
+USB_GLOBAL USB_RAM_ADDRESS_ALIGNMENT(USB_DATA_ALIGN_SIZE) static uint8_t cancel_request[sizeof(mtp_cancel_request_t)];
 
 static mtp_device_info_t getDevice(void)
 {
@@ -176,9 +225,14 @@ static usb_status_t OnIncomingFrame(usb_mtp_struct_t *mtpApp, void *param)
 
 static usb_status_t OnOutgoingFrameSent(usb_mtp_struct_t *mtpApp, void *param)
 {
-    UNUSED(param);
+    usb_device_endpoint_callback_message_struct_t *epCbParam = (usb_device_endpoint_callback_message_struct_t *)param;
 
     if (mtpApp->configured) {
+        if (mtpApp->in_reset || epCbParam->length == USB_UNINITIALIZED_VAL_32) {
+            // Transfer cancelled, don't feed controller with the rest of outgoing stream
+            log_debug("[MTP] Tx cancelled");
+            return kStatus_USB_Success;
+        }
         log_debug("[MTP] already sent");
         if (mtpApp->outputBox == NULL) {
             log_error("[MTP] output stream buffer is NULL!");
@@ -200,9 +254,45 @@ static usb_status_t OnOutgoingFrameSent(usb_mtp_struct_t *mtpApp, void *param)
 
 static usb_status_t OnCancelTransaction(usb_mtp_struct_t *mtpApp, void *param)
 {
-    UNUSED(param);
+    usb_device_control_request_struct_t *request = (usb_device_control_request_struct_t *)param;
+    uint16_t code;
+    uint32_t transaction_id;
+
+    if (request->isSetup) {
+        // Provide buffer for the data stage, request is handled when data arrives
+        request->buffer = cancel_request;
+        request->length = sizeof(cancel_request);
+        return kStatus_USB_Success;
+    }
+
+    if (request->length < sizeof(mtp_cancel_request_t)) {
+        log_debug("[MTP] Invalid cancel request, length: %u", (unsigned int)request->length);
+        return kStatus_USB_InvalidRequest;
+    }
+
+    code           = (uint16_t)(cancel_request[0] | (cancel_request[1] << 8));
+    transaction_id = (uint32_t)cancel_request[2] | ((uint32_t)cancel_request[3] << 8) |
+                     ((uint32_t)cancel_request[4] << 16) | ((uint32_t)cancel_request[5] << 24);
+    if (code != MTP_EVENT_CANCEL_TRANSACTION) {
+        log_debug("[MTP] Invalid cancel request, code: 0x%x", (unsigned int)code);
+        return kStatus_USB_InvalidRequest;
+    }
+
+    mtpApp->cancel_transaction_id = transaction_id;
+    mtpApp->cancel_pending        = true;
+    mtpApp->in_reset              = true;
 
-    mtpApp->in_reset = true;
+    // Retire transfers already queued in the controller, so the bus is released immediately
+    USB_DeviceClassMtpCancel(mtpApp->classHandle, USB_MTP_BULK_IN_ENDPOINT);
+    USB_DeviceClassMtpCancel(mtpApp->classHandle, USB_MTP_BULK_OUT_ENDPOINT);
+
+    // Wake up MTP task if it waits for incoming data. Message buffers block on
+    // task notification, so it returns with no data and sees the reset flag.
+    if (mtpApp->mtp_task_handle != NULL) {
+        xTaskNotifyFromISR(mtpApp->mtp_task_handle, 0, eNoAction, NULL);
+    }
+
+    log_debug("[MTP] Cancel transaction: 0x%x", (unsigned int)transaction_id);
     return kStatus_USB_Success;
 }
 
@@ -211,7 +301,8 @@ static usb_status_t OnGetStatus(usb_mtp_struct_t *mtpApp, void *param)
     usb_device_control_request_struct_t *request = (usb_device_control_request_struct_t *)param;
     uint16_t status                              = MTP_RESPONSE_OK;
     size_t event_length                          = 0;
-    if (mtpApp->in_reset || mtp_responder_data_transaction_open(mtpApp->responder)) {
+    // Busy until MTP task is done with cancellation, then host may issue next transaction
+    if (mtpApp->in_reset || mtpApp->cancel_pending || mtp_responder_data_transaction_open(mtpApp->responder)) {
         status = MTP_RESPONSE_DEVICE_BUSY;
     }
     mtp_responder_get_event(mtpApp->responder, status, event_response, &event_length);
@@ -261,6 +352,132 @@ static void send_response(usb_mtp_struct_t *mtpApp, uint16_t status)
     }
 }
 
+static void BoostPriority(usb_mtp_struct_t *mtpApp, size_t size)
+{
+    mtpApp->boost.last_data = xTaskGetTickCount();
+    if (mtpApp->boost.active || size < CONFIG_MTP_BOOST_MIN_SIZE) {
+        return;
+    }
+    vTaskPrioritySet(NULL, CONFIG_MTP_TASK_BOOST_PRIORITY);
+    mtpApp->boost.active = true;
+    mtpApp->boost.since  = mtpApp->boost.last_data;
+}
+
+static void RestorePriority(usb_mtp_struct_t *mtpApp, bool force)
+{
+    const TickType_t now = xTaskGetTickCount();
+    if (!mtpApp->boost.active) {
+        return;
+    }
+    if (!force && (now - mtpApp->boost.last_data) < pdMS_TO_TICKS(CONFIG_MTP_BOOST_HOLD_MS)) {
+        return;
+    }
+    vTaskPrioritySet(NULL, CONFIG_MTP_TASK_PRIORITY);
+    mtpApp->boost.active = false;
+    mtpApp->boost.total += now - mtpApp->boost.since;
+    log_debug("[MTP] Priority restored after %u ms boosted",
+              (unsigned int)((now - mtpApp->boost.since) * portTICK_PERIOD_MS));
+}
+
+static const mtp_progress_listener_t *ProgressListener(usb_mtp_struct_t *mtpApp)
+{
+    return __atomic_load_n(&mtpApp->progress.listener, __ATOMIC_ACQUIRE);
+}
+
+static void ProgressReport(usb_mtp_struct_t *mtpApp, mtp_progress_phase_t phase, TickType_t now)
+{
+    const mtp_progress_listener_t *listener = ProgressListener(mtpApp);
+    mtp_progress_t *report                  = &mtpApp->progress.report;
+    const TickType_t elapsed                = now - mtpApp->progress.since;
+
+    if (listener == NULL) {
+        return;
+    }
+    report->phase             = phase;
+    report->bytes_per_second  = elapsed ? (uint32_t)(report->bytes * configTICK_RATE_HZ / elapsed) : 0;
+    report->throttled_ms      = mtp_fs_throttled_time_ms(mtpApp->mtp_fs) - mtpApp->progress.throttled;
+    mtpApp->progress.reported = now;
+    listener->callback(listener->arg, report);
+}
+
+// Called once transaction has data phase. Nothing is tracked with no listener.
+static void ProgressStart(usb_mtp_struct_t *mtpApp)
+{
+    mtp_progress_t *report = &mtpApp->progress.report;
+
+    if (ProgressListener(mtpApp) == NULL) {
+        return;
+    }
+    report->operation          = mtp_responder_transaction_operation(mtpApp->responder, &report->handle);
+    report->status             = 0;
+    report->bytes              = 0;
+    report->total              = mtp_responder_data_transaction_size(mtpApp->responder);
+    mtpApp->progress.active    = true;
+    mtpApp->progress.since     = xTaskGetTickCount();
+    mtpApp->progress.throttled = mtp_fs_throttled_time_ms(mtpApp->mtp_fs);
+    ProgressReport(mtpApp, MTP_PROGRESS_START, mtpApp->progress.since);
+}
+
+static void ProgressMoved(usb_mtp_struct_t *mtpApp, size_t bytes)
+{
+    const mtp_progress_listener_t *listener;
+    TickType_t interval;
+    TickType_t now;
+
+    if (!mtpApp->progress.active) {
+        return;
+    }
+    mtpApp->progress.report.bytes += bytes;
+
+    if ((listener = ProgressListener(mtpApp)) == NULL) {
+        return;
+    }
+    interval = pdMS_TO_TICKS(listener->interval_ms ? listener->interval_ms : CONFIG_MTP_PROGRESS_INTERVAL_MS);
+    now      = xTaskGetTickCount();
+    if (now - mtpApp->progress.reported >= interval) {
+        ProgressReport(mtpApp, MTP_PROGRESS_DATA, now);
+    }
+}
+
+static void ProgressEnd(usb_mtp_struct_t *mtpApp, uint16_t status)
+{
+    if (!mtpApp->progress.active) {
+        return;
+    }
+    mtpApp->progress.active        = false;
+    mtpApp->progress.report.status = status;
+    ProgressReport(mtpApp, MTP_PROGRESS_END, xTaskGetTickCount());
+}
+
+// Interrupted uploads wait to be resumed, until staging timeout passes
+static void CollectStaged(usb_mtp_struct_t *mtpApp)
+{
+    mtp_responder_collect_staged(mtpApp->responder, xTaskGetTickCount() / configTICK_RATE_HZ);
+}
+
+// Files changed by phone apps show up on the host without enumerating storage
+// again. Host not reading interrupt endpoint doesn't hold the index back, its
+// events are dropped.
+static void ReportChanges(usb_mtp_struct_t *mtpApp)
+{
+    struct mtp_fs_change changes[CONFIG_MTP_EVENTS_PER_POLL];
+    const uint32_t count = mtp_fs_scan_changes(mtpApp->mtp_fs, changes, CONFIG_MTP_EVENTS_PER_POLL);
+
+    for (uint32_t i = 0; i < count && mtpApp->configured; i++) {
+        size_t length = 0;
+        int retries   = 3;
+        while (USB_DeviceClassMtpIsBusy(mtpApp->classHandle, USB_MTP_INTR_IN_ENDPOINT) && --retries) {
+            vTaskDelay(pdMS_TO_TICKS(1));
+        }
+        mtp_responder_get_object_event(mtpApp->responder, changes[i].event, changes[i].handle, object_event, &length);
+        if (length &&
+            USB_DeviceClassMtpSend(mtpApp->classHandle, USB_MTP_INTR_IN_ENDPOINT, object_event, length) !=
+                kStatus_USB_Success) {
+            log_debug("[MTP] Event 0x%04x of 0x%08x dropped", changes[i].event, (unsigned int)changes[i].handle);
+        }
+    }
+}
+
 static void poll_new_data(usb_mtp_struct_t *mtpApp, size_t *request_len)
 {
     do {
@@ -268,35 +485,59 @@ static void poll_new_data(usb_mtp_struct_t *mtpApp, size_t *request_len)
         RescheduleRecv(mtpApp);
         taskEXIT_CRITICAL();
         *request_len = xMessageBufferReceive(mtpApp->inputBox, mtp_request, sizeof(mtp_request), pdMS_TO_TICKS(100));
+        if (*request_len == 0) {
+            RestorePriority(mtpApp, false);
+            CollectStaged(mtpApp);
+            mtp_fs_close_idle(mtpApp->mtp_fs);
+            ReportChanges(mtpApp);
+        }
     } while (*request_len == 0 && !mtpApp->in_reset);
 }
 
+// Other tasks load the pointer in MtpForegroundActivity and MtpThrottledTimeMs,
+// it's cleared before the fs is freed
+static void FreeFs(usb_mtp_struct_t *mtpApp)
+{
+    struct mtp_fs *fs = mtpApp->mtp_fs;
+    __atomic_store_n(&mtpApp->mtp_fs, NULL, __ATOMIC_RELEASE);
+    mtp_fs_free(fs);
+}
+
 static void MtpTask(void *handle)
 {
     usb_mtp_struct_t *mtpApp = (usb_mtp_struct_t *)handle;
     mtp_responder_t *responder;
+    struct mtp_fs *fs;
 
-    if (!(mtpApp->mtp_fs = mtp_fs_alloc(mtpRootPath))) {
+    if (!(fs = mtp_fs_alloc(mtpRootPath, CONFIG_MTP_FS_IO))) {
         log_debug("[MTP] MTP FS initialization failed!");
         return;
     }
+    for (size_t i = 0; i < mtpApp->virtual_objects_count; i++) {
+        if (!mtp_fs_add_virtual(fs, &mtpApp->virtual_objects[i])) {
+            log_error("[MTP] Virtual object %s not added", mtpApp->virtual_objects[i].name);
+        }
+    }
+    // Published once initialized, other tasks may use it from now on
+    __atomic_store_n(&mtpApp->mtp_fs, fs, __ATOMIC_RELEASE);
 
     const mtp_device_info_t device = getDevice();
 
     mtp_responder_init(mtpApp->responder);
     if (mtp_responder_set_device_info(mtpApp->responder, &device)) {
         log_debug("[MTP] Invalid device info!");
-        mtp_fs_free(mtpApp->mtp_fs);
-        mtpApp->mtp_fs = NULL;
+        FreeFs(mtpApp);
         return;
     }
     mtp_responder_set_data_buffer(mtpApp->responder, mtp_response, sizeof(mtp_response));
-    mtp_responder_set_storage(mtpApp->responder, CONFIG_MTP_STORAGE_ID, &simple_fs_api, mtpApp->mtp_fs);
+    mtp_responder_set_storage(mtpApp->responder, CONFIG_MTP_STORAGE_ID, mtp_fs_api(mtpApp->mtp_fs), mtpApp->mtp_fs);
     mtp_responder_bind_storage_lock(mtpApp->responder, &mtpApp->is_storage_locked);
 
     responder = mtpApp->responder;
 
     while (!mtpApp->is_terminated) {
+        RestorePriority(mtpApp, true);
+        ProgressEnd(mtpApp, MTP_RESPONSE_TRANSACTION_CANCELLED);
         if (!mtpApp->configured) {
             log_debug("[MTP] Wait for configuration");
             xSemaphoreTake(mtpApp->configuring, portMAX_DELAY);
@@ -305,7 +546,14 @@ static void MtpTask(void *handle)
 
         xMessageBufferReset(mtpApp->inputBox);
         xMessageBufferReset(mtpApp->outputBox);
-        mtp_responder_transaction_reset(mtpApp->responder);
+        CollectStaged(mtpApp);
+        if (mtpApp->cancel_pending) {
+            mtp_responder_cancel_transaction(mtpApp->responder, mtpApp->cancel_transaction_id);
+            mtpApp->cancel_pending = false;
+        }
+        else {
+            mtp_responder_transaction_reset(mtpApp->responder);
+        }
 
         log_debug("[MTP] Ready");
 
@@ -315,6 +563,9 @@ static void MtpTask(void *handle)
             uint16_t status;
             size_t request_len;
             size_t result_len;
+            bool command;
+            bool aborted = false;
+            bool sending = false;
 
             poll_new_data(mtpApp, &request_len);
 
@@ -325,7 +576,12 @@ static void MtpTask(void *handle)
 
             // Incoming data transaction open:
             if (mtp_responder_data_transaction_open(responder)) {
+                BoostPriority(mtpApp, mtp_responder_data_transaction_size(responder));
                 status = mtp_responder_set_data(responder, mtp_request, request_len);
+                ProgressMoved(mtpApp, request_len);
+                if (status != 0) {
+                    ProgressEnd(mtpApp, status);
+                }
                 if (status == MTP_RESPONSE_INCOMPLETE_TRANSFER) {
                     // This happens with Linux (Nautilus) client. Cancelation procedure
                     // is to just stop sending data in this transaction.
@@ -345,13 +601,28 @@ static void MtpTask(void *handle)
                         log_debug("[MTP] Object is too large");
                         send_response(mtpApp, status);
                     }
+                    else if (status == MTP_RESPONSE_INVALID_DATASET) {
+                        log_debug("[MTP] Malformed compressed object or archive");
+                        send_response(mtpApp, status);
+                    }
                     continue;
                 }
             }
 
+            command = ((const mtp_cntr_hdr_t *)mtp_request)->type == MTP_CONTAINER_TYPE_COMMAND;
+            if (command) {
+                // Host gave up on data phase of previous transaction
+                ProgressEnd(mtpApp, MTP_RESPONSE_TRANSACTION_CANCELLED);
+            }
             status = mtp_responder_handle_request(responder, mtp_request, request_len);
+            if (!command) {
+                ProgressMoved(mtpApp, request_len);
+            }
 
             if (status != MTP_RESPONSE_UNDEFINED) {
+                if (status == MTP_RESPONSE_OK) {
+                    BoostPriority(mtpApp, mtp_responder_data_transaction_size(responder));
+                }
                 while ((result_len = mtp_responder_get_data(responder)) && !mtpApp->in_reset) {
 
                     if (!xMessageBufferIsEmpty(mtpApp->inputBox)) {
@@ -360,25 +631,42 @@ static void MtpTask(void *handle)
                         // with cancellation request.
                         log_debug("[MTP] incoming message during data transfer phase. Abort.");
                         mtp_responder_transaction_reset(mtpApp->responder);
-                        status = 0;
+                        status  = 0;
+                        aborted = true;
                         break;
                     }
 
+                    if (!sending) {
+                        ProgressStart(mtpApp);
+                        sending = true;
+                    }
                     if (!Send(mtpApp, mtp_response, result_len)) {
                         log_debug("[MTP] Outgoing data canceled (unable to send)");
                         mtpApp->in_reset = true;
                         break;
                     }
+                    ProgressMoved(mtpApp, result_len);
                 }
 
                 if (status && !mtpApp->in_reset) {
                     send_response(mtpApp, status);
                 }
+                if (aborted || mtpApp->in_reset) {
+                    ProgressEnd(mtpApp, MTP_RESPONSE_TRANSACTION_CANCELLED);
+                }
+                else if (status != 0) {
+                    ProgressEnd(mtpApp, status);
+                }
+                else if (command) {
+                    // Host sends data phase next
+                    ProgressStart(mtpApp);
+                }
             }
         }
     }
-    mtp_fs_free(mtpApp->mtp_fs);
-    mtpApp->mtp_fs = NULL;
+    RestorePriority(mtpApp, true);
+    ProgressEnd(mtpApp, MTP_RESPONSE_TRANSACTION_CANCELLED);
+    FreeFs(mtpApp);
     xSemaphoreGive(mtpApp->join);
     log_debug("[MTP] MTP task end");
     vTaskDelete(NULL);
@@ -389,7 +677,11 @@ usb_status_t MtpInit(usb_mtp_struct_t *mtpApp, class_handle_t classHandle, const
     mtpApp->configured          = false;
     mtpApp->is_terminated       = false;
     mtpApp->is_storage_locked   = mtpLockedAtInit;
+    mtpApp->cancel_pending      = false;
     mtpApp->classHandle         = classHandle;
+    mtpApp->boost.active        = false;
+    mtpApp->boost.total         = 0;
+    mtpApp->progress.active     = false;
 
     if ((mtpApp->join = xSemaphoreCreateBinary()) == NULL) {
         return kStatus_USB_AllocFail;
@@ -417,9 +709,9 @@ usb_status_t MtpInit(usb_mtp_struct_t *mtpApp, class_handle_t classHandle, const
 
     if (xTaskCreate(MtpTask,                                      /* pointer to the task */
                     "MTP task",                                   /* task name for kernel awareness debugging */
-                    MTP_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), /* task stack size */
+                    CONFIG_MTP_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), /* task stack size */
                     mtpApp,                                       /* optional task startup argument */
-                    tskIDLE_PRIORITY,                             /* initial priority */
+                    CONFIG_MTP_TASK_PRIORITY,                     /* initial priority */
                     &mtpApp->mtp_task_handle                      /* optional task handle to create */
                     ) != pdPASS) {
         log_debug("[MTP] Create task failed");
@@ -428,6 +720,40 @@ usb_status_t MtpInit(usb_mtp_struct_t *mtpApp, class_handle_t classHandle, const
     return kStatus_USB_Success;
 }
 
+uint32_t MtpBoostedTimeMs(usb_mtp_struct_t *mtpApp)
+{
+    TickType_t total = mtpApp->boost.total;
+    if (mtpApp->boost.active) {
+        total += xTaskGetTickCount() - mtpApp->boost.since;
+    }
+    return total * portTICK_PERIOD_MS;
+}
+
+void MtpSetProgressListener(usb_mtp_struct_t *mtpApp, const mtp_progress_listener_t *listener)
+{
+    __atomic_store_n(&mtpApp->progress.listener, listener, __ATOMIC_RELEASE);
+}
+
+void MtpForegroundActivity(usb_mtp_struct_t *mtpApp)
+{
+    struct mtp_fs *fs = __atomic_load_n(&mtpApp->mtp_fs, __ATOMIC_ACQUIRE);
+    if (fs != NULL) {
+        mtp_fs_foreground_activity(fs);
+    }
+}
+
+uint32_t MtpThrottledTimeMs(usb_mtp_struct_t *mtpApp)
+{
+    struct mtp_fs *fs = __atomic_load_n(&mtpApp->mtp_fs, __ATOMIC_ACQUIRE);
+    return (fs != NULL) ? mtp_fs_throttled_time_ms(fs) : 0;
+}
+
+void MtpSetVirtualObjects(usb_mtp_struct_t *mtpApp, const struct mtp_fs_virtual_object *objects, size_t count)
+{
+    mtpApp->virtual_objects       = objects;
+    mtpApp->virtual_objects_count = count;
+}
+
 void MtpDeinit(usb_mtp_struct_t *mtpApp)
 {
     if (!mtpApp->configured) {
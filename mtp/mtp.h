@@ -9,6 +9,32 @@
 #include "mtp_responder.h"
 #include "mtp_fs.h"
 
+/* Transfer progress, reported from MTP task for transactions with data phase */
+typedef enum {
+    MTP_PROGRESS_START,
+    MTP_PROGRESS_DATA,
+    MTP_PROGRESS_END,
+} mtp_progress_phase_t;
+
+typedef struct {
+    mtp_progress_phase_t phase;
+    uint16_t operation;
+    uint16_t status;            /* response code, at end only */
+    uint32_t handle;            /* object, 0 if operation has none */
+    uint64_t bytes;             /* moved so far, container headers included */
+    uint64_t total;             /* expected, 0 if not known */
+    uint32_t bytes_per_second;  /* average since start */
+    uint32_t throttled_ms;      /* writes held by I/O throttling since start */
+} mtp_progress_t;
+
+/* Callback runs in MTP task and holds the transfer, it shouldn't block.
+ * DATA reports come at most once per interval_ms. */
+typedef struct {
+    void (*callback)(void *arg, const mtp_progress_t *progress);
+    void *arg;
+    uint32_t interval_ms;
+} mtp_progress_listener_t;
+
 // refactor name to mtp_app_struct_t
 typedef struct {
     class_handle_t classHandle;
@@ -18,6 +44,8 @@ typedef struct {
     uint8_t configured;
     uint8_t in_reset;
     uint8_t is_terminated;
+    uint8_t cancel_pending;
+    uint32_t cancel_transaction_id;
     bool is_storage_locked;
     size_t usb_buffer_size;
     MessageBufferHandle_t inputBox;
@@ -25,6 +53,22 @@ typedef struct {
     SemaphoreHandle_t join;
     SemaphoreHandle_t configuring;
     TaskHandle_t mtp_task_handle; /* USB MTP task handle */
+    struct {
+        bool active;
+        TickType_t since;        /* when priority was raised */
+        TickType_t last_data;    /* last data phase activity */
+        TickType_t total;        /* time spent boosted, ticks */
+    } boost;
+    struct {
+        const mtp_progress_listener_t *listener; /* swapped atomically, NULL if none */
+        bool active;
+        mtp_progress_t report;
+        TickType_t since;
+        TickType_t reported;
+        uint32_t throttled;      /* throttled time of storage at start, ms */
+    } progress;
+    const struct mtp_fs_virtual_object *virtual_objects;
+    size_t virtual_objects_count;
 } usb_mtp_struct_t;
 
 usb_status_t MtpUSBCallback(uint32_t event, void *param, void *userArg);
@@ -33,5 +77,18 @@ void MtpReset(usb_mtp_struct_t *mtpApp, uint8_t speed);
 void MtpDeinit(usb_mtp_struct_t *mtpApp);
 void MtpDetached(usb_mtp_struct_t *mtpApp);
 void MtpUnlock(usb_mtp_struct_t *mtpApp);
+uint32_t MtpBoostedTimeMs(usb_mtp_struct_t *mtpApp);
+/* Set listener of transfer progress, NULL removes it. Safe to call from any
+ * task, no locks are taken. Replaced listener may still be in its callback
+ * when this returns, so it must stay valid a while longer. */
+void MtpSetProgressListener(usb_mtp_struct_t *mtpApp, const mtp_progress_listener_t *listener);
+/* Foreground services of the phone are busy, flash writes of MTP transfers
+ * get throttled for a while, see CONFIG_MTP_FS_THROTTLE_*. Safe to call from
+ * any task between MtpInit and MtpDeinit. */
+void MtpForegroundActivity(usb_mtp_struct_t *mtpApp);
+uint32_t MtpThrottledTimeMs(usb_mtp_struct_t *mtpApp);
+/* Objects listed along with files, content produced while host reads them.
+ * Call before MtpInit, objects must stay valid until MtpDeinit. */
+void MtpSetVirtualObjects(usb_mtp_struct_t *mtpApp, const struct mtp_fs_virtual_object *objects, size_t count);
 
 #endif /* _MTP_H_ */
@@ -0,0 +1,140 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <cerrno>
+#include <sys/stat.h>
+#include "log.hpp"
+#include "mtp_change_scanner.hpp"
+
+namespace mtp
+{
+    ChangeScanner::ChangeScanner(std::filesystem::path root, Filter hidden) : root(std::move(root)), hidden(hidden)
+    {}
+
+    ChangeScanner::~ChangeScanner()
+    {
+        if (dir != nullptr) {
+            closedir(dir);
+        }
+    }
+
+    bool ChangeScanner::step(std::size_t budget)
+    {
+        if (dir == nullptr) {
+            dir = opendir(root.c_str());
+            if (dir == nullptr) {
+                log_error("Change scanner: unable to open %s, errno %d", root.c_str(), errno);
+                return true;
+            }
+            for (auto &[filename, state] : known) {
+                state.seen = false;
+            }
+        }
+
+        for (; budget > 0; --budget) {
+            const auto entry = readdir(dir);
+            if (entry == nullptr) {
+                end_pass();
+                return true;
+            }
+            if (not hidden(entry->d_name)) {
+                visit(entry->d_name);
+            }
+        }
+        return false;
+    }
+
+    bool ChangeScanner::scanning() const
+    {
+        return dir != nullptr;
+    }
+
+    std::optional<FileChange> ChangeScanner::take()
+    {
+        if (changes.empty()) {
+            return std::nullopt;
+        }
+        auto change = std::move(changes.front());
+        changes.pop_front();
+        return change;
+    }
+
+    void ChangeScanner::update(const std::filesystem::path &filename)
+    {
+        drop_changes(filename);
+        State state{};
+        if (not read_state(filename, state)) {
+            forget(filename);
+            return;
+        }
+        state.seen      = true;
+        known[filename] = state;
+    }
+
+    void ChangeScanner::forget(const std::filesystem::path &filename)
+    {
+        drop_changes(filename);
+        known.erase(filename);
+    }
+
+    // Change made other way supersedes ones found before
+    void ChangeScanner::drop_changes(const std::filesystem::path &filename)
+    {
+        for (auto iter = changes.begin(); iter != changes.end();) {
+            iter = (iter->filename == filename) ? changes.erase(iter) : std::next(iter);
+        }
+    }
+
+    bool ChangeScanner::read_state(const std::filesystem::path &filename, State &state) const
+    {
+        struct stat statbuf
+        {};
+        if (stat((root / filename).c_str(), &statbuf) != 0 or not S_ISREG(statbuf.st_mode)) {
+            return false;
+        }
+        state.size     = static_cast<std::uint64_t>(statbuf.st_size);
+        state.modified = statbuf.st_mtim.tv_sec;
+        return true;
+    }
+
+    void ChangeScanner::visit(const char *name)
+    {
+        State current{};
+        if (not read_state(name, current)) {
+            return;
+        }
+        current.seen = true;
+
+        const auto [iter, inserted] = known.try_emplace(name, current);
+        if (inserted) {
+            if (primed) {
+                changes.push_back({FileChange::Kind::added, name});
+            }
+            return;
+        }
+        auto &state = iter->second;
+        if (state.size != current.size or state.modified != current.modified) {
+            changes.push_back({FileChange::Kind::modified, name});
+        }
+        state = current;
+    }
+
+    // Files not seen during the pass are gone
+    void ChangeScanner::end_pass()
+    {
+        closedir(dir);
+        dir = nullptr;
+        for (auto iter = known.begin(); iter != known.end();) {
+            if (iter->second.seen) {
+                ++iter;
+                continue;
+            }
+            changes.push_back({FileChange::Kind::removed, iter->first});
+            iter = known.erase(iter);
+        }
+        if (not primed) {
+            log_debug("Change scanner: %u files", static_cast<unsigned>(known.size()));
+        }
+        primed = true;
+    }
+} // namespace mtp
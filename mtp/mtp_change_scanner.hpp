@@ -0,0 +1,79 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <dirent.h>
+
+namespace mtp
+{
+    struct FileChange
+    {
+        enum class Kind
+        {
+            added,
+            removed,
+            modified,
+        };
+        Kind kind;
+        std::filesystem::path filename;
+    };
+
+    /// ChangeScanner finds files changed by other users of the filesystem, comparing size and modification time of
+    /// each file with the ones seen before. Directory is read a few entries per step, so the caller is never held
+    /// for long, and each pass over it ends with reporting files which weren't there. The first pass only learns
+    /// the files.
+    class ChangeScanner
+    {
+      public:
+        using Filter = bool (*)(const char *name);
+
+        ChangeScanner(std::filesystem::path root, Filter hidden);
+        ~ChangeScanner();
+        ChangeScanner(const ChangeScanner &) = delete;
+        ChangeScanner &operator=(const ChangeScanner &) = delete;
+
+        /// Read up to budget directory entries, starting a new pass if none is in progress. Returns true when the
+        /// pass ended.
+        bool step(std::size_t budget);
+
+        /// True while pass is in progress.
+        bool scanning() const;
+
+        /// Oldest change found and not taken yet.
+        std::optional<FileChange> take();
+
+        /// Take current state of the file as known, e.g. after it was written other way. Changes of the file
+        /// found before and not taken yet are dropped.
+        void update(const std::filesystem::path &filename);
+
+        /// Forget the file and its changes not taken yet, e.g. after it was removed other way.
+        void forget(const std::filesystem::path &filename);
+
+      private:
+        struct State
+        {
+            std::uint64_t size;
+            std::time_t modified;
+            bool seen;
+        };
+
+        bool read_state(const std::filesystem::path &filename, State &state) const;
+        void visit(const char *name);
+        void end_pass();
+        void drop_changes(const std::filesystem::path &filename);
+
+        std::filesystem::path root;
+        Filter hidden;
+        DIR *dir = nullptr;
+        bool primed = false;
+        std::map<std::filesystem::path, State> known;
+        std::deque<FileChange> changes;
+    };
+} // namespace mtp
@@ -0,0 +1,165 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "mtp_checksum.hpp"
+
+namespace mtp
+{
+    namespace
+    {
+        constexpr std::uint32_t crc32c_polynomial = 0x82F63B78U; // reflected 0x1EDC6F41
+
+        using SliceTables = std::array<std::array<std::uint32_t, 256>, 4>;
+
+        // Slicing-by-4: table n gives CRC of a byte followed by n zero bytes
+        constexpr SliceTables make_tables()
+        {
+            SliceTables tables{};
+            for (std::uint32_t i = 0; i < 256; i++) {
+                std::uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 1U) ? (crc >> 1) ^ crc32c_polynomial : (crc >> 1);
+                }
+                tables[0][i] = crc;
+            }
+            for (std::uint32_t i = 0; i < 256; i++) {
+                for (std::size_t slice = 1; slice < tables.size(); slice++) {
+                    const auto prev  = tables[slice - 1][i];
+                    tables[slice][i] = (prev >> 8) ^ tables[0][prev & 0xFFU];
+                }
+            }
+            return tables;
+        }
+
+        constexpr SliceTables tables = make_tables();
+
+        inline std::uint32_t update_byte(std::uint32_t crc, std::uint8_t byte)
+        {
+            return (crc >> 8) ^ tables[0][(crc ^ byte) & 0xFFU];
+        }
+
+        constexpr std::array<std::uint32_t, 64> sha256_rounds = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        inline std::uint32_t rotr(std::uint32_t value, unsigned bits)
+        {
+            return (value >> bits) | (value << (32U - bits));
+        }
+    } // namespace
+
+    std::uint32_t crc32c(std::uint32_t crc, const void *data, std::size_t length)
+    {
+        auto bytes = static_cast<const std::uint8_t *>(data);
+        crc        = ~crc;
+
+        while (length > 0 and (reinterpret_cast<std::uintptr_t>(bytes) & 3U) != 0) {
+            crc = update_byte(crc, *bytes++);
+            length--;
+        }
+        // Word at a time, little endian
+        while (length >= sizeof(std::uint32_t)) {
+            std::uint32_t word;
+            std::memcpy(&word, bytes, sizeof(word));
+            crc ^= word;
+            crc = tables[3][crc & 0xFFU] ^ tables[2][(crc >> 8) & 0xFFU] ^ tables[1][(crc >> 16) & 0xFFU] ^
+                  tables[0][crc >> 24];
+            bytes += sizeof(word);
+            length -= sizeof(word);
+        }
+        while (length > 0) {
+            crc = update_byte(crc, *bytes++);
+            length--;
+        }
+        return ~crc;
+    }
+
+    Sha256::Sha256()
+        : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+    {}
+
+    void Sha256::update(const void *data, std::size_t count)
+    {
+        auto bytes = static_cast<const std::uint8_t *>(data);
+        while (count > 0) {
+            const auto used  = static_cast<std::size_t>(length % block.size());
+            const auto chunk = std::min(block.size() - used, count);
+            std::memcpy(block.data() + used, bytes, chunk);
+            length += chunk;
+            bytes += chunk;
+            count -= chunk;
+            if (used + chunk == block.size()) {
+                transform(block.data());
+            }
+        }
+    }
+
+    Sha256::Digest Sha256::finish()
+    {
+        const auto bits         = length * 8;
+        const std::uint8_t pad  = 0x80;
+        const std::uint8_t zero = 0;
+        update(&pad, 1);
+        while (length % block.size() != block.size() - sizeof(bits)) {
+            update(&zero, 1);
+        }
+        std::uint8_t trailer[sizeof(bits)];
+        for (std::size_t i = 0; i < sizeof(bits); i++) {
+            trailer[i] = static_cast<std::uint8_t>(bits >> (8 * (sizeof(bits) - 1 - i)));
+        }
+        update(trailer, sizeof(trailer));
+
+        Digest digest;
+        for (std::size_t i = 0; i < digest.size(); i++) {
+            digest[i] = static_cast<std::uint8_t>(state[i / 4] >> (24 - 8 * (i % 4)));
+        }
+        return digest;
+    }
+
+    void Sha256::transform(const std::uint8_t *data)
+    {
+        std::uint32_t words[64];
+        for (int i = 0; i < 16; i++) {
+            words[i] = (std::uint32_t{data[4 * i]} << 24) | (std::uint32_t{data[4 * i + 1]} << 16) |
+                       (std::uint32_t{data[4 * i + 2]} << 8) | std::uint32_t{data[4 * i + 3]};
+        }
+        for (int i = 16; i < 64; i++) {
+            const auto s0 = rotr(words[i - 15], 7) ^ rotr(words[i - 15], 18) ^ (words[i - 15] >> 3);
+            const auto s1 = rotr(words[i - 2], 17) ^ rotr(words[i - 2], 19) ^ (words[i - 2] >> 10);
+            words[i]      = words[i - 16] + s0 + words[i - 7] + s1;
+        }
+
+        auto [a, b, c, d, e, f, g, h] = state;
+        for (int i = 0; i < 64; i++) {
+            const auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256_rounds[i] +
+                            words[i];
+            const auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h             = g;
+            g             = f;
+            f             = e;
+            e             = d + t1;
+            d             = c;
+            c             = b;
+            b             = a;
+            a             = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+} // namespace mtp
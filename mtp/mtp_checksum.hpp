@@ -0,0 +1,33 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace mtp
+{
+    /// Continue CRC32C (Castagnoli) over next chunk of data. Start with crc equal 0.
+    std::uint32_t crc32c(std::uint32_t crc, const void *data, std::size_t length);
+
+    /// SHA-256 of data given in chunks. Digest is taken once, after the last chunk.
+    class Sha256
+    {
+      public:
+        static constexpr std::size_t digest_size = 32;
+        using Digest                             = std::array<std::uint8_t, digest_size>;
+
+        Sha256();
+        void update(const void *data, std::size_t length);
+        Digest finish();
+
+      private:
+        void transform(const std::uint8_t *block);
+
+        std::array<std::uint32_t, 8> state;
+        std::array<std::uint8_t, 64> block{};
+        std::uint64_t length = 0;
+    };
+} // namespace mtp
@@ -37,18 +37,41 @@ namespace mtp
         if (handleToFilenameIter != handleToFilename.end()) {
             return handle_to_filename::getFilename(handleToFilenameIter);
         }
+        if (const auto stagedIter = staged.find(handle); stagedIter != staged.end()) {
+            return stagedIter->second;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<Handle> FileDatabase::get_handle(const char *filename) const
+    {
+        const auto filenameToHandleIter = filenameToHandle.find(filename);
+        if (filenameToHandleIter != filenameToHandle.end()) {
+            return filenameToHandleIter->second;
+        }
         return std::nullopt;
     }
     bool FileDatabase::remove(const Handle handle)
     {
+        if (staged.erase(handle) != 0) {
+            checksums.erase(handle);
+            stagedModified.erase(handle);
+            return true;
+        }
         const auto handleToFilenameIter = handleToFilename.find(handle);
         if (handleToFilenameIter == handleToFilename.end()) {
             return false;
         }
         filenameToHandle.erase(handle_to_filename::getIter(handleToFilenameIter));
         handleToFilename.erase(handleToFilenameIter);
+        checksums.erase(handle);
+        media.erase(handle);
         return true;
     }
+    std::size_t FileDatabase::remove(const Handle *handles, std::size_t count)
+    {
+        return std::count_if(handles, handles + count, [this](Handle handle) { return remove(handle); });
+    }
     Handle FileDatabase::insert_or_get(const char *filename)
     {
         const auto entry = filenameToHandle.emplace(filename, handle_idx);
@@ -72,8 +95,39 @@ namespace mtp
         ++handle_idx;
         return filename_to_handle::getHandle(entry.first);
     }
+    Handle FileDatabase::insert_staged(const char *filename)
+    {
+        staged.emplace(handle_idx, filename);
+        return handle_idx++;
+    }
+    bool FileDatabase::commit(const Handle handle)
+    {
+        const auto stagedIter = staged.find(handle);
+        if (stagedIter == staged.end()) {
+            return false;
+        }
+        const auto filename = stagedIter->second;
+        staged.erase(stagedIter);
+        stagedModified.erase(handle);
+
+        if (const auto filenameToHandleIter = filenameToHandle.find(filename);
+            filenameToHandleIter != filenameToHandle.end()) {
+            remove(filenameToHandleIter->second);
+        }
+        const auto entry = filenameToHandle.emplace(filename, handle);
+        handleToFilename.emplace(handle, entry.first);
+        return true;
+    }
+    bool FileDatabase::is_staged(const Handle handle) const
+    {
+        return staged.find(handle) != staged.end();
+    }
     bool FileDatabase::update(const Handle handle, const char *filename)
     {
+        if (const auto stagedIter = staged.find(handle); stagedIter != staged.end()) {
+            stagedIter->second = filename;
+            return true;
+        }
         const auto handleToFilenameIter = handleToFilename.find(handle);
         if (handleToFilenameIter == handleToFilename.end()) {
             return false;
@@ -86,4 +140,52 @@ namespace mtp
         handle_to_filename::getIter(handleToFilenameIter) = entry.first;
         return true;
     }
+    void FileDatabase::set_staged_modified(const Handle handle, const std::time_t modified)
+    {
+        if (is_staged(handle)) {
+            stagedModified[handle] = modified;
+        }
+    }
+    std::optional<std::time_t> FileDatabase::take_staged_modified(const Handle handle)
+    {
+        const auto modifiedIter = stagedModified.find(handle);
+        if (modifiedIter == stagedModified.end()) {
+            return std::nullopt;
+        }
+        const auto modified = modifiedIter->second;
+        stagedModified.erase(modifiedIter);
+        return modified;
+    }
+    void FileDatabase::set_checksum(const Handle handle, const std::uint32_t checksum)
+    {
+        if (handleToFilename.find(handle) != handleToFilename.end() or is_staged(handle)) {
+            checksums[handle] = checksum;
+        }
+    }
+    std::optional<std::uint32_t> FileDatabase::get_checksum(const Handle handle) const
+    {
+        const auto checksumIter = checksums.find(handle);
+        if (checksumIter != checksums.end()) {
+            return checksumIter->second;
+        }
+        return std::nullopt;
+    }
+    void FileDatabase::invalidate_checksum(const Handle handle)
+    {
+        checksums.erase(handle);
+    }
+    void FileDatabase::set_media(const Handle handle, MediaRecord record)
+    {
+        if (handleToFilename.find(handle) != handleToFilename.end()) {
+            media[handle] = std::move(record);
+        }
+    }
+    std::optional<MediaRecord> FileDatabase::get_media(const Handle handle) const
+    {
+        const auto mediaIter = media.find(handle);
+        if (mediaIter != media.end()) {
+            return mediaIter->second;
+        }
+        return std::nullopt;
+    }
 } // namespace mtp
@@ -3,9 +3,11 @@
 
 #pragma once
 
+#include <ctime>
 #include <map>
 #include <filesystem>
 #include <optional>
+#include "mtp_media_info.hpp"
 
 namespace mtp
 {
@@ -13,6 +15,14 @@ namespace mtp
     using PathToHandleMap      = std::map<std::filesystem::path, Handle>;
     using HandleToInteratorMap = std::map<Handle, std::map<std::filesystem::path, Handle>::iterator>;
 
+    /// Media metadata read from a file, valid while file's size and modification time stay the same
+    struct MediaRecord
+    {
+        MediaInfo info;
+        std::uint64_t size;
+        std::time_t modified;
+    };
+
     /// FileDatabase is a container used to store MTP object handles and corresponding data
     class FileDatabase
     {
@@ -20,9 +30,15 @@ namespace mtp
         /// Try to fetch entry's filename by handle.
         std::optional<std::filesystem::path> get_filename(Handle handle) const;
 
+        /// Try to fetch handle of visible entry by filename, without inserting it.
+        std::optional<Handle> get_handle(const char *filename) const;
+
         /// Try to remove entry by handle. Returns false in case of failure.
         bool remove(Handle handle);
 
+        /// Remove entries of all given handles. Returns number of removed entries.
+        std::size_t remove(const Handle *handles, std::size_t count);
+
         /// Try to insert entry with the specific filename. Returns existing handle if file exist and unique if it
         /// didn't exist.
         Handle insert_or_get(const char *filename);
@@ -30,13 +46,49 @@ namespace mtp
         /// Try to insert entry with the specific filename. Returns assigned unique index in case of success.
         Handle insert(const char *filename);
 
+        /// Reserve handle for an object being uploaded. Staged entry isn't found by filename, e.g. by
+        /// insert_or_get, until it's committed.
+        Handle insert_staged(const char *filename);
+
+        /// Make staged entry visible, replacing entry which held its filename so far. Returns false if entry isn't
+        /// staged.
+        bool commit(Handle handle);
+
+        /// Check if entry is staged.
+        bool is_staged(Handle handle) const;
+
+        /// Remember modification time to be given to staged entry's file once it's committed.
+        void set_staged_modified(Handle handle, std::time_t modified);
+
+        /// Fetch and forget modification time remembered for staged entry.
+        std::optional<std::time_t> take_staged_modified(Handle handle);
+
         /// Try to update specific entry by unique handle. Returns false in case of failure
         bool update(Handle handle, const char *filename);
 
+        /// Remember checksum of entry's whole content.
+        void set_checksum(Handle handle, std::uint32_t checksum);
+
+        /// Try to fetch checksum remembered for entry.
+        std::optional<std::uint32_t> get_checksum(Handle handle) const;
+
+        /// Forget checksum, e.g. when content is about to change.
+        void invalidate_checksum(Handle handle);
+
+        /// Remember media metadata read from entry's file.
+        void set_media(Handle handle, MediaRecord record);
+
+        /// Try to fetch media metadata remembered for entry.
+        std::optional<MediaRecord> get_media(Handle handle) const;
+
       private:
         Handle handle_idx = 1;
         PathToHandleMap filenameToHandle;
         HandleToInteratorMap handleToFilename;
+        std::map<Handle, std::uint32_t> checksums;
+        std::map<Handle, MediaRecord> media;
+        std::map<Handle, std::filesystem::path> staged;
+        std::map<Handle, std::time_t> stagedModified;
     };
 
 } // namespace mtp
@@ -9,11 +9,25 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/statvfs.h>
+#include <fcntl.h>
+#include <utime.h>
 #include "log.hpp"
 #include "mtp_db.hpp"
+#include "mtp_checksum.hpp"
+#include "mtp_hash_index.hpp"
+#include "mtp_uid_index.hpp"
+#include "mtp_read_cache.hpp"
+#include "mtp_change_scanner.hpp"
+#include "mtp_media_info.hpp"
+#include "mtp_search_index.hpp"
 #include "mtp_fs.h"
 #include <Utils.hpp>
 #include <filesystem>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "FreeRTOS.h"
+#include "task.h"
 
 extern "C"
 {
@@ -27,6 +41,44 @@ namespace
         return *static_cast<mtp::FileDatabase *>(raw);
     }
 
+    mtp::HashIndex &hash_index(const struct mtp_fs *fs)
+    {
+        return *static_cast<mtp::HashIndex *>(fs->hash_index);
+    }
+
+    mtp::UidIndex &uid_index(const struct mtp_fs *fs)
+    {
+        return *static_cast<mtp::UidIndex *>(fs->uid_index);
+    }
+
+    // nullptr when cache is disabled
+    mtp::ReadCache *read_cache(const struct mtp_fs *fs)
+    {
+        return static_cast<mtp::ReadCache *>(fs->read_cache);
+    }
+
+    mtp::ChangeScanner &scanner(const struct mtp_fs *fs)
+    {
+        return *static_cast<mtp::ChangeScanner *>(fs->scanner);
+    }
+
+    mtp::SearchIndex &search_index(const struct mtp_fs *fs)
+    {
+        return *static_cast<mtp::SearchIndex *>(fs->search_index);
+    }
+
+    std::vector<mtp::Handle> &search_results(const struct mtp_fs *fs)
+    {
+        return *static_cast<std::vector<mtp::Handle> *>(fs->search.results);
+    }
+
+    void forget_cached(const struct mtp_fs *fs, uint32_t handle)
+    {
+        if (const auto cache = read_cache(fs)) {
+            cache->invalidate(handle);
+        }
+    }
+
     mtp_storage_properties_t disk_properties = {
         .type        = MTP_STORAGE_FIXED_RAM,
         .fs_type     = MTP_STORAGE_FILESYSTEM_FLAT,
@@ -38,6 +90,12 @@ namespace
 
     constexpr auto bytes_per_mebibyte = 1024U * 1024U;
     constexpr auto iobuf_size         = 64U * 1024U;
+    // Files of the backend itself are kept in storage root but never listed
+    constexpr auto internal_prefix = MTP_STORAGE_RESERVED_PREFIX;
+    constexpr auto hash_index_name = ".mtp_hash_index";
+    constexpr auto uid_index_name  = ".mtp_uid_index";
+    // Uploads not committed yet, named after their handles
+    constexpr auto staged_prefix = ".mtp_staged_";
 
     bool is_dot(const char *name)
     {
@@ -48,13 +106,118 @@ namespace
         return ret;
     }
 
+    bool is_hidden(const char *name)
+    {
+        return is_dot(name) or strncmp(name, internal_prefix, strlen(internal_prefix)) == 0;
+    }
+
+    std::filesystem::path staged_name(uint32_t handle)
+    {
+        return staged_prefix + std::to_string(handle);
+    }
+
+    std::filesystem::path staged_path(const struct mtp_fs *fs, uint32_t handle)
+    {
+        return std::string(fs->root) / staged_name(handle);
+    }
+
+    // Name of object's file relative to root
+    std::filesystem::path stored_name(const struct mtp_fs *fs, uint32_t handle, const std::filesystem::path &filename)
+    {
+        if (from_raw(fs->db).is_staged(handle)) {
+            return staged_name(handle);
+        }
+        return filename;
+    }
+
+    std::filesystem::path object_path(const struct mtp_fs *fs, uint32_t handle, const std::filesystem::path &filename)
+    {
+        return std::string(fs->root) / stored_name(fs, handle, filename);
+    }
+
+    struct mtp_fs_virtual_entry *find_virtual(struct mtp_fs *fs, uint32_t handle)
+    {
+        for (auto &entry : fs->virtuals.objects) {
+            if (entry.handle != 0 and entry.handle == handle) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    bool is_virtual_name(const struct mtp_fs *fs, const char *name)
+    {
+        return std::any_of(std::begin(fs->virtuals.objects), std::end(fs->virtuals.objects), [name](const auto &entry) {
+            return entry.handle != 0 and strcmp(entry.object->name, name) == 0;
+        });
+    }
+
+    uint32_t count_virtual(const struct mtp_fs *fs)
+    {
+        return std::count_if(std::begin(fs->virtuals.objects),
+                             std::end(fs->virtuals.objects),
+                             [](const auto &entry) { return entry.handle != 0; });
+    }
+
+    // Virtual objects are listed ahead of files
+    uint32_t next_virtual(struct mtp_fs *fs)
+    {
+        while (fs->virtuals.listed < CONFIG_MTP_FS_VIRTUAL_OBJECTS) {
+            const auto &entry = fs->virtuals.objects[fs->virtuals.listed++];
+            if (entry.handle != 0) {
+                return entry.handle;
+            }
+        }
+        return 0;
+    }
+
+    // Staged uploads can't be resumed after restart, their handles are gone
+    void purge_staged(struct mtp_fs *fs)
+    {
+        const auto dir = opendir(fs->root);
+        if (dir == nullptr) {
+            return;
+        }
+        struct dirent *de;
+        while ((de = readdir(dir)) != nullptr) {
+            if (strncmp(de->d_name, staged_prefix, strlen(staged_prefix)) == 0) {
+                const auto path = std::string(fs->root) / std::filesystem::path(de->d_name);
+                if (unlink(path.c_str()) != 0) {
+                    log_error("Unable to remove %s, errno %d", path.c_str(), errno);
+                }
+                uid_index(fs).remove(de->d_name);
+            }
+        }
+        closedir(dir);
+    }
+
+    // Hash index knows visible files only, staged one doesn't affect it
+    void forget_content(struct mtp_fs *fs, uint32_t handle, const std::filesystem::path &filename)
+    {
+        if (not from_raw(fs->db).is_staged(handle)) {
+            hash_index(fs).remove(filename);
+        }
+    }
+
+    // Changes made through MTP aren't reported back to the host
+    void note_written(struct mtp_fs *fs, uint32_t handle)
+    {
+        if (handle == 0 or from_raw(fs->db).is_staged(handle)) {
+            return;
+        }
+        if (const auto filename = from_raw(fs->db).get_filename(handle)) {
+            scanner(fs).update(*filename);
+            search_index(fs).update(*filename);
+        }
+    }
+
     uint32_t count_files(DIR *find_data)
     {
         uint32_t count = 0;
         rewinddir(find_data);
         struct dirent *de;
         while ((de = readdir(find_data)) != nullptr) {
-            if (is_dot(de->d_name)) {
+            if (is_hidden(de->d_name)) {
                 continue;
             }
             count++;
@@ -62,24 +225,89 @@ namespace
         return count;
     }
 
-    const mtp_storage_properties_t *get_disk_properties(void *arg)
+    bool refresh_space(struct mtp_fs *fs)
     {
-        const auto fs = static_cast<struct mtp_fs *>(arg);
         struct statvfs stvfs
         {};
 
-        if (const auto ret = statvfs(fs->root, &stvfs); ret == 0) {
-            [[maybe_unused]] const auto freeSpace = stvfs.f_bavail * stvfs.f_bsize;
-            const auto capacity                   = stvfs.f_blocks * stvfs.f_bsize;
-            disk_properties.capacity              = capacity;
+        fs->space.timestamp = xTaskGetTickCount();
+        fs->space.ops       = 0;
 
-            log_debug("Capacity: %u MiB, free: %u MiB",
-                      static_cast<unsigned>(capacity / bytes_per_mebibyte),
-                      static_cast<unsigned>(freeSpace / bytes_per_mebibyte));
-        }
-        else {
+        if (const auto ret = statvfs(fs->root, &stvfs); ret != 0) {
             log_debug("Failed to vfsstat %s, error %d", fs->root, errno);
+            fs->space.free  = 0;
+            fs->space.valid = false;
+            return false;
+        }
+
+        fs->space.free     = static_cast<std::uint64_t>(stvfs.f_bavail) * stvfs.f_bsize;
+        fs->space.capacity = static_cast<std::uint64_t>(stvfs.f_blocks) * stvfs.f_bsize;
+        fs->space.block_size = stvfs.f_bsize;
+        fs->space.valid    = true;
+
+        log_debug("Capacity: %u MiB, free: %u MiB",
+                  static_cast<unsigned>(fs->space.capacity / bytes_per_mebibyte),
+                  static_cast<unsigned>(fs->space.free / bytes_per_mebibyte));
+        return true;
+    }
+
+    void ensure_space_fresh(struct mtp_fs *fs)
+    {
+        const auto age = xTaskGetTickCount() - fs->space.timestamp;
+        if (not fs->space.valid or fs->space.ops >= CONFIG_MTP_FS_FREE_SPACE_MAX_OPS or
+            age >= pdMS_TO_TICKS(CONFIG_MTP_FS_FREE_SPACE_MAX_AGE_MS)) {
+            refresh_space(fs);
+        }
+    }
+
+    void space_consumed(struct mtp_fs *fs, std::uint64_t bytes)
+    {
+        fs->space.free = (bytes < fs->space.free) ? fs->space.free - bytes : 0;
+    }
+
+    void space_released(struct mtp_fs *fs, std::uint64_t bytes)
+    {
+        fs->space.free += bytes;
+        if (fs->space.free > fs->space.capacity) {
+            fs->space.free = fs->space.capacity;
+        }
+    }
+
+    // Multiple of the cluster size, so stdio flushes full clusters only
+    size_t aligned_iobuf_size(const struct mtp_fs *fs)
+    {
+        const auto block = fs->space.block_size;
+        if (block == 0 or block >= iobuf_size) {
+            return (block == 0) ? iobuf_size : block;
+        }
+        return iobuf_size - (iobuf_size % block);
+    }
+
+    int preallocate(const std::string &path, std::uint64_t size)
+    {
+        const auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            log_error("Unable to create %s, errno %d", path.c_str(), errno);
+            return -1;
+        }
+        auto status = 0;
+        if (size > 0 and ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            log_error("Unable to preallocate %llu bytes for %s, errno %d", size, path.c_str(), errno);
+            status = -1;
+        }
+        close(fd);
+        if (status != 0) {
+            unlink(path.c_str());
         }
+        return status;
+    }
+
+    const mtp_storage_properties_t *get_disk_properties(void *arg)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+
+        ensure_space_fresh(fs);
+        disk_properties.capacity = fs->space.capacity;
 
         return &disk_properties;
     }
@@ -87,19 +315,11 @@ namespace
     uint64_t get_free_space(void *arg)
     {
         const auto fs = static_cast<struct mtp_fs *>(arg);
-        struct statvfs stvfs
-        {};
-        std::uint64_t freeSpace = 0;
 
-        if (const auto ret = statvfs(fs->root, &stvfs); ret == 0) {
-            freeSpace = stvfs.f_bavail * stvfs.f_bsize;
-            log_debug("Free space: %u MiB", static_cast<unsigned>(freeSpace / bytes_per_mebibyte));
-        }
-        else {
-            log_debug("Failed to vfsstat %s, error %d", fs->root, errno);
-        }
+        ensure_space_fresh(fs);
+        log_debug("Free space: %u MiB", static_cast<unsigned>(fs->space.free / bytes_per_mebibyte));
 
-        return freeSpace;
+        return fs->space.free;
     }
 
     uint32_t fs_find_first(void *arg, uint32_t root, uint32_t *count)
@@ -115,20 +335,29 @@ namespace
             return 0;
         }
 
+        // Reopened so the listing reflects files changed since the last one
+        if (fs->find_data != nullptr) {
+            closedir(fs->find_data);
+        }
         fs->find_data = opendir(fs->root);
         if (fs->find_data == nullptr) {
             log_error("Opendir failed");
             return 0;
         }
-        *count = count_files(fs->find_data);
-        log_debug("Found: %u files", static_cast<unsigned>(*count));
-        if (*count == 0) {
+        const auto files = count_files(fs->find_data);
+        log_debug("Found: %u files", static_cast<unsigned>(files));
+        rewinddir(fs->find_data);
+        fs->virtuals.listed = 0;
+        *count              = files + count_virtual(fs);
+        if (const auto handle = next_virtual(fs)) {
+            return handle;
+        }
+        if (files == 0) {
             return 0; // empty directory
         }
 
-        rewinddir(fs->find_data);
         struct dirent *de;
-        while (((de = readdir(fs->find_data)) != nullptr) && is_dot(de->d_name)) {
+        while (((de = readdir(fs->find_data)) != nullptr) && is_hidden(de->d_name)) {
             log_debug("Skip: '%s'", de->d_name);
         }
         if (de == nullptr) {
@@ -144,9 +373,12 @@ namespace
     uint32_t fs_find_next(void *arg)
     {
         const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (const auto handle = next_virtual(fs)) {
+            return handle;
+        }
         struct dirent *de;
         while ((de = readdir(fs->find_data)) != nullptr) {
-            if (is_dot(de->d_name)) {
+            if (is_hidden(de->d_name)) {
                 continue;
             }
             const auto new_handle = from_raw(fs->db).insert_or_get(de->d_name);
@@ -156,6 +388,23 @@ namespace
         return 0;
     }
 
+    uint32_t fs_find_batch(void *arg, uint32_t *out, uint32_t max)
+    {
+        const auto fs  = static_cast<struct mtp_fs *>(arg);
+        uint32_t found = 0;
+        for (uint32_t handle; found < max and (handle = next_virtual(fs)) != 0;) {
+            out[found++] = handle;
+        }
+        struct dirent *de;
+        while (found < max and (de = readdir(fs->find_data)) != nullptr) {
+            if (is_hidden(de->d_name)) {
+                continue;
+            }
+            out[found++] = from_raw(fs->db).insert_or_get(de->d_name);
+        }
+        return found;
+    }
+
     uint16_t ext_to_format_code(const char *name)
     {
         const auto extension          = std::filesystem::path(name).extension();
@@ -179,11 +428,33 @@ namespace
         return MTP_FORMAT_UNDEFINED;
     }
 
+    // Size is taken once per stat, read fills exactly that many bytes
+    int stat_virtual(struct mtp_fs *fs, struct mtp_fs_virtual_entry &entry, mtp_object_info_t *info)
+    {
+        const auto object = entry.object;
+        entry.size        = object->size(object->arg);
+
+        memset(info, 0, sizeof(mtp_object_info_t));
+        info->storage_id  = 0x00010001;
+        info->created     = std::time(nullptr);
+        info->modified    = info->created;
+        info->format_code = ext_to_format_code(object->name);
+        info->size        = entry.size;
+        const auto uid    = uid_index(fs).get(object->name);
+        memcpy(&info->uuid[0], &uid.serial, sizeof(uid.serial));
+        memcpy(&info->uuid[sizeof(uid.serial)], &uid.generation, sizeof(uid.generation));
+        strncpy(info->filename, object->name, sizeof(info->filename) - 1);
+        return 0;
+    }
+
     int fs_stat(void *arg, uint32_t handle, mtp_object_info_t *info)
     {
         struct stat statbuf
         {};
-        const auto fs       = static_cast<struct mtp_fs *>(arg);
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (const auto entry = find_virtual(fs, handle)) {
+            return stat_virtual(fs, *entry, info);
+        }
         const auto filename = from_raw(fs->db).get_filename(handle);
         if (not filename) {
             log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
@@ -191,16 +462,20 @@ namespace
         }
 
         log_debug("[%u]: get info for %s", static_cast<unsigned>(handle), filename->c_str());
-        const auto absolutePath = std::string(fs->root) / *filename;
+        const auto absolutePath = object_path(fs, handle, *filename);
 
         if (stat(absolutePath.c_str(), &statbuf) == 0) {
             memset(info, 0, sizeof(mtp_object_info_t));
-            info->storage_id                          = 0x00010001;
-            info->created                             = statbuf.st_ctim.tv_sec;
-            info->modified                            = statbuf.st_mtim.tv_sec;
-            info->format_code                         = ext_to_format_code(filename->c_str());
-            info->size                                = statbuf.st_size;
-            *reinterpret_cast<uint32_t *>(info->uuid) = handle;
+            info->storage_id  = 0x00010001;
+            info->created     = statbuf.st_ctim.tv_sec;
+            info->modified    = statbuf.st_mtim.tv_sec;
+            info->format_code = ext_to_format_code(filename->c_str());
+            info->size        = statbuf.st_size;
+            info->checksum    = from_raw(fs->db).get_checksum(handle).value_or(0);
+            // Handles change with every session, identity of the file doesn't
+            const auto uid = uid_index(fs).get(stored_name(fs, handle, *filename));
+            memcpy(&info->uuid[0], &uid.serial, sizeof(uid.serial));
+            memcpy(&info->uuid[sizeof(uid.serial)], &uid.generation, sizeof(uid.generation));
 
             strncpy(info->filename, filename->c_str(), sizeof(info->filename));
             return 0;
@@ -210,6 +485,220 @@ namespace
         return -1;
     }
 
+    std::optional<mtp::MediaFormat> media_format(uint16_t format_code)
+    {
+        switch (format_code) {
+        case MTP_FORMAT_MP3:
+            return mtp::MediaFormat::mp3;
+        case MTP_FORMAT_FLAC:
+            return mtp::MediaFormat::flac;
+        case MTP_FORMAT_WAV:
+            return mtp::MediaFormat::wav;
+        case MTP_FORMAT_EXIF_JPEG:
+            return mtp::MediaFormat::jpeg;
+        default:
+            return std::nullopt;
+        }
+    }
+
+    void copy_text(char (&field)[MTP_MEDIA_TEXT_LENGTH], const std::string &text)
+    {
+        auto length = std::min(text.size(), sizeof(field) - 1);
+        // Don't cut UTF-8 sequence
+        while (length < text.size() and length > 0 and (text[length] & 0xc0) == 0x80) {
+            --length;
+        }
+        memcpy(field, text.data(), length);
+        field[length] = '\0';
+    }
+
+    // Headers are read once, host asks for each property separately and
+    // library views ask for all files
+    int fs_get_media_info(void *arg, uint32_t handle, mtp_media_info_t *media)
+    {
+        const auto fs       = static_cast<struct mtp_fs *>(arg);
+        const auto filename = from_raw(fs->db).get_filename(handle);
+        if (not filename or from_raw(fs->db).is_staged(handle)) {
+            return -1;
+        }
+        const auto format = media_format(ext_to_format_code(filename->c_str()));
+        if (not format) {
+            return -1;
+        }
+        const auto absolutePath = std::string(fs->root) / *filename;
+        struct stat statbuf
+        {};
+        if (stat(absolutePath.c_str(), &statbuf) != 0) {
+            return -1;
+        }
+
+        auto record = from_raw(fs->db).get_media(handle);
+        if (not record or record->size != static_cast<std::uint64_t>(statbuf.st_size) or
+            record->modified != statbuf.st_mtim.tv_sec) {
+            const auto file = std::fopen(absolutePath.c_str(), "rb");
+            if (file == nullptr) {
+                log_error("[%u]: unable to open %s, errno %d", static_cast<unsigned>(handle), filename->c_str(), errno);
+                return -1;
+            }
+            record = mtp::MediaRecord{
+                mtp::read_media_info(file, statbuf.st_size, *format, CONFIG_MTP_FS_MEDIA_READ_LIMIT),
+                static_cast<std::uint64_t>(statbuf.st_size),
+                statbuf.st_mtim.tv_sec};
+            std::fclose(file);
+            from_raw(fs->db).set_media(handle, *record);
+            log_debug("[%u]: media info read", static_cast<unsigned>(handle));
+        }
+
+        memset(media, 0, sizeof(mtp_media_info_t));
+        copy_text(media->artist, record->info.artist);
+        copy_text(media->album, record->info.album);
+        copy_text(media->album_artist, record->info.albumArtist);
+        copy_text(media->genre, record->info.genre);
+        media->duration = record->info.duration;
+        media->track    = record->info.track;
+        media->width    = record->info.width;
+        media->height   = record->info.height;
+        return 0;
+    }
+
+    // Virtual objects have no files to index, they're checked one by one
+    uint32_t fs_search(void *arg, const mtp_search_query_t *query)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        mtp::SearchQuery wanted;
+        // Same order as MTP_SEARCH_NAME_*
+        wanted.nameMatch    = static_cast<mtp::SearchQuery::NameMatch>(query->name_match);
+        wanted.name         = query->name;
+        wanted.format       = query->format_code;
+        wanted.sizeMin      = query->size_min;
+        wanted.sizeMax      = query->size_max;
+        wanted.modifiedFrom = query->modified_from;
+        wanted.modifiedTo   = query->modified_to;
+
+        auto &results = search_results(fs);
+        results.clear();
+        fs->search.taken = 0;
+        for (const auto &entry : fs->virtuals.objects) {
+            if (entry.handle != 0 and mtp::SearchIndex::matches(wanted,
+                                                                 entry.object->name,
+                                                                 entry.object->size(entry.object->arg),
+                                                                 std::time(nullptr),
+                                                                 ext_to_format_code(entry.object->name))) {
+                results.push_back(entry.handle);
+            }
+        }
+        for (const auto &filename : search_index(fs).find(wanted)) {
+            if (is_virtual_name(fs, filename.c_str())) {
+                continue;
+            }
+            if (const auto handle = from_raw(fs->db).insert_or_get(filename.c_str())) {
+                results.push_back(handle);
+            }
+        }
+        log_debug("[]: search found %u objects", static_cast<unsigned>(results.size()));
+        return results.size();
+    }
+
+    uint32_t fs_search_batch(void *arg, uint32_t *out, uint32_t max)
+    {
+        const auto fs       = static_cast<struct mtp_fs *>(arg);
+        const auto &results = search_results(fs);
+        const auto count    = std::min<std::size_t>(max, results.size() - fs->search.taken);
+        std::copy_n(results.begin() + fs->search.taken, count, out);
+        fs->search.taken += count;
+        return count;
+    }
+
+    void close_kept(struct mtp_fs_open_file &entry)
+    {
+        if (entry.handle == 0) {
+            return;
+        }
+        if (entry.file != nullptr) {
+            std::fclose(entry.file);
+        }
+        else {
+            close(entry.fd);
+        }
+        delete[] entry.iobuf;
+        entry = {};
+    }
+
+    void forget_kept(struct mtp_fs *fs, uint32_t handle)
+    {
+        for (auto &entry : fs->kept.files) {
+            if (entry.handle == handle) {
+                close_kept(entry);
+            }
+        }
+    }
+
+    // Whatever object is stored under the name, its file is about to be replaced
+    void forget_kept(struct mtp_fs *fs, const std::filesystem::path &filename)
+    {
+        for (auto &entry : fs->kept.files) {
+            if (entry.handle == 0) {
+                continue;
+            }
+            if (const auto name = from_raw(fs->db).get_filename(entry.handle); not name or *name == filename) {
+                close_kept(entry);
+            }
+        }
+    }
+
+    // Kept file is used only while it's still the one under its path, as other users of the filesystem could
+    // replace or change it meanwhile
+    bool take_kept(struct mtp_fs *fs, uint32_t handle, const std::string &path, struct mtp_fs_open_file &taken)
+    {
+        for (auto &entry : fs->kept.files) {
+            if (entry.handle != handle) {
+                continue;
+            }
+            struct stat pathStat
+            {};
+            struct stat openStat
+            {};
+            const auto fd    = (entry.file != nullptr) ? fileno(entry.file) : entry.fd;
+            const bool fresh = stat(path.c_str(), &pathStat) == 0 and fstat(fd, &openStat) == 0 and
+                               pathStat.st_dev == openStat.st_dev and pathStat.st_ino == openStat.st_ino and
+                               pathStat.st_size == openStat.st_size and
+                               pathStat.st_mtim.tv_sec == openStat.st_mtim.tv_sec;
+            if (not fresh or (entry.file != nullptr and std::fseek(entry.file, 0, SEEK_SET) != 0)) {
+                close_kept(entry);
+                return false;
+            }
+            if (entry.file != nullptr) {
+                clearerr(entry.file);
+            }
+            taken = entry;
+            entry = {};
+            return true;
+        }
+        return false;
+    }
+
+    // File read through is kept for following transactions in place of the least recently used one
+    bool park(struct mtp_fs *fs, FILE *file, char *iobuf, int fd)
+    {
+        if (not fs->kept.reusable or fs->kept.handle == 0) {
+            return false;
+        }
+        const auto now = xTaskGetTickCount();
+        auto oldest    = &fs->kept.files[0];
+        for (auto &entry : fs->kept.files) {
+            if (entry.handle == 0) {
+                oldest = &entry;
+                break;
+            }
+            if (now - entry.parked > now - oldest->parked) {
+                oldest = &entry;
+            }
+        }
+        close_kept(*oldest);
+        *oldest = {fs->kept.handle, file, iobuf, fd, now};
+        return true;
+    }
+
     int fs_rename(void *arg, uint32_t handle, const char *new_name)
     {
         const auto fs       = static_cast<struct mtp_fs *>(arg);
@@ -218,10 +707,25 @@ namespace
             log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
             return -1;
         }
+        if (find_virtual(fs, handle) != nullptr or is_virtual_name(fs, new_name)) {
+            log_error("[%u]: virtual object can't be renamed or replaced", static_cast<unsigned>(handle));
+            return -1;
+        }
+        if (is_hidden(new_name)) {
+            log_error("[%u]: reserved name: %s", static_cast<unsigned>(handle), new_name);
+            return -1;
+        }
+
+        // Staged file is named after its handle, there's nothing to move
+        if (from_raw(fs->db).is_staged(handle)) {
+            return from_raw(fs->db).update(handle, new_name) ? 0 : -1;
+        }
 
         const auto old_abs = std::string(fs->root) / *filename;
         const auto new_abs = std::string(fs->root) / std::filesystem::path(new_name);
 
+        forget_kept(fs, handle);
+        forget_kept(fs, std::filesystem::path(new_name));
         if (const auto status = rename(old_abs.c_str(), new_abs.c_str()); status != 0) {
             log_error("[%u]: rename: %s -> %s FAILED, err: %d",
                       static_cast<unsigned>(handle),
@@ -234,21 +738,68 @@ namespace
             log_error("[%u]: invalid handle, new name %s", static_cast<unsigned>(handle), new_name);
             return -1;
         }
+        hash_index(fs).rename(*filename, new_name);
+        uid_index(fs).rename(*filename, new_name);
+        forget_cached(fs, handle);
+        scanner(fs).forget(*filename);
+        scanner(fs).update(new_name);
+        search_index(fs).forget(*filename);
+        search_index(fs).update(new_name);
 
         log_debug("[%u]: rename: %s -> %s", static_cast<unsigned>(handle), old_abs.c_str(), new_abs.c_str());
         return 0;
     }
 
+    // Object preallocated on create was never opened for writing, its data isn't coming
+    void release_preallocated(struct mtp_fs *fs)
+    {
+        if (fs->prealloc.handle == 0) {
+            return;
+        }
+        if (truncate(staged_path(fs, fs->prealloc.handle).c_str(), 0) == 0) {
+            space_released(fs, fs->prealloc.size);
+            log_debug("[%u]: preallocation released", static_cast<unsigned>(fs->prealloc.handle));
+        }
+        fs->prealloc.handle = 0;
+        fs->prealloc.size   = 0;
+    }
+
     int fs_create(void *arg, const mtp_object_info_t *info, uint32_t *handle)
     {
         const auto fs = static_cast<struct mtp_fs *>(arg);
 
+        release_preallocated(fs);
+        if (is_virtual_name(fs, info->filename)) {
+            log_error("Name of virtual object is taken: %s", info->filename);
+            return -1;
+        }
+        // Such file is storage's own, committing the object would replace it
+        if (is_hidden(info->filename)) {
+            log_error("Reserved name: %s", info->filename);
+            return -1;
+        }
         if (const auto freeSpace = get_free_space(arg); freeSpace < info->size) {
             log_error("There is not enough space for file %s (%llu < %llu)", info->filename, freeSpace, info->size);
             return -1;
         }
-        if (const auto new_handle = from_raw(fs->db).insert(info->filename)) {
+        // Content goes to a staged file first, it replaces visible one on commit
+        if (const auto new_handle = from_raw(fs->db).insert_staged(info->filename)) {
             log_debug("[%lu]: created: %s", static_cast<unsigned long>(new_handle), info->filename);
+            ++fs->space.ops;
+            if (info->modified != 0) {
+                from_raw(fs->db).set_staged_modified(new_handle, info->modified);
+            }
+            // Object size 0xFFFFFFFF means "4 GiB or more", actual size isn't known
+            if (info->size < UINT32_MAX) {
+                const auto absolutePath = staged_path(fs, new_handle);
+                if (preallocate(absolutePath, info->size) != 0) {
+                    from_raw(fs->db).remove(new_handle);
+                    return -1;
+                }
+                space_consumed(fs, info->size);
+                fs->prealloc.handle = new_handle;
+                fs->prealloc.size   = info->size;
+            }
             *handle = new_handle;
             return 0;
         }
@@ -256,51 +807,661 @@ namespace
         return -1;
     }
 
-    int fs_remove(void *arg, uint32_t handle)
+    // Returns true when object's file no longer exists
+    bool unlink_object(struct mtp_fs *fs, uint32_t handle)
     {
-        const auto fs       = static_cast<struct mtp_fs *>(arg);
         const auto filename = from_raw(fs->db).get_filename(handle);
         if (not filename) {
             log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
-            return -1;
+            return false;
         }
-        const auto absolutePath = std::string(fs->root) / *filename;
-
-        unlink(absolutePath.c_str());
+        if (find_virtual(fs, handle) != nullptr) {
+            log_error("[%u]: virtual object can't be removed", static_cast<unsigned>(handle));
+            return false;
+        }
+        const auto absolutePath = object_path(fs, handle, *filename);
+        struct stat statbuf
+        {};
+        const bool sized = stat(absolutePath.c_str(), &statbuf) == 0;
 
+        if (handle == fs->prealloc.handle) {
+            fs->prealloc.handle = 0;
+            fs->prealloc.size   = 0;
+        }
+        forget_kept(fs, handle);
+        if (unlink(absolutePath.c_str()) != 0) {
+            const auto error = errno;
+            log_error("[%u]: unable to remove %s, errno %d",
+                      static_cast<unsigned>(handle),
+                      absolutePath.c_str(),
+                      error);
+            if (error != ENOENT) {
+                return false;
+            }
+            forget_content(fs, handle, *filename);
+            uid_index(fs).remove(stored_name(fs, handle, *filename));
+            forget_cached(fs, handle);
+            scanner(fs).forget(*filename);
+            search_index(fs).forget(*filename);
+            return true;
+        }
+        forget_content(fs, handle, *filename);
+        uid_index(fs).remove(stored_name(fs, handle, *filename));
+        forget_cached(fs, handle);
+        if (not from_raw(fs->db).is_staged(handle)) {
+            scanner(fs).forget(*filename);
+            search_index(fs).forget(*filename);
+        }
+        if (sized) {
+            space_released(fs, statbuf.st_size);
+        }
         log_debug("[%u]: removed: %s", static_cast<unsigned>(handle), absolutePath.c_str());
-        from_raw(fs->db).remove(handle);
-        return 0;
+        return true;
     }
 
-    int fs_open(void *arg, uint32_t handle, const char *mode)
+    int fs_remove(void *arg, uint32_t handle)
     {
-        const auto fs       = static_cast<struct mtp_fs *>(arg);
-        const auto filename = from_raw(fs->db).get_filename(handle);
-        if (not filename) {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (not from_raw(fs->db).get_filename(handle)) {
             log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
             return -1;
         }
-
-        const auto absolutePath = std::string(fs->root) / *filename;
-        fs->file                = std::fopen(absolutePath.c_str(), mode);
-        if (fs->file == nullptr) {
-            log_error("[%u]: fail to open: %s [%s]. Flush and wait",
+        if (find_virtual(fs, handle) != nullptr) {
+            log_error("[%u]: virtual object can't be removed", static_cast<unsigned>(handle));
+            return -1;
+        }
+        unlink_object(fs, handle);
+        ++fs->space.ops;
+        from_raw(fs->db).remove(handle);
+        return 0;
+    }
+
+    uint32_t fs_remove_batch(void *arg, const uint32_t *handles, uint32_t count)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        std::vector<mtp::Handle> removed;
+        removed.reserve(count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (unlink_object(fs, handles[i])) {
+                removed.push_back(handles[i]);
+            }
+        }
+        ++fs->space.ops;
+        from_raw(fs->db).remove(removed.data(), removed.size());
+        log_debug("[]: removed %u of %u objects",
+                  static_cast<unsigned>(removed.size()),
+                  static_cast<unsigned>(count));
+        return removed.size();
+    }
+
+    // Don't truncate what was preallocated on create, write over it
+    const char *prepare_open(struct mtp_fs *fs, uint32_t handle, const char *mode)
+    {
+        fs->checksum.writing = mode[0] != 'r' or strchr(mode, '+') != nullptr;
+        fs->throttle.buffered = 0;
+        fs->offset           = 0;
+        fs->reading.handle   = 0;
+        fs->reading.seek     = false;
+        fs->kept.handle      = handle;
+        fs->kept.reusable    = not fs->checksum.writing;
+        if (fs->checksum.writing) {
+            forget_kept(fs, handle);
+            forget_cached(fs, handle);
+            from_raw(fs->db).invalidate_checksum(handle);
+            if (const auto filename = from_raw(fs->db).get_filename(handle)) {
+                forget_content(fs, handle, *filename);
+            }
+        }
+
+        // Reading other objects meanwhile keeps the preallocation for SendObject
+        if (mode[0] == 'w' and handle == fs->prealloc.handle) {
+            mode = "r+";
+        }
+        else if (fs->checksum.writing) {
+            release_preallocated(fs);
+        }
+        fs->prealloc.written = 0;
+        return mode;
+    }
+
+    // Cached blocks of file changed other way than through MTP are dropped
+    void begin_cached_read(struct mtp_fs *fs, uint32_t handle, int fd)
+    {
+        struct stat statbuf
+        {};
+        const auto cache = read_cache(fs);
+        if (cache == nullptr or fs->checksum.writing or fstat(fd, &statbuf) != 0) {
+            return;
+        }
+        cache->validate(handle, statbuf.st_size, statbuf.st_mtim.tv_sec);
+        fs->reading.handle = handle;
+    }
+
+    // Serves beginning of the object from cache, reading whole blocks into it on miss. Returns number of bytes
+    // copied to buffer, the rest is read from the file.
+    size_t cached_read(struct mtp_fs *fs, int fd, char *buffer, size_t count)
+    {
+        const auto cache = read_cache(fs);
+        size_t done      = 0;
+        if (cache == nullptr or fs->reading.handle == 0) {
+            return 0;
+        }
+
+        while (done < count and fs->offset < CONFIG_MTP_FS_READ_CACHE_PREFIX) {
+            auto copied = cache->read(fs->reading.handle, fs->offset, buffer + done, count - done);
+            if (copied == 0) {
+                const auto blockOffset = fs->offset - fs->offset % cache->block_size();
+                const auto block       = cache->prepare(fs->reading.handle, blockOffset);
+                const auto read        = pread(fd, block, cache->block_size(), static_cast<off_t>(blockOffset));
+                const auto skipped     = static_cast<ssize_t>(fs->offset - blockOffset);
+                if (read <= skipped) {
+                    // End of file or error, reading the file tells which
+                    break;
+                }
+                cache->fill(read);
+                copied = std::min(count - done, static_cast<size_t>(read - skipped));
+                memcpy(buffer + done, block + skipped, copied);
+            }
+            done += copied;
+            fs->offset += copied;
+        }
+        fs->reading.seek = fs->reading.seek or done != 0;
+        return done;
+    }
+
+    void end_cached_read(struct mtp_fs *fs)
+    {
+        if (fs->reading.handle != 0) {
+            log_debug("[%u]: read cache hits %u, misses %u",
+                      static_cast<unsigned>(fs->reading.handle),
+                      static_cast<unsigned>(read_cache(fs)->hits()),
+                      static_cast<unsigned>(read_cache(fs)->misses()));
+            fs->reading.handle = 0;
+        }
+    }
+
+    void account_write(struct mtp_fs *fs, size_t count)
+    {
+        const auto end = fs->prealloc.written + count;
+        if (end > fs->prealloc.size) {
+            space_consumed(fs, end - std::max(fs->prealloc.written, fs->prealloc.size));
+        }
+        fs->prealloc.written = end;
+    }
+
+    constexpr std::int64_t throttle_depth(std::uint32_t rate)
+    {
+        return static_cast<std::int64_t>(rate) * pdMS_TO_TICKS(CONFIG_MTP_FS_THROTTLE_BURST_MS);
+    }
+
+    bool foreground_active(const struct mtp_fs *fs, TickType_t now)
+    {
+        if (not __atomic_load_n(&fs->throttle.signalled, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const auto since = now - __atomic_load_n(&fs->throttle.foreground, __ATOMIC_RELAXED);
+        return since < pdMS_TO_TICKS(CONFIG_MTP_FS_THROTTLE_HOLD_MS);
+    }
+
+    // Ticks needed to pay off bucket's debt
+    TickType_t throttle_wait(std::int64_t tokens, std::uint32_t rate)
+    {
+        return (rate == 0 or tokens >= 0) ? 0 : static_cast<TickType_t>((-tokens + rate - 1) / rate);
+    }
+
+    // Tokens are scaled by tick rate, so a tick refills bucket with its rate. Buckets stay full while foreground
+    // is idle, writes throttled later start with a burst. Bytes are charged as they come, writes only when they
+    // reach flash.
+    void throttle_write(struct mtp_fs *fs, size_t count, std::uint32_t writes)
+    {
+        auto &throttle     = fs->throttle;
+        const auto now     = xTaskGetTickCount();
+        const auto elapsed = now - throttle.refilled;
+        throttle.refilled  = now;
+
+        constexpr auto bytesDepth  = throttle_depth(CONFIG_MTP_FS_THROTTLE_BYTES_PER_SEC);
+        constexpr auto writesDepth = throttle_depth(CONFIG_MTP_FS_THROTTLE_WRITES_PER_SEC);
+        if (not foreground_active(fs, now)) {
+            throttle.bytes  = bytesDepth;
+            throttle.writes = writesDepth;
+            return;
+        }
+        throttle.bytes =
+            std::min(bytesDepth, throttle.bytes + std::int64_t{elapsed} * CONFIG_MTP_FS_THROTTLE_BYTES_PER_SEC);
+        throttle.writes =
+            std::min(writesDepth, throttle.writes + std::int64_t{elapsed} * CONFIG_MTP_FS_THROTTLE_WRITES_PER_SEC);
+        throttle.bytes -= static_cast<std::int64_t>(count) * configTICK_RATE_HZ;
+        throttle.writes -= static_cast<std::int64_t>(writes) * configTICK_RATE_HZ;
+
+        const auto wait = std::max(throttle_wait(throttle.bytes, CONFIG_MTP_FS_THROTTLE_BYTES_PER_SEC),
+                                   throttle_wait(throttle.writes, CONFIG_MTP_FS_THROTTLE_WRITES_PER_SEC));
+        if (wait > 0) {
+            // Debt is paid off by refill of the next write
+            vTaskDelay(wait);
+            throttle.held += wait;
+        }
+    }
+
+    // Host sent less than announced, drop preallocated tail
+    void trim_preallocated(struct mtp_fs *fs, int fd)
+    {
+        if (not fs->checksum.writing or fs->prealloc.handle == 0 or fs->prealloc.handle != fs->kept.handle) {
+            return;
+        }
+        if (fs->prealloc.written < fs->prealloc.size) {
+            if (ftruncate(fd, static_cast<off_t>(fs->prealloc.written)) == 0) {
+                space_released(fs, fs->prealloc.size - fs->prealloc.written);
+            }
+        }
+        fs->prealloc.handle = 0;
+        fs->prealloc.size   = 0;
+    }
+
+    // Checksum is computed over data as it goes through read/write, so a
+    // complete upload or download leaves it in database for free
+    void checksum_begin(struct mtp_fs *fs, uint32_t handle, const char *mode, int fd)
+    {
+        struct stat statbuf
+        {};
+        // Appended data alone doesn't give checksum of whole content
+        fs->checksum.handle = (mode[0] == 'a') ? 0 : handle;
+        fs->checksum.crc    = 0;
+        fs->checksum.length = 0;
+        fs->checksum.size   = 0;
+        if (not fs->checksum.writing and fstat(fd, &statbuf) == 0) {
+            fs->checksum.size = statbuf.st_size;
+        }
+    }
+
+    void checksum_update(struct mtp_fs *fs, const void *data, size_t count)
+    {
+        if (fs->checksum.handle != 0) {
+            fs->checksum.crc = mtp::crc32c(fs->checksum.crc, data, count);
+            fs->checksum.length += count;
+        }
+    }
+
+    // Returns handle of object which got its checksum, 0 if none
+    uint32_t checksum_end(struct mtp_fs *fs)
+    {
+        auto handle = fs->checksum.handle;
+        if (handle != 0 and (fs->checksum.writing or fs->checksum.length == fs->checksum.size)) {
+            from_raw(fs->db).set_checksum(handle, fs->checksum.crc);
+            log_debug("[%u]: crc32c %08x", static_cast<unsigned>(handle), static_cast<unsigned>(fs->checksum.crc));
+        }
+        else {
+            handle = 0;
+        }
+        fs->checksum.handle = 0;
+        return handle;
+    }
+
+    // Closed object with known checksum goes to hash index, so identical
+    // content sent again can be copied locally instead. Staged one waits for
+    // commit, its content isn't there under its name yet.
+    void index_content(struct mtp_fs *fs, uint32_t handle)
+    {
+        if (handle == 0 or from_raw(fs->db).is_staged(handle)) {
+            return;
+        }
+        const auto filename = from_raw(fs->db).get_filename(handle);
+        const auto checksum = from_raw(fs->db).get_checksum(handle);
+        if (not filename or not checksum) {
+            return;
+        }
+        const auto absolutePath = std::string(fs->root) / *filename;
+        struct stat statbuf
+        {};
+        if (stat(absolutePath.c_str(), &statbuf) == 0) {
+            hash_index(fs).add({*filename,
+                                *checksum,
+                                static_cast<std::uint64_t>(statbuf.st_size),
+                                statbuf.st_mtim.tv_sec});
+        }
+    }
+
+    int set_file_modified(const std::string &path, std::time_t modified)
+    {
+        struct utimbuf times
+        {};
+        times.actime  = modified;
+        times.modtime = modified;
+        if (utime(path.c_str(), &times) != 0) {
+            log_error("Unable to set modification time of %s, errno %d", path.c_str(), errno);
+            return -1;
+        }
+        return 0;
+    }
+
+    // Staged file would lose the time with the next write, it's given on commit
+    int fs_set_modified(void *arg, uint32_t handle, time_t modified)
+    {
+        const auto fs       = static_cast<struct mtp_fs *>(arg);
+        const auto filename = from_raw(fs->db).get_filename(handle);
+        if (not filename) {
+            log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
+            return -1;
+        }
+        if (from_raw(fs->db).is_staged(handle)) {
+            from_raw(fs->db).set_staged_modified(handle, modified);
+            return 0;
+        }
+        if (find_virtual(fs, handle) != nullptr) {
+            return -1;
+        }
+        if (set_file_modified(std::string(fs->root) / *filename, modified) != 0) {
+            return -1;
+        }
+        // Hash index tells stale records by modification time
+        index_content(fs, handle);
+        note_written(fs, handle);
+        log_debug("[%u]: modified at %lld", static_cast<unsigned>(handle), static_cast<long long>(modified));
+        return 0;
+    }
+
+    // Uploads are staged from the start, interrupted one just stays that way
+    int fs_stage(void *arg, uint32_t handle)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (not from_raw(fs->db).is_staged(handle)) {
+            log_error("[%u]: not staged", static_cast<unsigned>(handle));
+            return -1;
+        }
+        // Checksum of data received so far isn't the one of object
+        from_raw(fs->db).invalidate_checksum(handle);
+        log_debug("[%u]: kept staged", static_cast<unsigned>(handle));
+        return 0;
+    }
+
+    // Complete upload replaces whatever was visible under its name at once
+    int fs_commit(void *arg, uint32_t handle)
+    {
+        const auto fs       = static_cast<struct mtp_fs *>(arg);
+        const auto filename = from_raw(fs->db).get_filename(handle);
+        if (not filename) {
+            log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
+            return -1;
+        }
+        if (not from_raw(fs->db).is_staged(handle)) {
+            return 0;
+        }
+
+        const auto visiblePath = std::string(fs->root) / *filename;
+        const auto stagedPath  = staged_path(fs, handle);
+        // Host's time survives rename, visible file never shows time of upload
+        if (const auto modified = from_raw(fs->db).take_staged_modified(handle)) {
+            set_file_modified(stagedPath, *modified);
+        }
+        struct stat statbuf
+        {};
+        const bool replaced = stat(visiblePath.c_str(), &statbuf) == 0;
+        forget_kept(fs, *filename);
+        if (rename(stagedPath.c_str(), visiblePath.c_str()) != 0) {
+            log_error("[%u]: unable to commit %s, errno %d", static_cast<unsigned>(handle), filename->c_str(), errno);
+            return -1;
+        }
+        if (replaced) {
+            space_released(fs, statbuf.st_size);
+        }
+        hash_index(fs).remove(*filename);
+        // Replaced file was other object, identity goes with the content
+        uid_index(fs).rename(staged_name(handle), *filename);
+        from_raw(fs->db).commit(handle);
+        index_content(fs, handle);
+        note_written(fs, handle);
+        log_debug("[%u]: committed: %s", static_cast<unsigned>(handle), filename->c_str());
+        return 0;
+    }
+
+    bool same_digest(const mtp::Sha256::Digest &digest, const mtp_object_hash_t *hash)
+    {
+        return std::equal(digest.begin(), digest.end(), hash->digest);
+    }
+
+    std::optional<mtp::Sha256::Digest> file_digest(const std::string &path)
+    {
+        const auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            log_error("Unable to open %s, errno %d", path.c_str(), errno);
+            return std::nullopt;
+        }
+        const auto buffer = new (std::nothrow) char[iobuf_size];
+        mtp::Sha256 sha;
+        bool read = buffer != nullptr;
+        while (read) {
+            const auto count = ::read(fd, buffer, iobuf_size);
+            if (count <= 0) {
+                read = count == 0;
+                break;
+            }
+            sha.update(buffer, count);
+        }
+        delete[] buffer;
+        close(fd);
+        return read ? std::optional(sha.finish()) : std::nullopt;
+    }
+
+    // Index knows CRC32C only, it narrows down files whose SHA-256 is worth computing
+    uint32_t fs_find_duplicate(void *arg, const mtp_object_hash_t *hash)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        for (const auto &record : hash_index(fs).find(hash->checksum, hash->size)) {
+            const auto absolutePath = std::string(fs->root) / record.filename;
+            struct stat statbuf
+            {};
+            if (stat(absolutePath.c_str(), &statbuf) != 0 or static_cast<uint64_t>(statbuf.st_size) != hash->size or
+                statbuf.st_mtim.tv_sec != record.modified) {
+                log_debug("[]: %s changed since indexed", record.filename.c_str());
+                hash_index(fs).remove(record.filename);
+                continue;
+            }
+            if (const auto digest = file_digest(absolutePath); digest and same_digest(*digest, hash)) {
+                log_debug("[]: %08x matches %s", static_cast<unsigned>(hash->checksum), record.filename.c_str());
+                return from_raw(fs->db).insert_or_get(record.filename.c_str());
+            }
+            log_debug("[]: %s has the same crc32c, different content", record.filename.c_str());
+        }
+        return 0;
+    }
+
+    bool write_all(int fd, const char *data, size_t count)
+    {
+        size_t done = 0;
+        while (done < count) {
+            const auto written = ::write(fd, data + done, count - done);
+            if (written <= 0) {
+                return false;
+            }
+            done += written;
+        }
+        return true;
+    }
+
+    // Copy file content, making sure it's still what the host announced
+    bool copy_content(const std::string &from, const std::string &to, const mtp_object_hash_t *hash)
+    {
+        const auto in = open(from.c_str(), O_RDONLY);
+        if (in < 0) {
+            log_error("Unable to open %s, errno %d", from.c_str(), errno);
+            return false;
+        }
+        const auto out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (out < 0) {
+            log_error("Unable to create %s, errno %d", to.c_str(), errno);
+            close(in);
+            return false;
+        }
+
+        const auto buffer = new (std::nothrow) char[iobuf_size];
+        mtp::Sha256 sha;
+        bool copied = buffer != nullptr;
+        while (copied) {
+            const auto count = ::read(in, buffer, iobuf_size);
+            if (count <= 0) {
+                copied = count == 0;
+                break;
+            }
+            sha.update(buffer, count);
+            copied = write_all(out, buffer, count);
+        }
+        delete[] buffer;
+        close(in);
+        copied = (close(out) == 0) and copied;
+
+        if (copied and not same_digest(sha.finish(), hash)) {
+            log_error("Content of %s changed since matched", from.c_str());
+            copied = false;
+        }
+        if (not copied) {
+            unlink(to.c_str());
+        }
+        return copied;
+    }
+
+    int fs_create_copy(
+        void *arg, uint32_t source, const mtp_object_hash_t *hash, const mtp_object_info_t *info, uint32_t *handle)
+    {
+        const auto fs         = static_cast<struct mtp_fs *>(arg);
+        const auto sourceName = from_raw(fs->db).get_filename(source);
+        if (not sourceName) {
+            log_error("[%u]: filename is nullptr", static_cast<unsigned>(source));
+            return -1;
+        }
+        if (find_virtual(fs, source) != nullptr or is_virtual_name(fs, info->filename) or is_hidden(info->filename)) {
+            return -1;
+        }
+
+        // Same content sent again under the same name, file is already there
+        const auto targetName = std::filesystem::path(info->filename);
+        const bool inPlace    = (*sourceName == targetName);
+        if (not inPlace) {
+            if (const auto freeSpace = get_free_space(arg); freeSpace < info->size) {
+                log_error("There is not enough space for file %s (%llu < %llu)", info->filename, freeSpace, info->size);
+                return -1;
+            }
+        }
+
+        const auto new_handle =
+            inPlace ? from_raw(fs->db).insert(info->filename) : from_raw(fs->db).insert_staged(info->filename);
+        if (new_handle == 0) {
+            log_error("Can't create a new object: %s", info->filename);
+            return -1;
+        }
+        from_raw(fs->db).set_checksum(new_handle, info->checksum);
+        if (info->modified != 0) {
+            fs_set_modified(arg, new_handle, info->modified);
+        }
+        if (not inPlace) {
+            const auto sourcePath = std::string(fs->root) / *sourceName;
+            const auto stagedPath = staged_path(fs, new_handle);
+            if (not copy_content(sourcePath, stagedPath, hash)) {
+                from_raw(fs->db).remove(new_handle);
+                return -1;
+            }
+            space_consumed(fs, info->size);
+            ++fs->space.ops;
+            if (fs_commit(arg, new_handle) != 0) {
+                unlink(stagedPath.c_str());
+                from_raw(fs->db).remove(new_handle);
+                return -1;
+            }
+        }
+        else {
+            // Commit indexes copied file, one already in place is only indexed
+            index_content(fs, new_handle);
+            note_written(fs, new_handle);
+        }
+        log_debug("[%u]: %s copied from %s",
+                  static_cast<unsigned>(new_handle),
+                  info->filename,
+                  sourceName->c_str());
+        *handle = new_handle;
+        return 0;
+    }
+
+    // Content is generated, there's no file to open
+    int open_virtual(struct mtp_fs *fs, struct mtp_fs_virtual_entry &entry, const char *mode)
+    {
+        if (mode[0] != 'r' or strchr(mode, '+') != nullptr) {
+            log_error("[%u]: virtual object is read only", static_cast<unsigned>(entry.handle));
+            return -1;
+        }
+        fs->virtuals.open = &entry;
+        fs->offset        = 0;
+        log_debug("[%u]: opened virtual: %s", static_cast<unsigned>(entry.handle), entry.object->name);
+        return 0;
+    }
+
+    // Generator may give more or less than it reported in stat, host expects exactly that size
+    int read_virtual(struct mtp_fs *fs, void *buffer, size_t count)
+    {
+        const auto entry  = fs->virtuals.open;
+        const auto object = entry->object;
+        const auto data   = static_cast<char *>(buffer);
+        const auto wanted = static_cast<size_t>(std::min<std::uint64_t>(count, entry->size - fs->offset));
+        size_t done       = 0;
+        while (done < wanted) {
+            const auto read = object->read(object->arg, fs->offset + done, data + done, wanted - done);
+            if (read < 0) {
+                log_error("[%u]: virtual read failed: %d", static_cast<unsigned>(entry->handle), read);
+                return -1;
+            }
+            if (read == 0) {
+                memset(data + done, 0, wanted - done);
+                break;
+            }
+            done += std::min(static_cast<size_t>(read), wanted - done);
+        }
+        fs->offset += wanted;
+        return static_cast<int>(wanted);
+    }
+
+    int fs_open(void *arg, uint32_t handle, const char *mode)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (const auto entry = find_virtual(fs, handle)) {
+            return open_virtual(fs, *entry, mode);
+        }
+        const auto filename = from_raw(fs->db).get_filename(handle);
+        if (not filename) {
+            log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
+            return -1;
+        }
+
+        const auto absolutePath = object_path(fs, handle, *filename);
+        mode                    = prepare_open(fs, handle, mode);
+
+        if (struct mtp_fs_open_file kept {}; fs->kept.reusable and take_kept(fs, handle, absolutePath, kept)) {
+            fs->file  = kept.file;
+            fs->iobuf = kept.iobuf;
+            checksum_begin(fs, handle, mode, fileno(fs->file));
+            begin_cached_read(fs, handle, fileno(fs->file));
+            log_debug("[%u]: reopened: %s [%s]", static_cast<unsigned>(handle), filename->c_str(), mode);
+            return 0;
+        }
+
+        fs->file = std::fopen(absolutePath.c_str(), mode);
+        if (fs->file == nullptr) {
+            log_error("[%u]: fail to open: %s [%s]. Flush and wait",
                       static_cast<unsigned>(handle),
                       absolutePath.c_str(),
                       mode);
             fs->iobuf = nullptr;
         }
         else {
-            fs->iobuf = new (std::nothrow) char[iobuf_size];
+            const auto bufsize = aligned_iobuf_size(fs);
+            fs->iobuf          = new (std::nothrow) char[bufsize];
             if (fs->iobuf != nullptr) {
-                if (setvbuf(fs->file, fs->iobuf, _IOFBF, iobuf_size) != 0) {
+                if (setvbuf(fs->file, fs->iobuf, _IOFBF, bufsize) != 0) {
                     log_error("[%u]: unable to setvbuf, errno %d", static_cast<uintptr_t>(handle), errno);
                 }
             }
             else {
                 log_error("[%u]: unable to allocate iobuffer", static_cast<uintptr_t>(handle));
             }
+            checksum_begin(fs, handle, mode, fileno(fs->file));
+            begin_cached_read(fs, handle, fileno(fs->file));
         }
         log_debug("[%u]: opened: %s [%s]", static_cast<unsigned>(handle), filename->c_str(), mode);
         return static_cast<int>(fs->file == nullptr);
@@ -309,16 +1470,29 @@ namespace
     int fs_read(void *arg, void *buffer, size_t count)
     {
         const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (fs->virtuals.open != nullptr) {
+            return read_virtual(fs, buffer, count);
+        }
         if (fs->file == nullptr) {
             return -1;
         }
 
-        if (const auto read = std::fread(buffer, 1, count, fs->file); read != count and ferror(fs->file) != 0) {
-            return -1;
+        const auto data   = static_cast<char *>(buffer);
+        const auto cached = cached_read(fs, fileno(fs->file), data, count);
+        if (cached != count and fs->reading.seek) {
+            if (fseek(fs->file, static_cast<long>(fs->offset), SEEK_SET) != 0) {
+                return -1;
+            }
+            fs->reading.seek = false;
         }
-        else {
-            return static_cast<int>(read);
+
+        const auto read = (cached != count) ? std::fread(data + cached, 1, count - cached, fs->file) : 0;
+        if (read != count - cached and ferror(fs->file) != 0) {
+            return -1;
         }
+        fs->offset += read;
+        checksum_update(fs, buffer, cached + read);
+        return static_cast<int>(cached + read);
     }
 
     int fs_write(void *arg, const void *buffer, size_t count)
@@ -327,39 +1501,329 @@ namespace
         if (fs->file == nullptr) {
             return -1;
         }
-        return std::fwrite(buffer, 1, count, fs->file) == count ? 0 : -1;
+        // Stdio buffer goes to flash each time it fills up
+        const size_t buffered = (fs->iobuf != nullptr) ? aligned_iobuf_size(fs) : BUFSIZ;
+        fs->throttle.buffered += count;
+        throttle_write(fs, count, static_cast<std::uint32_t>(fs->throttle.buffered / buffered));
+        fs->throttle.buffered %= buffered;
+        if (std::fwrite(buffer, 1, count, fs->file) != count) {
+            fs->checksum.handle = 0;
+            return -1;
+        }
+        checksum_update(fs, buffer, count);
+        account_write(fs, count);
+        return 0;
     }
 
     void fs_close(void *arg)
     {
-        const auto fs = static_cast<struct mtp_fs *>(arg);
+        const auto fs     = static_cast<struct mtp_fs *>(arg);
+        fs->virtuals.open = nullptr;
         if (fs->file != nullptr) {
-            std::fclose(fs->file);
+            if (fs->throttle.buffered != 0) {
+                throttle_write(fs, 0, 1);
+                fs->throttle.buffered = 0;
+            }
+            std::fflush(fs->file);
+            end_cached_read(fs);
+            trim_preallocated(fs, fileno(fs->file));
+            const auto handle = checksum_end(fs);
+            if (not fs->kept.reusable) {
+                note_written(fs, fs->kept.handle);
+            }
+            if (not park(fs, fs->file, fs->iobuf, -1)) {
+                std::fclose(fs->file);
+                delete[] fs->iobuf;
+            }
             log_debug("[]: closed");
-            fs->file = nullptr;
-            delete[] fs->iobuf;
+            fs->file  = nullptr;
             fs->iobuf = nullptr;
+            index_content(fs, handle);
+        }
+    }
+
+    // No O_APPEND for "a", it doesn't apply to pwrite, raw_open starts at the end instead
+    int raw_open_flags(const char *mode)
+    {
+        const bool update = strchr(mode, '+') != nullptr;
+        switch (mode[0]) {
+        case 'w':
+            return (update ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+        case 'a':
+            return (update ? O_RDWR : O_WRONLY) | O_CREAT;
+        default:
+            return update ? O_RDWR : O_RDONLY;
+        }
+    }
+
+    int raw_open(void *arg, uint32_t handle, const char *mode)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (const auto entry = find_virtual(fs, handle)) {
+            return open_virtual(fs, *entry, mode);
+        }
+        const auto filename = from_raw(fs->db).get_filename(handle);
+        if (not filename) {
+            log_error("[%u]: filename is nullptr", static_cast<unsigned>(handle));
+            return -1;
+        }
+
+        const auto absolutePath = object_path(fs, handle, *filename);
+        mode                    = prepare_open(fs, handle, mode);
+
+        if (struct mtp_fs_open_file kept {}; fs->kept.reusable and take_kept(fs, handle, absolutePath, kept)) {
+            fs->fd = kept.fd;
+            checksum_begin(fs, handle, mode, fs->fd);
+            begin_cached_read(fs, handle, fs->fd);
+            log_debug("[%u]: reopened: %s [%s]", static_cast<unsigned>(handle), filename->c_str(), mode);
+            return 0;
+        }
+
+        fs->fd = open(absolutePath.c_str(), raw_open_flags(mode), 0666);
+        if (fs->fd < 0) {
+            log_error("[%u]: fail to open: %s [%s], errno %d",
+                      static_cast<unsigned>(handle),
+                      absolutePath.c_str(),
+                      mode,
+                      errno);
+            return -1;
+        }
+        if (mode[0] == 'a') {
+            const auto end = lseek(fs->fd, 0, SEEK_END);
+            if (end < 0) {
+                log_error("[%u]: fail to seek: %s, errno %d",
+                          static_cast<unsigned>(handle),
+                          absolutePath.c_str(),
+                          errno);
+                close(fs->fd);
+                fs->fd = -1;
+                return -1;
+            }
+            fs->offset = static_cast<std::uint64_t>(end);
+        }
+        // Without buffer data is written as it comes
+        if (fs->checksum.writing) {
+            fs->gather.size   = aligned_iobuf_size(fs);
+            fs->gather.length = 0;
+            fs->gather.buffer = new (std::nothrow) char[fs->gather.size];
+        }
+        checksum_begin(fs, handle, mode, fs->fd);
+        begin_cached_read(fs, handle, fs->fd);
+        log_debug("[%u]: opened: %s [%s]", static_cast<unsigned>(handle), filename->c_str(), mode);
+        return 0;
+    }
+
+    bool pwrite_all(int fd, const char *data, size_t count, std::uint64_t offset)
+    {
+        size_t done = 0;
+        while (done < count) {
+            const auto written = pwrite(fd, data + done, count - done, static_cast<off_t>(offset + done));
+            if (written <= 0) {
+                return false;
+            }
+            done += written;
         }
+        return true;
+    }
+
+    // Gathered data ends on a cluster boundary unless the file is being closed
+    bool flush_gathered(struct mtp_fs *fs)
+    {
+        const auto length = fs->gather.length;
+        fs->gather.length = 0;
+        if (length == 0) {
+            return true;
+        }
+        throttle_write(fs, 0, 1);
+        if (not pwrite_all(fs->fd, fs->gather.buffer, length, fs->offset - length)) {
+            log_error("[%u]: unable to write %u bytes, errno %d",
+                      static_cast<unsigned>(fs->kept.handle),
+                      static_cast<unsigned>(length),
+                      errno);
+            fs->checksum.handle = 0;
+            return false;
+        }
+        return true;
+    }
+
+    int raw_read(void *arg, void *buffer, size_t count)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (fs->virtuals.open != nullptr) {
+            return read_virtual(fs, buffer, count);
+        }
+        if (fs->fd < 0 or not flush_gathered(fs)) {
+            return -1;
+        }
+
+        const auto data   = static_cast<char *>(buffer);
+        const auto cached = cached_read(fs, fs->fd, data, count);
+        const auto read =
+            (cached != count) ? pread(fs->fd, data + cached, count - cached, static_cast<off_t>(fs->offset)) : 0;
+        if (read < 0) {
+            return -1;
+        }
+        fs->offset += read;
+        checksum_update(fs, buffer, cached + read);
+        return static_cast<int>(cached + read);
+    }
+
+    // Host packets don't start at cluster boundary, the first container has header in front of data. They are
+    // gathered and written as whole clusters, the first write only fills up the cluster the file ends in.
+    int raw_write(void *arg, const void *buffer, size_t count)
+    {
+        const auto fs = static_cast<struct mtp_fs *>(arg);
+        if (fs->fd < 0) {
+            return -1;
+        }
+
+        const auto data = static_cast<const char *>(buffer);
+        throttle_write(fs, count, (fs->gather.buffer == nullptr) ? 1 : 0);
+        if (fs->gather.buffer == nullptr) {
+            if (not pwrite_all(fs->fd, data, count, fs->offset)) {
+                fs->checksum.handle = 0;
+                return -1;
+            }
+            fs->offset += count;
+        }
+        else {
+            const auto cluster = (fs->space.block_size != 0) ? fs->space.block_size : fs->gather.size;
+            for (size_t done = 0; done < count;) {
+                const auto start  = fs->offset - fs->gather.length;
+                const auto limit  = fs->gather.size - static_cast<size_t>(start % cluster);
+                const auto copied = std::min(count - done, limit - fs->gather.length);
+                memcpy(fs->gather.buffer + fs->gather.length, data + done, copied);
+                fs->gather.length += copied;
+                fs->offset += copied;
+                done += copied;
+                if (fs->gather.length == limit and not flush_gathered(fs)) {
+                    return -1;
+                }
+            }
+        }
+        checksum_update(fs, buffer, count);
+        account_write(fs, count);
+        return 0;
+    }
+
+    void raw_close(void *arg)
+    {
+        const auto fs     = static_cast<struct mtp_fs *>(arg);
+        fs->virtuals.open = nullptr;
+        if (fs->fd >= 0) {
+            flush_gathered(fs);
+            delete[] fs->gather.buffer;
+            fs->gather.buffer = nullptr;
+            end_cached_read(fs);
+            trim_preallocated(fs, fs->fd);
+            const auto handle = checksum_end(fs);
+            if (not fs->kept.reusable) {
+                note_written(fs, fs->kept.handle);
+            }
+            if (not park(fs, nullptr, nullptr, fs->fd)) {
+                close(fs->fd);
+            }
+            log_debug("[]: closed");
+            fs->fd = -1;
+            index_content(fs, handle);
+        }
+    }
+
+    // Index follows the change before the host is told about it
+    bool apply_change(struct mtp_fs *fs, const mtp::FileChange &change, struct mtp_fs_change &out)
+    {
+        auto &db = from_raw(fs->db);
+        // File put under name of virtual object stays shadowed by it
+        if (is_virtual_name(fs, change.filename.c_str())) {
+            return false;
+        }
+        if (change.kind == mtp::FileChange::Kind::removed) {
+            search_index(fs).forget(change.filename);
+        }
+        else {
+            search_index(fs).update(change.filename);
+        }
+        if (change.kind == mtp::FileChange::Kind::added) {
+            out = {MTP_EVENT_OBJECT_ADDED, db.insert_or_get(change.filename.c_str())};
+            log_debug("[%u]: added outside: %s", static_cast<unsigned>(out.handle), change.filename.c_str());
+            return true;
+        }
+        // Host can't know object it never got a handle of
+        const auto handle = db.get_handle(change.filename.c_str());
+        if (not handle) {
+            return false;
+        }
+        forget_kept(fs, *handle);
+        forget_cached(fs, *handle);
+        hash_index(fs).remove(change.filename);
+        if (change.kind == mtp::FileChange::Kind::removed) {
+            uid_index(fs).remove(change.filename);
+            db.remove(*handle);
+            ++fs->space.ops;
+            out = {MTP_EVENT_OBJECT_REMOVED, *handle};
+            log_debug("[%u]: removed outside: %s", static_cast<unsigned>(*handle), change.filename.c_str());
+            return true;
+        }
+        db.invalidate_checksum(*handle);
+        ++fs->space.ops;
+        out = {MTP_EVENT_OBJECT_INFO_CHANGED, *handle};
+        log_debug("[%u]: changed outside: %s", static_cast<unsigned>(*handle), change.filename.c_str());
+        return true;
     }
 } // namespace
 
 extern "C" const struct mtp_storage_api simple_fs_api = {.get_properties = get_disk_properties,
                                                          .find_first     = fs_find_first,
                                                          .find_next      = fs_find_next,
+                                                         .find_batch     = fs_find_batch,
                                                          .get_free_space = get_free_space,
                                                          .stat           = fs_stat,
+                                                         .search         = fs_search,
+                                                         .search_batch   = fs_search_batch,
+                                                         .get_media_info = fs_get_media_info,
                                                          .rename         = fs_rename,
+                                                         .set_modified   = fs_set_modified,
                                                          .create         = fs_create,
+                                                         .find_duplicate = fs_find_duplicate,
+                                                         .create_copy    = fs_create_copy,
                                                          .remove         = fs_remove,
+                                                         .stage          = fs_stage,
+                                                         .commit         = fs_commit,
+                                                         .remove_batch   = fs_remove_batch,
                                                          .open           = fs_open,
                                                          .read           = fs_read,
                                                          .write          = fs_write,
                                                          .close          = fs_close};
 
-extern "C" struct mtp_fs *mtp_fs_alloc(void *mtpRootPath)
+extern "C" const struct mtp_storage_api raw_fs_api = {.get_properties = get_disk_properties,
+                                                      .find_first     = fs_find_first,
+                                                      .find_next      = fs_find_next,
+                                                      .find_batch     = fs_find_batch,
+                                                      .get_free_space = get_free_space,
+                                                      .stat           = fs_stat,
+                                                      .search         = fs_search,
+                                                      .search_batch   = fs_search_batch,
+                                                      .get_media_info = fs_get_media_info,
+                                                      .rename         = fs_rename,
+                                                      .set_modified   = fs_set_modified,
+                                                      .create         = fs_create,
+                                                      .find_duplicate = fs_find_duplicate,
+                                                      .create_copy    = fs_create_copy,
+                                                      .remove         = fs_remove,
+                                                      .stage          = fs_stage,
+                                                      .commit         = fs_commit,
+                                                      .remove_batch   = fs_remove_batch,
+                                                      .open           = raw_open,
+                                                      .read           = raw_read,
+                                                      .write          = raw_write,
+                                                      .close          = raw_close};
+
+extern "C" struct mtp_fs *mtp_fs_alloc(void *mtpRootPath, enum mtp_fs_io io)
 {
     const auto fs = static_cast<struct mtp_fs *>(calloc(1, sizeof(struct mtp_fs)));
     if (fs != NULL) {
+        fs->io = io;
+        fs->fd = -1;
         fs->db = static_cast<void *>(new mtp::FileDatabase);
         if (fs->db == NULL) {
             free(fs);
@@ -368,7 +1832,21 @@ extern "C" struct mtp_fs *mtp_fs_alloc(void *mtpRootPath)
 
         fs->root = (const char *)mtpRootPath;
         log_debug("[]: initializing MTP root at %s", fs->root);
-        fs->find_data = opendir(fs->root);
+        const auto index = new mtp::HashIndex(std::filesystem::path(fs->root) / hash_index_name);
+        index->load();
+        fs->hash_index = static_cast<void *>(index);
+        const auto uids = new mtp::UidIndex(std::filesystem::path(fs->root) / uid_index_name);
+        uids->load();
+        fs->uid_index = static_cast<void *>(uids);
+        if (CONFIG_MTP_FS_READ_CACHE_BLOCKS > 0) {
+            fs->read_cache = static_cast<void *>(
+                new mtp::ReadCache(CONFIG_MTP_FS_READ_CACHE_BLOCK_SIZE, CONFIG_MTP_FS_READ_CACHE_BLOCKS));
+        }
+        purge_staged(fs);
+        fs->scanner        = static_cast<void *>(new mtp::ChangeScanner(fs->root, is_hidden));
+        fs->search_index   = static_cast<void *>(new mtp::SearchIndex(fs->root, is_hidden, ext_to_format_code));
+        fs->search.results = static_cast<void *>(new std::vector<mtp::Handle>);
+        fs->find_data      = opendir(fs->root);
         if (fs->find_data == NULL) {
             mtp_fs_free(fs);
             return NULL;
@@ -377,13 +1855,117 @@ extern "C" struct mtp_fs *mtp_fs_alloc(void *mtpRootPath)
     return fs;
 }
 
+extern "C" uint32_t mtp_fs_add_virtual(struct mtp_fs *fs, const struct mtp_fs_virtual_object *object)
+{
+    const auto free = std::find_if(std::begin(fs->virtuals.objects),
+                                   std::end(fs->virtuals.objects),
+                                   [](const auto &entry) { return entry.handle == 0; });
+    if (free == std::end(fs->virtuals.objects)) {
+        log_error("No room for virtual object %s", object->name);
+        return 0;
+    }
+    struct stat statbuf
+    {};
+    if (is_hidden(object->name) or is_virtual_name(fs, object->name) or
+        stat((std::string(fs->root) / std::filesystem::path(object->name)).c_str(), &statbuf) == 0) {
+        log_error("Name of virtual object %s is taken", object->name);
+        return 0;
+    }
+    *free = {from_raw(fs->db).insert(object->name), object, 0};
+    log_debug("[%u]: virtual object: %s", static_cast<unsigned>(free->handle), object->name);
+    return free->handle;
+}
+
+extern "C" const struct mtp_storage_api *mtp_fs_api(const struct mtp_fs *fs)
+{
+    return (fs->io == MTP_FS_IO_RAW) ? &raw_fs_api : &simple_fs_api;
+}
+
 extern "C" void mtp_fs_free(struct mtp_fs *fs)
 {
+    for (auto &entry : fs->kept.files) {
+        close_kept(entry);
+    }
     if (fs->db != nullptr) {
         delete static_cast<mtp::FileDatabase *>(fs->db);
     }
+    if (fs->hash_index != nullptr) {
+        delete static_cast<mtp::HashIndex *>(fs->hash_index);
+    }
+    if (fs->uid_index != nullptr) {
+        delete static_cast<mtp::UidIndex *>(fs->uid_index);
+    }
+    if (fs->read_cache != nullptr) {
+        delete static_cast<mtp::ReadCache *>(fs->read_cache);
+    }
+    if (fs->scanner != nullptr) {
+        delete static_cast<mtp::ChangeScanner *>(fs->scanner);
+    }
+    if (fs->search_index != nullptr) {
+        delete static_cast<mtp::SearchIndex *>(fs->search_index);
+    }
+    if (fs->search.results != nullptr) {
+        delete static_cast<std::vector<mtp::Handle> *>(fs->search.results);
+    }
     if (fs->find_data != NULL) {
         closedir(fs->find_data);
     }
+    delete[] fs->gather.buffer;
     free(fs);
 }
+
+extern "C" void mtp_fs_foreground_activity(struct mtp_fs *fs)
+{
+    __atomic_store_n(&fs->throttle.foreground, xTaskGetTickCount(), __ATOMIC_RELAXED);
+    __atomic_store_n(&fs->throttle.signalled, true, __ATOMIC_RELEASE);
+}
+
+extern "C" uint32_t mtp_fs_throttled_time_ms(const struct mtp_fs *fs)
+{
+    return fs->throttle.held * portTICK_PERIOD_MS;
+}
+
+extern "C" void mtp_fs_read_cache_stats(const struct mtp_fs *fs, uint32_t *hits, uint32_t *misses)
+{
+    const auto cache = read_cache(fs);
+    *hits            = (cache != nullptr) ? cache->hits() : 0;
+    *misses          = (cache != nullptr) ? cache->misses() : 0;
+}
+
+extern "C" void mtp_fs_close_idle(struct mtp_fs *fs)
+{
+    hash_index(fs).flush();
+    uid_index(fs).flush();
+    const auto now = xTaskGetTickCount();
+    for (auto &entry : fs->kept.files) {
+        if (entry.handle != 0 and now - entry.parked >= pdMS_TO_TICKS(CONFIG_MTP_FS_OPEN_FILE_IDLE_MS)) {
+            log_debug("[%u]: closed idle file", static_cast<unsigned>(entry.handle));
+            close_kept(entry);
+        }
+    }
+}
+
+extern "C" uint32_t mtp_fs_scan_changes(struct mtp_fs *fs, struct mtp_fs_change *out, uint32_t max)
+{
+    // Object open now is in the middle of a transaction
+    if (fs->file != nullptr or fs->fd >= 0) {
+        return 0;
+    }
+    const auto now = xTaskGetTickCount();
+    if (scanner(fs).scanning() or now - fs->scan.timestamp >= pdMS_TO_TICKS(CONFIG_MTP_FS_SCAN_INTERVAL_MS)) {
+        if (scanner(fs).step(CONFIG_MTP_FS_SCAN_STEP)) {
+            fs->scan.timestamp = now;
+        }
+    }
+    uint32_t count = 0;
+    while (count < max) {
+        const auto change = scanner(fs).take();
+        if (not change) {
+            break;
+        }
+        if (apply_change(fs, *change, out[count])) {
+            ++count;
+        }
+    }
+    return count;
+}
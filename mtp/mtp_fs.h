@@ -9,21 +9,227 @@
 #include <stdio.h>
 #include <dirent.h>
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Free space is taken from statvfs only when cached value is older than
+ * CONFIG_MTP_FS_FREE_SPACE_MAX_AGE_MS or after CONFIG_MTP_FS_FREE_SPACE_MAX_OPS
+ * create/remove operations. In between it's adjusted by bytes written/removed. */
+#ifndef CONFIG_MTP_FS_FREE_SPACE_MAX_AGE_MS
+#define CONFIG_MTP_FS_FREE_SPACE_MAX_AGE_MS (5000U)
+#endif
+#ifndef CONFIG_MTP_FS_FREE_SPACE_MAX_OPS
+#define CONFIG_MTP_FS_FREE_SPACE_MAX_OPS (32U)
+#endif
+
+/* Up to CONFIG_MTP_FS_READ_CACHE_PREFIX first bytes of objects read by the
+ * host are kept in CONFIG_MTP_FS_READ_CACHE_BLOCKS blocks of
+ * CONFIG_MTP_FS_READ_CACHE_BLOCK_SIZE bytes, hosts read file headers again
+ * and again. The least recently used block is reused. 0 blocks disables it. */
+#ifndef CONFIG_MTP_FS_READ_CACHE_BLOCKS
+#define CONFIG_MTP_FS_READ_CACHE_BLOCKS (8U)
+#endif
+#ifndef CONFIG_MTP_FS_READ_CACHE_BLOCK_SIZE
+#define CONFIG_MTP_FS_READ_CACHE_BLOCK_SIZE (4096U)
+#endif
+#ifndef CONFIG_MTP_FS_READ_CACHE_PREFIX
+#define CONFIG_MTP_FS_READ_CACHE_PREFIX (16U * 1024U)
+#endif
+
+/* Files opened for reading stay open after close, up to
+ * CONFIG_MTP_FS_OPEN_FILES of them, so following transactions on the same
+ * objects skip open work. The least recently used one is closed first, all
+ * are closed after CONFIG_MTP_FS_OPEN_FILE_IDLE_MS with no use. */
+#ifndef CONFIG_MTP_FS_OPEN_FILES
+#define CONFIG_MTP_FS_OPEN_FILES (4U)      /* at least 1 */
+#endif
+#ifndef CONFIG_MTP_FS_OPEN_FILE_IDLE_MS
+#define CONFIG_MTP_FS_OPEN_FILE_IDLE_MS (2000U)
+#endif
+
+/* Files changed by other users of the filesystem are found by comparing
+ * size and modification time with ones seen before. Directory is read
+ * CONFIG_MTP_FS_SCAN_STEP entries at a time while idle, and a new pass is
+ * started CONFIG_MTP_FS_SCAN_INTERVAL_MS after the previous one ended. */
+#ifndef CONFIG_MTP_FS_SCAN_STEP
+#define CONFIG_MTP_FS_SCAN_STEP (16U)
+#endif
+#ifndef CONFIG_MTP_FS_SCAN_INTERVAL_MS
+#define CONFIG_MTP_FS_SCAN_INTERVAL_MS (1000U)
+#endif
+
+/* Audio tags and image dimensions are read on first request for them, at
+ * most CONFIG_MTP_FS_MEDIA_READ_LIMIT bytes of file headers per object, and
+ * kept until the file changes. */
+#ifndef CONFIG_MTP_FS_MEDIA_READ_LIMIT
+#define CONFIG_MTP_FS_MEDIA_READ_LIMIT (16U * 1024U)
+#endif
+
+/* Writes are throttled while foreground services of the phone are busy, i.e.
+ * for CONFIG_MTP_FS_THROTTLE_HOLD_MS after mtp_fs_foreground_activity. Token
+ * buckets then let through CONFIG_MTP_FS_THROTTLE_BYTES_PER_SEC bytes and
+ * CONFIG_MTP_FS_THROTTLE_WRITES_PER_SEC writes to flash a second, in bursts
+ * of up to CONFIG_MTP_FS_THROTTLE_BURST_MS worth of them. A write to flash is
+ * a flush of the stdio buffer or of clusters gathered by raw I/O, up to 64 KiB
+ * each, so the byte rate is what limits large uploads. Rate 0 disables its
+ * limit. */
+#ifndef CONFIG_MTP_FS_THROTTLE_BYTES_PER_SEC
+#define CONFIG_MTP_FS_THROTTLE_BYTES_PER_SEC (512U * 1024U)
+#endif
+#ifndef CONFIG_MTP_FS_THROTTLE_WRITES_PER_SEC
+#define CONFIG_MTP_FS_THROTTLE_WRITES_PER_SEC (32U)
+#endif
+#ifndef CONFIG_MTP_FS_THROTTLE_BURST_MS
+#define CONFIG_MTP_FS_THROTTLE_BURST_MS (100U)
+#endif
+#ifndef CONFIG_MTP_FS_THROTTLE_HOLD_MS
+#define CONFIG_MTP_FS_THROTTLE_HOLD_MS (1000U)
+#endif
+
+/* Objects with content produced at read time, see mtp_fs_add_virtual */
+#ifndef CONFIG_MTP_FS_VIRTUAL_OBJECTS
+#define CONFIG_MTP_FS_VIRTUAL_OBJECTS (4U)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+/* File kept open with no transaction using it */
+struct mtp_fs_open_file {
+    uint32_t handle;        /* 0 for free entry */
+    FILE *file;
+    char *iobuf;
+    int fd;
+    uint32_t parked;        /* tick count when it was closed */
+};
+
+/* Object listed in storage root whose content is produced while the host
+ * reads it, e.g. from logs kept in RAM. Nothing is stored on disk. */
+struct mtp_fs_virtual_object {
+    const char *name;
+    /* Size of content now. It's given to the host ahead of data, content read
+     * afterwards is cut or zero padded to it. */
+    uint64_t (*size)(void *arg);
+    /* Copy up to count bytes of content starting at offset to buffer. Returns
+     * number of bytes copied, 0 past the end of content, negative on error. */
+    int (*read)(void *arg, uint64_t offset, void *buffer, size_t count);
+    void *arg;
+};
+
+struct mtp_fs_virtual_entry {
+    uint32_t handle;        /* 0 for free entry */
+    const struct mtp_fs_virtual_object *object;
+    uint64_t size;          /* as last reported to the host */
+};
+
+/* Object changed outside of MTP, already applied to the index */
+struct mtp_fs_change {
+    uint16_t event;         /* MTP_EVENT_OBJECT_ADDED, _REMOVED or _INFO_CHANGED */
+    uint32_t handle;
+};
+
+/* How object data is moved between the filesystem and MTP buffers */
+enum mtp_fs_io {
+    MTP_FS_IO_STDIO,    /* FILE with a cluster aligned stdio buffer */
+    MTP_FS_IO_RAW,      /* pread/pwrite, writes gathered into whole clusters */
+};
+
 struct mtp_fs {
     void* db;
+    void* hash_index;
+    void* uid_index;
+    void* read_cache;
+    void* scanner;
+    void* search_index;
     const char *root;
     DIR *find_data;
     FILE *file;
     char *iobuf;
+    enum mtp_fs_io io;
+    int fd;
+    uint64_t offset;
+    struct {
+        uint32_t handle;
+        uint64_t size;
+        uint64_t written;
+    } prealloc;
+    struct {
+        char *buffer;           /* raw I/O file open for writing */
+        size_t size;            /* multiple of cluster size */
+        size_t length;          /* gathered bytes, they belong before offset */
+    } gather;
+    struct {
+        uint32_t handle;        /* object of the file open now */
+        bool reusable;          /* opened for reading only, kept on close */
+        struct mtp_fs_open_file files[CONFIG_MTP_FS_OPEN_FILES];
+    } kept;
+    struct {
+        struct mtp_fs_virtual_entry objects[CONFIG_MTP_FS_VIRTUAL_OBJECTS];
+        uint32_t listed;        /* listed by find_first/find_next so far */
+        struct mtp_fs_virtual_entry *open;  /* read now, NULL if none */
+    } virtuals;
+    struct {
+        uint32_t handle;        /* object opened for reading, 0 if not cached */
+        bool seek;              /* FILE position lags offset after cached reads */
+    } reading;
+    struct {
+        uint32_t handle;
+        uint32_t crc;
+        uint64_t length;
+        uint64_t size;
+        bool writing;
+    } checksum;
+    struct {
+        uint32_t timestamp;     /* tick count when last pass ended */
+    } scan;
+    struct {
+        void *results;          /* handles found by the last search */
+        uint32_t taken;         /* given by search_batch so far */
+    } search;
+    struct {
+        uint32_t foreground;    /* tick count of last foreground activity */
+        bool signalled;         /* foreground was ever active */
+        uint32_t refilled;      /* tick count when buckets were last filled */
+        int64_t bytes;          /* tokens scaled by tick rate, negative in debt */
+        int64_t writes;
+        uint32_t held;          /* ticks writes were held, in total */
+        size_t buffered;        /* bytes in stdio buffer, not charged as write yet */
+    } throttle;
+    struct {
+        uint64_t free;
+        uint64_t capacity;
+        uint32_t block_size;
+        uint32_t timestamp;
+        uint32_t ops;
+        bool valid;
+    } space;
 };
 
 extern const struct mtp_storage_api simple_fs_api;
+extern const struct mtp_storage_api raw_fs_api;
 
-struct mtp_fs* mtp_fs_alloc(void *disk);
+struct mtp_fs* mtp_fs_alloc(void *disk, enum mtp_fs_io io);
+/* Storage API matching I/O mode given to mtp_fs_alloc */
+const struct mtp_storage_api* mtp_fs_api(const struct mtp_fs *fs);
 void mtp_fs_free(struct mtp_fs *fs);
+/* Add virtual object, it's read only. Object must stay valid as long as fs.
+ * Returns its handle, 0 if there's no room or the name is taken. */
+uint32_t mtp_fs_add_virtual(struct mtp_fs *fs, const struct mtp_fs_virtual_object *object);
+/* Close files kept open but not used for CONFIG_MTP_FS_OPEN_FILE_IDLE_MS,
+ * so other users of the filesystem can change them. Index changes buffered
+ * meanwhile are written too. */
+void mtp_fs_close_idle(struct mtp_fs *fs);
+/* Continue looking for files changed outside of MTP, updating the index.
+ * Stores up to max changes found in out, returns their number. */
+uint32_t mtp_fs_scan_changes(struct mtp_fs *fs, struct mtp_fs_change *out, uint32_t max);
+/* Foreground services are busy, writes get throttled for a while. Safe to
+ * call from any task. */
+void mtp_fs_foreground_activity(struct mtp_fs *fs);
+/* Time writes were held by throttling since fs was allocated */
+uint32_t mtp_fs_throttled_time_ms(const struct mtp_fs *fs);
+/* Reads served from read cache and ones that went to the filesystem */
+void mtp_fs_read_cache_stats(const struct mtp_fs *fs, uint32_t *hits, uint32_t *misses);
 
 #ifdef __cplusplus
 }; // extern "C"
@@ -0,0 +1,151 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <cstdio>
+#include "log.hpp"
+#include "mtp_hash_index.hpp"
+
+namespace mtp
+{
+    namespace
+    {
+        // Journal records: "+ checksum size modified name" or "- name"
+        std::string added_record(const HashRecord &record)
+        {
+            return journal_record("+ %08lx %llu %lld %s",
+                                  static_cast<unsigned long>(record.checksum),
+                                  static_cast<unsigned long long>(record.size),
+                                  static_cast<long long>(record.modified),
+                                  record.filename.c_str());
+        }
+
+        bool parse_added(char *line, HashRecord &record)
+        {
+            unsigned long checksum;
+            unsigned long long size;
+            long long modified;
+            int name_offset = 0;
+            if (std::sscanf(line, "+ %lx %llu %lld %n", &checksum, &size, &modified, &name_offset) != 3 or
+                name_offset == 0 or line[name_offset] == '\0') {
+                return false;
+            }
+            record.filename = &line[name_offset];
+            record.checksum = static_cast<std::uint32_t>(checksum);
+            record.size     = size;
+            record.modified = static_cast<std::time_t>(modified);
+            return true;
+        }
+    } // namespace
+
+    HashIndex::HashIndex(std::filesystem::path journal) : journal(std::move(journal), "Hash index")
+    {}
+
+    void HashIndex::load()
+    {
+        byFilename.clear();
+        byChecksum.clear();
+
+        const bool replayed = journal.replay([this](char *line) {
+            HashRecord record{};
+            if (line[0] == '+' and parse_added(line, record)) {
+                insert(record);
+            }
+            else if (line[0] == '-' and line[1] == ' ') {
+                erase(&line[2]);
+            }
+        });
+        if (not replayed) {
+            return;
+        }
+
+        log_debug("Hash index: %u files", static_cast<unsigned>(byFilename.size()));
+        if (journal.wants_compaction(byFilename.size())) {
+            compact();
+        }
+    }
+
+    void HashIndex::add(const HashRecord &record)
+    {
+        if (const auto iter = byFilename.find(record.filename); iter != byFilename.end()) {
+            const auto &known = iter->second;
+            if (known.checksum == record.checksum and known.size == record.size and
+                known.modified == record.modified) {
+                return;
+            }
+            erase(record.filename);
+        }
+        insert(record);
+        journal.append(added_record(record));
+    }
+
+    void HashIndex::remove(const std::filesystem::path &filename)
+    {
+        if (erase(filename)) {
+            journal.append(journal_record("- %s", filename.c_str()));
+        }
+    }
+
+    void HashIndex::rename(const std::filesystem::path &from, const std::filesystem::path &to)
+    {
+        const auto iter = byFilename.find(from);
+        if (iter == byFilename.end()) {
+            remove(to);
+            return;
+        }
+        auto record     = iter->second;
+        record.filename = to;
+        remove(from);
+        add(record);
+    }
+
+    std::vector<HashRecord> HashIndex::find(std::uint32_t checksum, std::uint64_t size) const
+    {
+        std::vector<HashRecord> found;
+        const auto [first, last] = byChecksum.equal_range(checksum);
+        for (auto iter = first; iter != last; ++iter) {
+            const auto &record = byFilename.at(iter->second);
+            if (record.size == size) {
+                found.push_back(record);
+            }
+        }
+        return found;
+    }
+
+    void HashIndex::flush()
+    {
+        journal.flush();
+    }
+
+    void HashIndex::insert(const HashRecord &record)
+    {
+        erase(record.filename);
+        byFilename.emplace(record.filename, record);
+        byChecksum.emplace(record.checksum, record.filename);
+    }
+
+    bool HashIndex::erase(const std::filesystem::path &filename)
+    {
+        const auto iter = byFilename.find(filename);
+        if (iter == byFilename.end()) {
+            return false;
+        }
+        const auto [first, last] = byChecksum.equal_range(iter->second.checksum);
+        for (auto checksumIter = first; checksumIter != last; ++checksumIter) {
+            if (checksumIter->second == filename) {
+                byChecksum.erase(checksumIter);
+                break;
+            }
+        }
+        byFilename.erase(iter);
+        return true;
+    }
+
+    void HashIndex::compact()
+    {
+        journal.rewrite([this](const Journal::Append &append) {
+            for (const auto &[filename, record] : byFilename) {
+                append(added_record(record));
+            }
+        });
+    }
+} // namespace mtp
@@ -0,0 +1,60 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include "mtp_journal.hpp"
+
+namespace mtp
+{
+    /// Content of a single file as known to HashIndex
+    struct HashRecord
+    {
+        std::filesystem::path filename;
+        std::uint32_t checksum;
+        std::uint64_t size;
+        std::time_t modified;
+    };
+
+    /// HashIndex maps content checksums to files holding that content. It survives restarts as an append-only
+    /// journal. Records aren't validated here, size and modification time kept with each let the caller tell
+    /// whether the file still holds recorded content.
+    class HashIndex
+    {
+      public:
+        explicit HashIndex(std::filesystem::path journal);
+
+        /// Replay journal. It's rewritten when superseded records outnumber live ones.
+        void load();
+
+        /// Remember content of the file, replacing its previous record.
+        void add(const HashRecord &record);
+
+        /// Forget the file.
+        void remove(const std::filesystem::path &filename);
+
+        /// Move record of the file to a new name, content stays the same.
+        void rename(const std::filesystem::path &from, const std::filesystem::path &to);
+
+        /// Records of all files with given content.
+        std::vector<HashRecord> find(std::uint32_t checksum, std::uint64_t size) const;
+
+        /// Write changes buffered since the last flush. Ones lost on power failure only make the index miss
+        /// content or keep stale records, which callers tell apart anyway.
+        void flush();
+
+      private:
+        void insert(const HashRecord &record);
+        bool erase(const std::filesystem::path &filename);
+        void compact();
+
+        Journal journal;
+        std::map<std::filesystem::path, HashRecord> byFilename;
+        std::multimap<std::uint32_t, std::filesystem::path> byChecksum;
+    };
+} // namespace mtp
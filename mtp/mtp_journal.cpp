@@ -0,0 +1,135 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+#include <vector>
+#include "log.hpp"
+#include "mtp_journal.hpp"
+
+namespace mtp
+{
+    namespace
+    {
+        constexpr auto compact_min_records = 64U;
+        // About a flash page, records past it are written right away
+        constexpr auto flush_size = 4096U;
+    } // namespace
+
+    Journal::Journal(std::filesystem::path path, const char *name) : path(std::move(path)), name(name)
+    {}
+
+    Journal::~Journal()
+    {
+        flush();
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+    }
+
+    bool Journal::replay(const std::function<void(char *record)> &read)
+    {
+        records = 0;
+        pending.clear();
+
+        const auto in = std::fopen(path.c_str(), "r");
+        if (in == nullptr) {
+            return false;
+        }
+        // Line buffers are kept off MTP task's stack
+        std::vector<char> line(line_max);
+        while (std::fgets(line.data(), static_cast<int>(line.size()), in) != nullptr) {
+            line[std::strcspn(line.data(), "\n")] = '\0';
+            read(line.data());
+            ++records;
+        }
+        std::fclose(in);
+        return true;
+    }
+
+    void Journal::append(const std::string &record)
+    {
+        pending += record;
+        pending += '\n';
+        ++records;
+        if (pending.size() >= flush_size) {
+            flush();
+        }
+    }
+
+    void Journal::flush()
+    {
+        if (pending.empty()) {
+            return;
+        }
+        const auto out = open_for_append();
+        if (out == nullptr or std::fwrite(pending.data(), 1, pending.size(), out) != pending.size() or
+            std::fflush(out) != 0) {
+            log_error("%s: unable to write %s, errno %d", name, path.c_str(), errno);
+        }
+        pending.clear();
+    }
+
+    bool Journal::wants_compaction(std::size_t live) const
+    {
+        return records > compact_min_records and records > 2 * live;
+    }
+
+    // Live records go to a new journal which then replaces the old one
+    bool Journal::rewrite(const std::function<void(const Append &append)> &write)
+    {
+        auto temporary = path;
+        temporary += ".tmp";
+
+        const auto out = std::fopen(temporary.c_str(), "w");
+        if (out == nullptr) {
+            log_error("%s: unable to open %s, errno %d", name, temporary.c_str(), errno);
+            return false;
+        }
+        bool written      = true;
+        std::size_t count = 0;
+        write([out, &written, &count](const std::string &record) {
+            written = written and std::fprintf(out, "%s\n", record.c_str()) > 0;
+            ++count;
+        });
+        written = (std::fclose(out) == 0) and written;
+
+        if (file != nullptr) {
+            std::fclose(file);
+            file = nullptr;
+        }
+        if (not written or std::rename(temporary.c_str(), path.c_str()) != 0) {
+            log_error("%s: rewrite failed, errno %d", name, errno);
+            std::remove(temporary.c_str());
+            return false;
+        }
+        pending.clear();
+        records = count;
+        log_debug("%s: rewritten with %u records", name, static_cast<unsigned>(records));
+        return true;
+    }
+
+    std::FILE *Journal::open_for_append()
+    {
+        if (file == nullptr) {
+            file = std::fopen(path.c_str(), "a");
+        }
+        return file;
+    }
+
+    std::string journal_record(const char *format, ...)
+    {
+        std::string record(Journal::line_max, '\0');
+        va_list args;
+        va_start(args, format);
+        const auto length = std::vsnprintf(record.data(), record.size(), format, args);
+        va_end(args);
+        if (length < 0) {
+            return std::string();
+        }
+        record.resize(std::min<std::size_t>(length, record.size() - 1));
+        return record;
+    }
+} // namespace mtp
@@ -0,0 +1,59 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+namespace mtp
+{
+    /// Journal is an append-only text file of records, one per line, which an index replays on start. Appended
+    /// records are buffered and written together by flush, the file stays open between flushes, so a burst of
+    /// changes costs one write. Index rewrites the journal with its live records once superseded ones outnumber
+    /// them.
+    class Journal
+    {
+      public:
+        static constexpr std::size_t line_max = 512;
+
+        using Append = std::function<void(const std::string &record)>;
+
+        /// Name is used in logs only.
+        Journal(std::filesystem::path path, const char *name);
+        ~Journal();
+        Journal(const Journal &)            = delete;
+        Journal &operator=(const Journal &) = delete;
+
+        /// Pass each record to read, without newline. Returns false when there's no journal.
+        bool replay(const std::function<void(char *record)> &read);
+
+        /// Buffer the record, it's written by the next flush. Flushed at once when enough of them piled up.
+        void append(const std::string &record);
+
+        /// Write buffered records.
+        void flush();
+
+        /// Whether superseded records outnumber live ones enough to rewrite the journal.
+        bool wants_compaction(std::size_t live) const;
+
+        /// Replace journal with records passed to append by write. Buffered records are dropped, written ones are
+        /// supposed to cover them.
+        bool rewrite(const std::function<void(const Append &append)> &write);
+
+      private:
+        std::FILE *open_for_append();
+
+        std::filesystem::path path;
+        const char *name;
+        std::FILE *file = nullptr;
+        std::string pending;
+        std::size_t records = 0;
+    };
+
+    /// Record formatted like printf, cut to fit Journal::line_max.
+    std::string journal_record(const char *format, ...) __attribute__((format(printf, 1, 2)));
+} // namespace mtp
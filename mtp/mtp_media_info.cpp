@@ -0,0 +1,509 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <vector>
+#include "mtp_media_info.hpp"
+
+namespace mtp
+{
+    namespace
+    {
+        // Longer text is cut, MTP strings don't take more anyway
+        constexpr auto text_max = 255U;
+        // Each header piece is a separate read, skipped payload doesn't count
+        constexpr auto reads_max = 256U;
+
+        class HeaderReader
+        {
+          public:
+            HeaderReader(std::FILE *file, std::uint64_t size, std::size_t limit)
+                : file(file), fileSize(size), bytesLeft(limit)
+            {}
+
+            bool read(std::uint64_t offset, void *data, std::size_t length)
+            {
+                if (readsLeft == 0 or length > bytesLeft or offset > fileSize or length > fileSize - offset) {
+                    return false;
+                }
+                --readsLeft;
+                bytesLeft -= length;
+                return std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0 and
+                       std::fread(data, 1, length, file) == length;
+            }
+
+            std::uint64_t size() const
+            {
+                return fileSize;
+            }
+
+          private:
+            std::FILE *file;
+            std::uint64_t fileSize;
+            std::size_t bytesLeft;
+            std::size_t readsLeft = reads_max;
+        };
+
+        std::uint32_t be16(const std::uint8_t *data)
+        {
+            return (data[0] << 8) | data[1];
+        }
+
+        std::uint32_t be24(const std::uint8_t *data)
+        {
+            return (data[0] << 16) | (data[1] << 8) | data[2];
+        }
+
+        std::uint32_t be32(const std::uint8_t *data)
+        {
+            return (static_cast<std::uint32_t>(data[0]) << 24) | be24(&data[1]);
+        }
+
+        std::uint32_t le16(const std::uint8_t *data)
+        {
+            return data[0] | (data[1] << 8);
+        }
+
+        std::uint32_t le32(const std::uint8_t *data)
+        {
+            return le16(data) | (static_cast<std::uint32_t>(le16(&data[2])) << 16);
+        }
+
+        std::uint32_t syncsafe32(const std::uint8_t *data)
+        {
+            return ((data[0] & 0x7f) << 21) | ((data[1] & 0x7f) << 14) | ((data[2] & 0x7f) << 7) | (data[3] & 0x7f);
+        }
+
+        bool append_utf8(std::string &text, std::uint32_t codepoint)
+        {
+            char encoded[4];
+            std::size_t length;
+            if (codepoint < 0x80) {
+                encoded[0] = static_cast<char>(codepoint);
+                length     = 1;
+            }
+            else if (codepoint < 0x800) {
+                encoded[0] = static_cast<char>(0xc0 | (codepoint >> 6));
+                encoded[1] = static_cast<char>(0x80 | (codepoint & 0x3f));
+                length     = 2;
+            }
+            else if (codepoint < 0x10000) {
+                encoded[0] = static_cast<char>(0xe0 | (codepoint >> 12));
+                encoded[1] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+                encoded[2] = static_cast<char>(0x80 | (codepoint & 0x3f));
+                length     = 3;
+            }
+            else {
+                encoded[0] = static_cast<char>(0xf0 | (codepoint >> 18));
+                encoded[1] = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+                encoded[2] = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+                encoded[3] = static_cast<char>(0x80 | (codepoint & 0x3f));
+                length     = 4;
+            }
+            if (text.size() + length > text_max) {
+                return false;
+            }
+            text.append(encoded, length);
+            return true;
+        }
+
+        std::string latin1_text(const std::uint8_t *data, std::size_t length)
+        {
+            std::string text;
+            for (std::size_t i = 0; i < length and data[i] != 0 and append_utf8(text, data[i]); ++i) {}
+            return text;
+        }
+
+        // Without byte order mark it's big endian
+        std::string utf16_text(const std::uint8_t *data, std::size_t length, bool bigEndian)
+        {
+            if (length >= 2 and ((data[0] == 0xff and data[1] == 0xfe) or (data[0] == 0xfe and data[1] == 0xff))) {
+                bigEndian = data[0] == 0xfe;
+                data += 2;
+                length -= 2;
+            }
+            std::string text;
+            for (std::size_t i = 0; i + 1 < length; i += 2) {
+                std::uint32_t codepoint = bigEndian ? be16(&data[i]) : le16(&data[i]);
+                if (codepoint == 0) {
+                    break;
+                }
+                if (codepoint >= 0xd800 and codepoint < 0xdc00 and i + 3 < length) {
+                    const auto low = bigEndian ? be16(&data[i + 2]) : le16(&data[i + 2]);
+                    codepoint      = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+                    i += 2;
+                }
+                if (not append_utf8(text, codepoint)) {
+                    break;
+                }
+            }
+            return text;
+        }
+
+        // Cut at character boundary
+        std::string utf8_text(const std::uint8_t *data, std::size_t length)
+        {
+            length = strnlen(reinterpret_cast<const char *>(data), length);
+            if (length > text_max) {
+                length = text_max;
+                while (length > 0 and (data[length] & 0xc0) == 0x80) {
+                    --length;
+                }
+            }
+            return std::string(reinterpret_cast<const char *>(data), length);
+        }
+
+        // Only the first of multiple values is taken
+        std::string id3_text(const std::uint8_t *data, std::size_t length)
+        {
+            if (length < 1) {
+                return {};
+            }
+            switch (data[0]) {
+            case 0:
+                return latin1_text(&data[1], length - 1);
+            case 1:
+                return utf16_text(&data[1], length - 1, false);
+            case 2:
+                return utf16_text(&data[1], length - 1, true);
+            case 3:
+                return utf8_text(&data[1], length - 1);
+            default:
+                return {};
+            }
+        }
+
+        enum class Field
+        {
+            none,
+            artist,
+            album,
+            albumArtist,
+            genre,
+            track,
+            duration,
+        };
+
+        struct FrameId
+        {
+            const char *id;
+            const char *id22; // ID3v2.2 uses three character identifiers
+            Field field;
+        };
+
+        constexpr FrameId id3_frames[] = {
+            {"TPE1", "TP1", Field::artist},
+            {"TALB", "TAL", Field::album},
+            {"TPE2", "TP2", Field::albumArtist},
+            {"TCON", "TCO", Field::genre},
+            {"TRCK", "TRK", Field::track},
+            {"TLEN", "TLE", Field::duration},
+        };
+
+        Field id3_field(const std::uint8_t *id, unsigned version)
+        {
+            for (const auto &frame : id3_frames) {
+                const auto known = (version == 2) ? frame.id22 : frame.id;
+                if (std::memcmp(id, known, std::strlen(known)) == 0) {
+                    return frame.field;
+                }
+            }
+            return Field::none;
+        }
+
+        void set_field(MediaInfo &info, Field field, std::string text)
+        {
+            switch (field) {
+            case Field::artist:
+                info.artist = std::move(text);
+                break;
+            case Field::album:
+                info.album = std::move(text);
+                break;
+            case Field::albumArtist:
+                info.albumArtist = std::move(text);
+                break;
+            case Field::genre:
+                info.genre = std::move(text);
+                break;
+            case Field::track:
+                // "3/12" is track 3 of 12
+                info.track = static_cast<std::uint16_t>(std::strtoul(text.c_str(), nullptr, 10));
+                break;
+            case Field::duration:
+                info.duration = static_cast<std::uint32_t>(std::strtoul(text.c_str(), nullptr, 10));
+                break;
+            case Field::none:
+                break;
+            }
+        }
+
+        // Returns offset of data following the tag, 0 if there's no tag
+        std::uint64_t read_id3v2(HeaderReader &reader, MediaInfo &info)
+        {
+            std::uint8_t header[10];
+            if (not reader.read(0, header, sizeof(header)) or std::memcmp(header, "ID3", 3) != 0) {
+                return 0;
+            }
+            const unsigned version = header[3];
+            const auto flags       = header[5];
+            const std::uint64_t end = sizeof(header) + syncsafe32(&header[6]);
+            const auto next         = end + ((version == 4 and (flags & 0x10)) ? 10 : 0);
+            // Unsynchronised tag of older versions would have to be decoded as a whole
+            if (version < 2 or version > 4 or (version < 4 and (flags & 0x80))) {
+                return next;
+            }
+
+            std::uint64_t offset = sizeof(header);
+            if (version > 2 and (flags & 0x40)) {
+                std::uint8_t extended[4];
+                if (not reader.read(offset, extended, sizeof(extended))) {
+                    return next;
+                }
+                offset += (version == 3) ? 4 + be32(extended) : syncsafe32(extended);
+            }
+
+            const std::size_t frameHeaderSize = (version == 2) ? 6 : 10;
+            while (offset + frameHeaderSize <= end) {
+                std::uint8_t frame[10];
+                if (not reader.read(offset, frame, frameHeaderSize) or frame[0] == 0) {
+                    break;
+                }
+                const std::uint32_t size = (version == 2)   ? be24(&frame[3])
+                                           : (version == 3) ? be32(&frame[4])
+                                                            : syncsafe32(&frame[4]);
+                const auto data = offset + frameHeaderSize;
+                if (size == 0 or data + size > end) {
+                    break;
+                }
+                // Compressed, encrypted or unsynchronised frame is skipped
+                const bool plain = (version == 2) or (version == 3 and (frame[9] & 0xc0) == 0) or
+                                   (version == 4 and (frame[9] & 0x0e) == 0);
+                if (const auto field = id3_field(frame, version); field != Field::none and plain) {
+                    // Too big for MTP task's stack
+                    std::vector<std::uint8_t> text(std::min<std::size_t>(size, 1 + 2 * text_max + 2));
+                    if (reader.read(data, text.data(), text.size())) {
+                        set_field(info, field, id3_text(text.data(), text.size()));
+                    }
+                }
+                offset = data + size;
+            }
+            return next;
+        }
+
+        // Duration of MPEG audio Layer III stream, from Xing/Info or VBRI frame count, bit rate of the first frame
+        // otherwise
+        void read_mpeg_duration(HeaderReader &reader, std::uint64_t offset, MediaInfo &info)
+        {
+            constexpr std::uint16_t bitrates_v1[]  = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+            constexpr std::uint16_t bitrates_v2[]  = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+            constexpr std::uint32_t samplerates[] = {44100, 48000, 32000};
+
+            std::uint8_t frame[4];
+            if (not reader.read(offset, frame, sizeof(frame)) or frame[0] != 0xff or (frame[1] & 0xe0) != 0xe0) {
+                return;
+            }
+            const auto version       = (frame[1] >> 3) & 0x03; // 3: MPEG-1, 2: MPEG-2, 0: MPEG-2.5
+            const auto layer         = (frame[1] >> 1) & 0x03; // 1: Layer III
+            const auto bitrateIndex  = frame[2] >> 4;
+            const auto samplingIndex = (frame[2] >> 2) & 0x03;
+            if (version == 1 or layer != 1 or bitrateIndex == 0 or bitrateIndex == 15 or samplingIndex == 3) {
+                return;
+            }
+            const bool mpeg1         = version == 3;
+            const bool mono          = (frame[3] >> 6) == 3;
+            const auto samplerate    = samplerates[samplingIndex] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+            const auto samplesPerFrame = mpeg1 ? 1152U : 576U;
+            const auto bitrate       = (mpeg1 ? bitrates_v1 : bitrates_v2)[bitrateIndex];
+
+            std::uint8_t tag[12];
+            const auto sideInfoSize = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+            std::uint32_t frames    = 0;
+            if (reader.read(offset + 4 + sideInfoSize, tag, sizeof(tag)) and
+                (std::memcmp(tag, "Xing", 4) == 0 or std::memcmp(tag, "Info", 4) == 0) and (be32(&tag[4]) & 0x01)) {
+                frames = be32(&tag[8]);
+            }
+            else if (reader.read(offset + 4 + 32, tag, sizeof(tag)) and std::memcmp(tag, "VBRI", 4) == 0 and
+                     reader.read(offset + 4 + 32 + 14, tag, 4)) {
+                frames = be32(tag);
+            }
+
+            if (frames != 0) {
+                info.duration = static_cast<std::uint32_t>(static_cast<std::uint64_t>(frames) * samplesPerFrame *
+                                                           1000 / samplerate);
+            }
+            else {
+                info.duration = static_cast<std::uint32_t>((reader.size() - offset) * 8 / bitrate);
+            }
+        }
+
+        void read_mp3(HeaderReader &reader, MediaInfo &info)
+        {
+            const auto audio = read_id3v2(reader, info);
+            if (info.duration == 0) {
+                read_mpeg_duration(reader, audio, info);
+            }
+        }
+
+        void read_vorbis_comments(HeaderReader &reader, std::uint64_t offset, std::uint64_t end, MediaInfo &info)
+        {
+            constexpr struct
+            {
+                const char *key;
+                Field field;
+            } keys[] = {
+                {"ARTIST", Field::artist},
+                {"ALBUM", Field::album},
+                {"ALBUMARTIST", Field::albumArtist},
+                {"GENRE", Field::genre},
+                {"TRACKNUMBER", Field::track},
+            };
+
+            std::uint8_t word[4];
+            if (not reader.read(offset, word, sizeof(word))) {
+                return;
+            }
+            offset += 4 + le32(word);
+            if (offset + 4 > end or not reader.read(offset, word, sizeof(word))) {
+                return;
+            }
+            auto count = le32(word);
+            offset += 4;
+
+            for (; count > 0 and offset + 4 <= end; --count) {
+                if (not reader.read(offset, word, sizeof(word))) {
+                    return;
+                }
+                const auto length = le32(word);
+                offset += 4;
+                if (offset + length > end) {
+                    return;
+                }
+                const auto taken = std::min<std::size_t>(length, 16 + text_max - 1);
+                std::vector<std::uint8_t> buffer(taken + 1);
+                const auto comment = buffer.data();
+                if (reader.read(offset, comment, taken)) {
+                    comment[taken] = 0;
+                    const auto separator =
+                        static_cast<std::uint8_t *>(std::memchr(comment, '=', taken));
+                    for (const auto &key : keys) {
+                        if (separator != nullptr and
+                            static_cast<std::size_t>(separator - comment) == std::strlen(key.key) and
+                            strncasecmp(reinterpret_cast<char *>(comment), key.key, separator - comment) == 0) {
+                            set_field(info, key.field, utf8_text(separator + 1, &comment[taken] - separator - 1));
+                        }
+                    }
+                }
+                offset += length;
+            }
+        }
+
+        void read_flac(HeaderReader &reader, MediaInfo &info)
+        {
+            std::uint64_t offset = read_id3v2(reader, info);
+            std::uint8_t header[4];
+            if (not reader.read(offset, header, sizeof(header)) or std::memcmp(header, "fLaC", 4) != 0) {
+                return;
+            }
+            offset += sizeof(header);
+
+            bool last = false;
+            while (not last and reader.read(offset, header, sizeof(header))) {
+                last              = header[0] & 0x80;
+                const auto type   = header[0] & 0x7f;
+                const auto length = be24(&header[1]);
+                offset += sizeof(header);
+                if (type == 0) {
+                    std::uint8_t streaminfo[18];
+                    if (length >= sizeof(streaminfo) and reader.read(offset, streaminfo, sizeof(streaminfo))) {
+                        const auto samplerate = (streaminfo[10] << 12) | (streaminfo[11] << 4) | (streaminfo[12] >> 4);
+                        const auto samples =
+                            (static_cast<std::uint64_t>(streaminfo[13] & 0x0f) << 32) | be32(&streaminfo[14]);
+                        if (samplerate != 0) {
+                            info.duration = static_cast<std::uint32_t>(samples * 1000 / samplerate);
+                        }
+                    }
+                }
+                else if (type == 4) {
+                    read_vorbis_comments(reader, offset, offset + length, info);
+                }
+                offset += length;
+            }
+        }
+
+        void read_wav(HeaderReader &reader, MediaInfo &info)
+        {
+            std::uint8_t header[12];
+            if (not reader.read(0, header, sizeof(header)) or std::memcmp(header, "RIFF", 4) != 0 or
+                std::memcmp(&header[8], "WAVE", 4) != 0) {
+                return;
+            }
+            std::uint64_t offset  = sizeof(header);
+            std::uint32_t byteRate = 0;
+            std::uint8_t chunk[12];
+            while (reader.read(offset, chunk, 8)) {
+                const auto length = le32(&chunk[4]);
+                if (std::memcmp(chunk, "fmt ", 4) == 0 and length >= 12 and reader.read(offset + 8, chunk, 12)) {
+                    byteRate = le32(&chunk[8]);
+                }
+                else if (std::memcmp(chunk, "data", 4) == 0) {
+                    if (byteRate != 0) {
+                        info.duration = static_cast<std::uint32_t>(static_cast<std::uint64_t>(length) * 1000 / byteRate);
+                    }
+                    return;
+                }
+                offset += 8 + length + (length & 1);
+            }
+        }
+
+        // Dimensions come from the frame header, EXIF ones may be missing or describe a thumbnail
+        void read_jpeg(HeaderReader &reader, MediaInfo &info)
+        {
+            std::uint8_t segment[9];
+            if (not reader.read(0, segment, 2) or segment[0] != 0xff or segment[1] != 0xd8) {
+                return;
+            }
+            std::uint64_t offset = 2;
+            while (reader.read(offset, segment, 4) and segment[0] == 0xff) {
+                const auto marker = segment[1];
+                if (marker == 0xd9 or marker == 0xda) {
+                    return;
+                }
+                const bool frame = marker >= 0xc0 and marker <= 0xcf and marker != 0xc4 and marker != 0xc8 and
+                                   marker != 0xcc;
+                if (frame) {
+                    if (reader.read(offset + 4, segment, 5)) {
+                        info.height = be16(&segment[1]);
+                        info.width  = be16(&segment[3]);
+                    }
+                    return;
+                }
+                offset += 2 + be16(&segment[2]);
+            }
+        }
+    } // namespace
+
+    MediaInfo read_media_info(std::FILE *file, std::uint64_t size, MediaFormat format, std::size_t read_limit)
+    {
+        MediaInfo info;
+        HeaderReader reader(file, size, read_limit);
+        switch (format) {
+        case MediaFormat::mp3:
+            read_mp3(reader, info);
+            break;
+        case MediaFormat::flac:
+            read_flac(reader, info);
+            break;
+        case MediaFormat::wav:
+            read_wav(reader, info);
+            break;
+        case MediaFormat::jpeg:
+            read_jpeg(reader, info);
+            break;
+        }
+        return info;
+    }
+} // namespace mtp
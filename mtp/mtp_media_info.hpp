@@ -0,0 +1,37 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace mtp
+{
+    /// Metadata of media file, as much of it as was found in its headers
+    struct MediaInfo
+    {
+        std::string artist;
+        std::string album;
+        std::string albumArtist;
+        std::string genre;
+        std::uint32_t duration = 0; ///< milliseconds
+        std::uint16_t track    = 0;
+        std::uint32_t width    = 0;
+        std::uint32_t height   = 0;
+    };
+
+    enum class MediaFormat
+    {
+        mp3,
+        flac,
+        wav,
+        jpeg,
+    };
+
+    /// Read ID3v2 tags and MPEG frame header of MP3, STREAMINFO and Vorbis comments of FLAC, format chunk of WAV or
+    /// SOF segment of JPEG. Headers are read in bounded pieces, payload between them is skipped, so at most
+    /// read_limit bytes are read whatever the file size is. Text is UTF-8.
+    MediaInfo read_media_info(std::FILE *file, std::uint64_t size, MediaFormat format, std::size_t read_limit);
+} // namespace mtp
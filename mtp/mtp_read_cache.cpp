@@ -0,0 +1,89 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "mtp_read_cache.hpp"
+
+namespace mtp
+{
+    ReadCache::ReadCache(std::size_t blockSize, std::size_t blockCount) : blockSize(blockSize)
+    {
+        for (std::size_t i = 0; i < blockCount; ++i) {
+            blocks.push_back(Block{{0, 0}, 0, {}, std::make_unique<char[]>(blockSize)});
+        }
+    }
+
+    // All cached blocks of a file have the same version, the first one is checked
+    void ReadCache::validate(Handle handle, std::uint64_t size, std::time_t modified)
+    {
+        const auto version = Version{size, modified};
+        if (const auto iter = byKey.lower_bound({handle, 0});
+            iter != byKey.end() and iter->first.first == handle and iter->second->version != version) {
+            invalidate(handle);
+        }
+        validated = {handle, version};
+    }
+
+    std::size_t ReadCache::read(Handle handle, std::uint64_t offset, void *buffer, std::size_t count)
+    {
+        const auto blockOffset = offset - offset % blockSize;
+        const auto iter        = byKey.find({handle, blockOffset});
+        if (iter == byKey.end()) {
+            ++missCount;
+            return 0;
+        }
+        const auto block   = iter->second;
+        const auto skipped = static_cast<std::size_t>(offset - blockOffset);
+        if (skipped >= block->length) {
+            ++missCount;
+            return 0;
+        }
+        const auto copied = std::min(count, block->length - skipped);
+        std::memcpy(buffer, block->data.get() + skipped, copied);
+        blocks.splice(blocks.begin(), blocks, block);
+        ++hitCount;
+        return copied;
+    }
+
+    char *ReadCache::prepare(Handle handle, std::uint64_t offset)
+    {
+        const auto block = std::prev(blocks.end());
+        release(block);
+        block->key     = {handle, offset};
+        block->version = (validated.first == handle) ? validated.second : Version{};
+        blocks.splice(blocks.begin(), blocks, block);
+        return block->data.get();
+    }
+
+    void ReadCache::fill(std::size_t length)
+    {
+        const auto block = blocks.begin();
+        block->length    = std::min(length, blockSize);
+        if (block->length != 0) {
+            byKey[block->key] = block;
+        }
+    }
+
+    void ReadCache::invalidate(Handle handle)
+    {
+        for (auto block = blocks.begin(); block != blocks.end();) {
+            const auto next = std::next(block);
+            if (block->length != 0 and block->key.first == handle) {
+                release(block);
+                blocks.splice(blocks.end(), blocks, block);
+            }
+            block = next;
+        }
+    }
+
+    // Free block goes to the end of the list, it's taken first
+    void ReadCache::release(std::list<Block>::iterator block)
+    {
+        if (block->length != 0) {
+            byKey.erase(block->key);
+            block->length = 0;
+        }
+    }
+} // namespace mtp
@@ -0,0 +1,79 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace mtp
+{
+    /// ReadCache keeps fixed number of equally sized blocks of file data, keyed by object handle and offset.
+    /// When all blocks are taken, the least recently used one is given to new data. Memory is allocated once, at
+    /// construction.
+    class ReadCache
+    {
+      public:
+        using Handle = std::uint32_t;
+
+        ReadCache(std::size_t blockSize, std::size_t blockCount);
+
+        /// Forget blocks of the file if its size or modification time differ from ones seen when they were read.
+        /// Blocks prepared afterwards for the file are tagged with this version.
+        void validate(Handle handle, std::uint64_t size, std::time_t modified);
+
+        /// Copy data at offset from cached block, counting hit or miss. Returns number of bytes copied, up to the end
+        /// of the block, 0 if it isn't cached.
+        std::size_t read(Handle handle, std::uint64_t offset, void *buffer, std::size_t count);
+
+        /// Take the least recently used block for data at block aligned offset. Returns buffer of blockSize bytes
+        /// to read the data into, block is cached only once fill is called.
+        char *prepare(Handle handle, std::uint64_t offset);
+
+        /// Cache block returned by last prepare, holding given number of bytes.
+        void fill(std::size_t length);
+
+        /// Forget all blocks of the file.
+        void invalidate(Handle handle);
+
+        std::size_t block_size() const
+        {
+            return blockSize;
+        }
+
+        std::uint32_t hits() const
+        {
+            return hitCount;
+        }
+
+        std::uint32_t misses() const
+        {
+            return missCount;
+        }
+
+      private:
+        using Key     = std::pair<Handle, std::uint64_t>;
+        using Version = std::pair<std::uint64_t, std::time_t>;
+
+        struct Block
+        {
+            Key key;
+            std::size_t length;
+            Version version;
+            std::unique_ptr<char[]> data;
+        };
+
+        void release(std::list<Block>::iterator block);
+
+        const std::size_t blockSize;
+        std::list<Block> blocks; // most recently used first, free ones have length 0
+        std::map<Key, std::list<Block>::iterator> byKey;
+        std::pair<Handle, Version> validated{};
+        std::uint32_t hitCount  = 0;
+        std::uint32_t missCount = 0;
+    };
+} // namespace mtp
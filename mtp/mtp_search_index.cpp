@@ -0,0 +1,230 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "log.hpp"
+#include "mtp_search_index.hpp"
+
+namespace mtp
+{
+    namespace
+    {
+        // UTF-8 bytes of other characters are left as they are
+        std::string to_key(const std::string &name)
+        {
+            std::string key(name);
+            std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+                return (c >= 'A' and c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+            });
+            return key;
+        }
+
+        bool name_matches(SearchQuery::NameMatch match, std::string_view key, std::string_view pattern)
+        {
+            switch (match) {
+            case SearchQuery::NameMatch::prefix:
+                return key.substr(0, pattern.size()) == pattern;
+            case SearchQuery::NameMatch::substring:
+                return key.find(pattern) != std::string_view::npos;
+            case SearchQuery::NameMatch::suffix:
+                return key.size() >= pattern.size() and key.substr(key.size() - pattern.size()) == pattern;
+            default:
+                return true;
+            }
+        }
+
+        // Name of query is a key already
+        bool key_matches(const SearchQuery &query,
+                         std::string_view key,
+                         std::uint64_t size,
+                         std::time_t modified,
+                         std::uint16_t format)
+        {
+            return (query.format == 0 or format == query.format) and size >= query.sizeMin and
+                   size <= query.sizeMax and modified >= query.modifiedFrom and modified <= query.modifiedTo and
+                   name_matches(query.nameMatch, key, query.name);
+        }
+
+        template <typename Column> void insert(Column &column, const typename Column::value_type &item)
+        {
+            column.insert(std::lower_bound(column.begin(), column.end(), item), item);
+        }
+
+        template <typename Column> void erase(Column &column, const typename Column::value_type &item)
+        {
+            const auto at = std::lower_bound(column.begin(), column.end(), item);
+            if (at != column.end() and *at == item) {
+                column.erase(at);
+            }
+        }
+
+        // Items with key in [low, high]
+        template <typename Column, typename Key> auto key_range(const Column &column, Key low, Key high)
+        {
+            const auto first = std::lower_bound(
+                column.begin(), column.end(), low, [](const auto &item, Key key) { return item.first < key; });
+            const auto last = std::upper_bound(
+                first, column.end(), high, [](Key key, const auto &item) { return key < item.first; });
+            return std::make_pair(first, last);
+        }
+
+        // Names sharing the prefix are next to each other
+        template <typename Column> auto prefix_range(const Column &column, std::string_view prefix)
+        {
+            const auto first = std::lower_bound(
+                column.begin(), column.end(), prefix, [](const auto &item, std::string_view key) {
+                    return item.first < key;
+                });
+            const auto last =
+                std::upper_bound(first, column.end(), prefix, [](std::string_view key, const auto &item) {
+                    return key < item.first.substr(0, key.size());
+                });
+            return std::make_pair(first, last);
+        }
+    } // namespace
+
+    SearchIndex::SearchIndex(std::filesystem::path root, Filter hidden, Classify format)
+        : root(std::move(root)), hidden(hidden), format(format)
+    {}
+
+    std::vector<std::filesystem::path> SearchIndex::find(const SearchQuery &query)
+    {
+        load();
+        auto normalized = query;
+        normalized.name = to_key(query.name);
+
+        const auto nameRange   = (normalized.nameMatch == SearchQuery::NameMatch::prefix)
+                                     ? prefix_range(byName, std::string_view(normalized.name))
+                                     : std::make_pair(byName.cbegin(), byName.cend());
+        const auto formatRange = (normalized.format != 0)
+                                     ? key_range(byFormat, normalized.format, normalized.format)
+                                     : std::make_pair(byFormat.cbegin(), byFormat.cend());
+        const auto sizeRange     = key_range(bySize, normalized.sizeMin, normalized.sizeMax);
+        const auto modifiedRange = key_range(byModified, normalized.modifiedFrom, normalized.modifiedTo);
+
+        std::vector<std::filesystem::path> found;
+        const auto collect = [&normalized, &found](const auto &range) {
+            for (auto iter = range.first; iter != range.second; ++iter) {
+                const auto &[filename, record] = *iter->second;
+                if (key_matches(normalized, record.key, record.size, record.modified, record.format)) {
+                    found.push_back(filename);
+                }
+            }
+        };
+
+        const std::size_t sizes[] = {static_cast<std::size_t>(std::distance(nameRange.first, nameRange.second)),
+                                     static_cast<std::size_t>(std::distance(formatRange.first, formatRange.second)),
+                                     static_cast<std::size_t>(std::distance(sizeRange.first, sizeRange.second)),
+                                     static_cast<std::size_t>(
+                                         std::distance(modifiedRange.first, modifiedRange.second))};
+        switch (std::distance(std::begin(sizes), std::min_element(std::begin(sizes), std::end(sizes)))) {
+        case 0:
+            collect(nameRange);
+            break;
+        case 1:
+            collect(formatRange);
+            break;
+        case 2:
+            collect(sizeRange);
+            break;
+        default:
+            collect(modifiedRange);
+            break;
+        }
+        log_debug("Search: %u of %u files checked, %u found",
+                  static_cast<unsigned>(*std::min_element(std::begin(sizes), std::end(sizes))),
+                  static_cast<unsigned>(records.size()),
+                  static_cast<unsigned>(found.size()));
+        return found;
+    }
+
+    bool SearchIndex::matches(const SearchQuery &query,
+                              const std::string &name,
+                              std::uint64_t size,
+                              std::time_t modified,
+                              std::uint16_t format)
+    {
+        auto normalized = query;
+        normalized.name = to_key(query.name);
+        return key_matches(normalized, to_key(name), size, modified, format);
+    }
+
+    void SearchIndex::update(const std::filesystem::path &filename)
+    {
+        if (not loaded) {
+            return;
+        }
+        remove(filename);
+        add(filename);
+    }
+
+    void SearchIndex::forget(const std::filesystem::path &filename)
+    {
+        if (loaded) {
+            remove(filename);
+        }
+    }
+
+    void SearchIndex::load()
+    {
+        if (loaded) {
+            return;
+        }
+        loaded         = true;
+        const auto dir = opendir(root.c_str());
+        if (dir == nullptr) {
+            log_error("Search index: unable to open %s, errno %d", root.c_str(), errno);
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (not hidden(entry->d_name)) {
+                add(entry->d_name);
+            }
+        }
+        closedir(dir);
+        log_debug("Search index: %u files", static_cast<unsigned>(records.size()));
+    }
+
+    void SearchIndex::add(const std::filesystem::path &filename)
+    {
+        struct stat statbuf
+        {};
+        if (stat((root / filename).c_str(), &statbuf) != 0 or not S_ISREG(statbuf.st_mode)) {
+            return;
+        }
+        const auto [iter, inserted] = records.try_emplace(filename,
+                                                          Record{to_key(filename.string()),
+                                                                 static_cast<std::uint64_t>(statbuf.st_size),
+                                                                 statbuf.st_mtim.tv_sec,
+                                                                 format(filename.c_str())});
+        if (not inserted) {
+            return;
+        }
+        const auto entry   = &*iter;
+        const auto &record = iter->second;
+        insert(byName, {std::string_view(record.key), entry});
+        insert(byFormat, {record.format, entry});
+        insert(bySize, {record.size, entry});
+        insert(byModified, {record.modified, entry});
+    }
+
+    void SearchIndex::remove(const std::filesystem::path &filename)
+    {
+        const auto iter = records.find(filename);
+        if (iter == records.end()) {
+            return;
+        }
+        const auto entry   = &*iter;
+        const auto &record = iter->second;
+        erase(byName, {std::string_view(record.key), entry});
+        erase(byFormat, {record.format, entry});
+        erase(bySize, {record.size, entry});
+        erase(byModified, {record.modified, entry});
+        records.erase(iter);
+    }
+} // namespace mtp
@@ -0,0 +1,92 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mtp
+{
+    /// Files wanted by the host, all given predicates have to match. Ranges are inclusive, names are matched
+    /// ignoring case of ASCII letters.
+    struct SearchQuery
+    {
+        enum class NameMatch
+        {
+            any,
+            prefix,
+            substring,
+            suffix,
+        };
+        NameMatch nameMatch = NameMatch::any;
+        std::string name;
+        std::uint16_t format     = 0; ///< 0 for any
+        std::uint64_t sizeMin    = 0;
+        std::uint64_t sizeMax    = std::numeric_limits<std::uint64_t>::max();
+        std::time_t modifiedFrom = std::numeric_limits<std::time_t>::min();
+        std::time_t modifiedTo   = std::numeric_limits<std::time_t>::max();
+    };
+
+    /// SearchIndex keeps size, modification time and format of files in sorted columns, next to their names. Query
+    /// takes the range each of its predicates selects in its column and checks only files of the narrowest one, so
+    /// it doesn't go through all files unless it selects them all. Name substring and suffix have no column, they
+    /// only filter. Directory is read on the first query, the index follows changes reported by update and forget
+    /// afterwards.
+    class SearchIndex
+    {
+      public:
+        using Filter   = bool (*)(const char *name);
+        using Classify = std::uint16_t (*)(const char *name);
+
+        SearchIndex(std::filesystem::path root, Filter hidden, Classify format);
+
+        /// Names of files matching the query.
+        std::vector<std::filesystem::path> find(const SearchQuery &query);
+
+        /// Whether a file with given attributes matches the query, e.g. for objects kept out of the index.
+        static bool matches(const SearchQuery &query,
+                            const std::string &name,
+                            std::uint64_t size,
+                            std::time_t modified,
+                            std::uint16_t format);
+
+        /// Take current state of the file, after it was written or created.
+        void update(const std::filesystem::path &filename);
+
+        /// Forget the file, after it was removed or renamed.
+        void forget(const std::filesystem::path &filename);
+
+      private:
+        struct Record
+        {
+            std::string key; ///< lowercase name
+            std::uint64_t size;
+            std::time_t modified;
+            std::uint16_t format;
+        };
+        using Entry = std::map<std::filesystem::path, Record>::value_type;
+        template <typename Key> using Column = std::vector<std::pair<Key, const Entry *>>;
+
+        void load();
+        void add(const std::filesystem::path &filename);
+        void remove(const std::filesystem::path &filename);
+
+        std::filesystem::path root;
+        Filter hidden;
+        Classify format;
+        bool loaded = false;
+        std::map<std::filesystem::path, Record> records;
+        Column<std::string_view> byName;
+        Column<std::uint16_t> byFormat;
+        Column<std::uint64_t> bySize;
+        Column<std::time_t> byModified;
+    };
+} // namespace mtp
@@ -0,0 +1,187 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iterator>
+#include "log.hpp"
+#include "mtp_uid_index.hpp"
+
+namespace mtp
+{
+    namespace
+    {
+        // Journal records: "= generation reserved", "+ serial name" or "- name"
+        constexpr auto serial_reserve = 256U;
+
+        std::string generation_record(std::uint64_t generation, std::uint64_t reserved)
+        {
+            return journal_record(
+                "= %llu %llu", static_cast<unsigned long long>(generation), static_cast<unsigned long long>(reserved));
+        }
+
+        std::string added_record(const std::filesystem::path &filename, std::uint64_t serial)
+        {
+            return journal_record("+ %llu %s", static_cast<unsigned long long>(serial), filename.c_str());
+        }
+
+        std::uint64_t read_counter(const std::filesystem::path &path)
+        {
+            unsigned long long value = 0;
+            if (const auto file = std::fopen(path.c_str(), "r"); file != nullptr) {
+                if (std::fscanf(file, "%llu", &value) != 1) {
+                    value = 0;
+                }
+                std::fclose(file);
+            }
+            return value;
+        }
+
+        void write_counter(const std::filesystem::path &path, std::uint64_t value)
+        {
+            const auto file = std::fopen(path.c_str(), "w");
+            if (file == nullptr) {
+                log_error("UID index: unable to open %s, errno %d", path.c_str(), errno);
+                return;
+            }
+            std::fprintf(file, "%llu\n", static_cast<unsigned long long>(value));
+            std::fclose(file);
+        }
+    } // namespace
+
+    UidIndex::UidIndex(std::filesystem::path journal)
+        : journal(journal, "UID index"), counter(std::move(journal += ".generation"))
+    {}
+
+    void UidIndex::load()
+    {
+        byFilename.clear();
+        generation = 0;
+        nextSerial = 1;
+        reserved   = 1;
+
+        const bool replayed = journal.replay([this](char *line) {
+            unsigned long long first;
+            unsigned long long second;
+            int name_offset = 0;
+            if (std::sscanf(line, "= %llu %llu", &first, &second) == 2) {
+                generation = first;
+                reserved   = std::max<std::uint64_t>(reserved, second);
+            }
+            else if (std::sscanf(line, "+ %llu %n", &first, &name_offset) == 1 and name_offset != 0 and
+                     line[name_offset] != '\0') {
+                byFilename[&line[name_offset]] = first;
+                nextSerial = std::max<std::uint64_t>(nextSerial, first + 1);
+            }
+            else if (line[0] == '-' and line[1] == ' ') {
+                byFilename.erase(&line[2]);
+            }
+        });
+
+        if (not replayed or generation == 0) {
+            if (replayed) {
+                log_error("UID index: no generation in journal, starting anew");
+            }
+            start_generation();
+            return;
+        }
+        // Records of reserved serials may have been lost, they count as given
+        nextSerial = std::max(nextSerial, reserved);
+        reserved   = nextSerial;
+        keep_generation();
+        log_debug("UID index: %u files, generation %llu",
+                  static_cast<unsigned>(byFilename.size()),
+                  static_cast<unsigned long long>(generation));
+        if (journal.wants_compaction(byFilename.size())) {
+            compact();
+        }
+    }
+
+    Uid UidIndex::get(const std::filesystem::path &filename)
+    {
+        if (const auto iter = byFilename.find(filename); iter != byFilename.end()) {
+            return {iter->second, generation};
+        }
+        if (nextSerial >= reserved) {
+            reserve();
+        }
+        const auto serial = nextSerial++;
+        byFilename.emplace(filename, serial);
+        journal.append(added_record(filename, serial));
+        return {serial, generation};
+    }
+
+    // Identifier moved or dropped mustn't come back after power failure, such records are written at once
+    void UidIndex::remove(const std::filesystem::path &filename)
+    {
+        if (byFilename.erase(filename) != 0) {
+            journal.append(journal_record("- %s", filename.c_str()));
+            journal.flush();
+        }
+    }
+
+    void UidIndex::rename(const std::filesystem::path &from, const std::filesystem::path &to)
+    {
+        const auto iter = byFilename.find(from);
+        if (iter == byFilename.end()) {
+            remove(to);
+            return;
+        }
+        const auto serial = iter->second;
+        byFilename.erase(iter);
+        journal.append(journal_record("- %s", from.c_str()));
+        byFilename[to] = serial;
+        journal.append(added_record(to, serial));
+        journal.flush();
+    }
+
+    void UidIndex::flush()
+    {
+        journal.flush();
+    }
+
+    // Index without a journal can't tell which serials were given, new generation keeps identifiers unique
+    void UidIndex::start_generation()
+    {
+        byFilename.clear();
+        generation = std::max(read_counter(counter), generation) + 1;
+        nextSerial = 1;
+        reserved   = 1;
+        write_counter(counter, generation);
+        journal.rewrite([this](const Journal::Append &append) { append(generation_record(generation, reserved)); });
+        log_debug("UID index: generation %llu", static_cast<unsigned long long>(generation));
+    }
+
+    // Counter lost along with the journal would give its generation again
+    void UidIndex::keep_generation()
+    {
+        if (read_counter(counter) < generation) {
+            write_counter(counter, generation);
+        }
+    }
+
+    void UidIndex::reserve()
+    {
+        reserved = nextSerial + serial_reserve;
+        journal.append(generation_record(generation, reserved));
+        journal.flush();
+    }
+
+    // Files removed other way than through MTP are noticed here, their names could be given to unrelated files
+    // later
+    void UidIndex::compact()
+    {
+        const auto root = counter.parent_path();
+        for (auto iter = byFilename.begin(); iter != byFilename.end();) {
+            std::error_code error;
+            iter = std::filesystem::exists(root / iter->first, error) ? std::next(iter) : byFilename.erase(iter);
+        }
+        journal.rewrite([this](const Journal::Append &append) {
+            append(generation_record(generation, reserved));
+            for (const auto &[filename, serial] : byFilename) {
+                append(added_record(filename, serial));
+            }
+        });
+    }
+} // namespace mtp
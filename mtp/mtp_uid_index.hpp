@@ -0,0 +1,60 @@
+// Copyright (c) 2017-2023, Mudita Sp. z.o.o. All rights reserved.
+// For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include "mtp_journal.hpp"
+
+namespace mtp
+{
+    /// Persistent unique identifier of an object, as reported in its PersistentUID property
+    struct Uid
+    {
+        std::uint64_t serial;
+        std::uint64_t generation;
+    };
+
+    /// UidIndex assigns files identifiers which stay the same across sessions, so host can match objects with its
+    /// cached metadata. Each new file gets next serial number, generation tells apart indexes created anew, e.g.
+    /// after journal was lost. Generations are counted in a file of their own, next to the journal, so they don't
+    /// depend on the clock. It survives restarts as an append-only journal, like HashIndex. Serials are reserved
+    /// in blocks written at once, while records of assigned ones are buffered, so enumerating many new files
+    /// doesn't write each of them, and serials of records lost on power failure aren't given again.
+    class UidIndex
+    {
+      public:
+        explicit UidIndex(std::filesystem::path journal);
+
+        /// Replay journal, starting a new generation if there's none. It's rewritten when superseded records
+        /// outnumber live ones, records of files gone meanwhile are dropped then.
+        void load();
+
+        /// Identifier of the file, assigned on first request.
+        Uid get(const std::filesystem::path &filename);
+
+        /// Forget the file, identifier isn't ever given again.
+        void remove(const std::filesystem::path &filename);
+
+        /// Move identifier of the file to a new name, replacing one the name had.
+        void rename(const std::filesystem::path &from, const std::filesystem::path &to);
+
+        /// Write identifiers assigned since the last flush.
+        void flush();
+
+      private:
+        void start_generation();
+        void keep_generation();
+        void reserve();
+        void compact();
+
+        Journal journal;
+        std::filesystem::path counter;
+        std::map<std::filesystem::path, std::uint64_t> byFilename;
+        std::uint64_t generation = 0;
+        std::uint64_t nextSerial = 1;
+        std::uint64_t reserved   = 1; ///< serials below are on record as given
+    };
+} // namespace mtp
@@ -56,9 +56,17 @@ static usb_status_t USB_DeviceClassMtpInterruptIn(usb_device_handle handle,
                                       usb_device_endpoint_callback_message_struct_t *message,
                                       void *callbackParam)
 {
-    usb_status_t error = kStatus_USB_Error;
-    PRINTF("%s", __FUNCTION__);
-    return error;
+    usb_device_mtp_struct_t *mtpHandle;
+    mtpHandle = (usb_device_mtp_struct_t *)callbackParam;
+
+    if (!mtpHandle)
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+
+    /* Event is sent, next one may follow */
+    mtpHandle->interruptIn.isBusy = 0;
+    return kStatus_USB_Success;
 }
 
 static usb_status_t USB_DeviceClassMtpBulkIn(usb_device_handle handle,
@@ -519,6 +527,49 @@ usb_status_t USB_DeviceClassMtpRecv(class_handle_t handle, uint8_t ep, uint8_t *
     return error;
 }
 
+usb_status_t USB_DeviceClassMtpCancel(class_handle_t handle, uint8_t ep)
+{
+    usb_status_t error = kStatus_USB_Success;
+    usb_device_mtp_struct_t *mtpHandle;
+    usb_device_mtp_pipe_t *mtpPipe = NULL;
+    uint8_t direction = USB_IN;
+
+    if (!handle)
+    {
+        return kStatus_USB_InvalidHandle;
+    }
+    mtpHandle = (usb_device_mtp_struct_t *)handle;
+
+    if (mtpHandle->bulkIn.ep == ep)
+    {
+        mtpPipe = &(mtpHandle->bulkIn);
+    }
+    else if (mtpHandle->bulkOut.ep == ep)
+    {
+        mtpPipe   = &(mtpHandle->bulkOut);
+        direction = USB_OUT;
+    }
+    else if (mtpHandle->interruptIn.ep == ep)
+    {
+        mtpPipe = &(mtpHandle->interruptIn);
+    }
+    else
+    {
+        return kStatus_USB_InvalidParameter;
+    }
+
+    if (1U == mtpPipe->isBusy)
+    {
+        /* Retires all primed dTDs, pipe callback is called with length set to USB_UNINITIALIZED_VAL_32 */
+        error = USB_DeviceCancel(mtpHandle->handle,
+                                 ep | (direction << USB_DESCRIPTOR_ENDPOINT_ADDRESS_DIRECTION_SHIFT));
+        mtpPipe->isBusy = 0U;
+    }
+    mtpPipe->pipeDataBuffer = (uint8_t *)USB_UNINITIALIZED_VAL_32;
+    mtpPipe->pipeDataLen    = 0U;
+    return error;
+}
+
 int USB_DeviceClassMtpIsBusy(class_handle_t handle, uint8_t ep)
 {
     usb_device_mtp_struct_t *mtpHandle;